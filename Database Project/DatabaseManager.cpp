@@ -2,10 +2,18 @@
 #include <iostream>
 #include <system_error>
 #include <set>
+#include <algorithm>
+#include <cstring>
+#include <climits>
+#include <charconv>
+#include <string_view>
 #include "database_manager.h"
 #include <thread>
 #include <chrono>
 #include "query_parser.h"
+#include "operators.h"
+#include "copy_input.h"
+#include "optimizer.h"
 
 // Get the executable path helper function
 
@@ -43,9 +51,12 @@ DatabaseManager::DatabaseManager(const std::string& catalog_path_rel) {
         if (std::filesystem::exists(this->catalog_path)) {
             catalog.load(this->catalog_path);
         }
+        statistics.load(statisticsPath());
 
         // Load existing indexes
         loadIndexes();
+
+        compactor = std::thread(&DatabaseManager::compactorLoop, this);
     }
     catch (const std::filesystem::filesystem_error& e) {
         std::cerr << "Filesystem error in constructor: " << e.what() << std::endl;
@@ -60,14 +71,22 @@ DatabaseManager::DatabaseManager(const std::string& catalog_path_rel) {
 
 
 DatabaseManager::~DatabaseManager() {
+    {
+        std::lock_guard<std::mutex> lock(compactor_mutex);
+        stop_compactor = true;
+    }
+    compactor_wakeup.notify_one();
+    if (compactor.joinable()) {
+        compactor.join();
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     // Save catalog
     catalog.save(catalog_path);
 
-    // Clean up indexes
-    for (auto& [name, index] : indexes) {
-        delete index;
-    }
-    indexes.clear();
+    // Clean up indexes and write back any cached pages
+    closeAllTables();
+    closeLog();
 }
 
 void ensureWritePermissions(const fs::path& path) {
@@ -100,6 +119,7 @@ bool DatabaseManager::createTable(
     const std::vector<std::tuple<std::string, std::string, int>>& columns,
     const std::string& primary_key,
     const std::map<std::string, std::pair<std::string, std::string>>& foreign_keys) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
 
     // Check if database is selected
     if (current_database.empty()) {
@@ -211,6 +231,7 @@ bool DatabaseManager::createTable(
 
     // Add table to catalog
     catalog.tables.push_back(table);
+    schema_version++;
 
     // Save catalog
     catalog.save(catalog_path);
@@ -244,7 +265,7 @@ void DatabaseManager::createIndex(const TableSchema& schema) {
     std::filesystem::create_directories(indexPath.parent_path());
 
     // Create B+ tree index
-    auto* index = new BPlusTree(schema.index_file_path);
+    auto* index = new BPlusTree(schema.index_file_path, buffer_pool);
     indexes[schema.name] = index;
 }
 
@@ -252,16 +273,398 @@ void DatabaseManager::loadIndexes() {
     for (const auto& table : catalog.tables) {
         std::cout << "Loading index for table " << table.name << " from " << table.index_file_path << std::endl;
         if (std::filesystem::exists(table.index_file_path)) {
-            auto* index = new BPlusTree(table.index_file_path);
+            auto* index = new BPlusTree(table.index_file_path, buffer_pool);
             indexes[table.name] = index;
+            // An empty index over stored rows is left by a COPY cut short before indexing them
+            // while no write-ahead log was open
+            HeapFile* heap = index->isOpen() && index->get_root_offset() < 0 ? openDataFile(table) : nullptr;
+            if (index->isOpen() && (!heap || heap->recordCount() == 0)) {
+                continue;
+            }
         } else {
             std::cout << "Index file does not exist: " << table.index_file_path << std::endl;
         }
+        // Missing or unreadable index: rebuild it from the table data
+        rebuildIndex(table);
+    }
+}
+
+HeapFile* DatabaseManager::openDataFile(const TableSchema& schema) {
+    auto it = data_files.find(schema.name);
+    if (it != data_files.end()) {
+        return it->second;
+    }
+    auto* heap = new HeapFile(buffer_pool, schema.data_file_path);
+    if (!heap->isOpen()) {
+        delete heap;
+        return nullptr;
+    }
+    data_files[schema.name] = heap;
+    return heap;
+}
+
+void DatabaseManager::closeDataFile(const std::string& table_name) {
+    auto it = data_files.find(table_name);
+    if (it != data_files.end()) {
+        delete it->second; // Writes back the table's cached pages
+        data_files.erase(it);
+    }
+}
+
+void DatabaseManager::closeAllTables() {
+    // Leave the files complete on disk so the log can start over empty
+    commitChanges();
+    checkpoint();
+
+    for (auto& [name, index] : indexes) {
+        index->close();
+        delete index;
+    }
+    indexes.clear();
+    for (auto& [name, heap] : data_files) {
+        delete heap;
+    }
+    data_files.clear();
+}
+
+void DatabaseManager::rebuildIndex(const TableSchema& schema) {
+    int primary_key = -1;
+    for (size_t i = 0; i < schema.columns.size(); i++) {
+        if (schema.columns[i].is_primary_key && schema.columns[i].type == Column::INT) {
+            primary_key = static_cast<int>(i);
+            break;
+        }
+    }
+    HeapFile* heap = openDataFile(schema);
+    if (primary_key < 0 || !heap) {
+        return;
+    }
+
+    // Make the log forget the old index file before it is removed
+    commitChanges();
+    checkpoint();
+
+    // Start from an empty index file rather than re-inserting over stale nodes
+    auto it = indexes.find(schema.name);
+    if (it != indexes.end()) {
+        it->second->close();
+        delete it->second;
+        indexes.erase(it);
+    }
+    std::error_code ec;
+    std::filesystem::remove(schema.index_file_path, ec);
+    createIndex(schema);
+
+    BPlusTree* index = indexes[schema.name];
+    std::vector<std::pair<int, int>> entries;
+    HeapScanner scanner(*heap);
+    RecordId rid;
+    const char* data;
+    uint16_t length;
+    while (scanner.next(rid, data, length)) {
+        Row row = loadRow(data, length, schema);
+        entries.emplace_back(std::get<int>(row[primary_key]), packRecordId(rid));
+    }
+
+    // Sorted keys let the tree be built bottom-up instead of one root-to-leaf insert per row
+    std::sort(entries.begin(), entries.end());
+    auto duplicates = std::unique(entries.begin(), entries.end(),
+        [](const auto& a, const auto& b) { return a.first == b.first; });
+    if (duplicates != entries.end()) {
+        std::cerr << "Warning: Table '" << schema.name << "' stores a primary key value more than once; "
+                  << "the index keeps one record per key" << std::endl;
+        entries.erase(duplicates, entries.end());
+    }
+    if (!index->bulkLoad(entries)) {
+        // Never leave the index empty over stored rows: fall back to one insert per key
+        std::cerr << "Bulk load failed for table '" << schema.name << "', inserting keys one by one" << std::endl;
+        for (const auto& [key, rid] : entries) {
+            index->insert(key, rid);
+        }
+    }
+    commitChanges();
+}
+
+BufferPoolStats DatabaseManager::getBufferPoolStats() const {
+    return buffer_pool.getStats();
+}
+
+WalStats DatabaseManager::getWalStats() const {
+    return wal.getStats();
+}
+
+uint64_t DatabaseManager::getSchemaVersion() const {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    return schema_version;
+}
+
+uint64_t DatabaseManager::logCommit() {
+    if (!wal.isOpen()) {
+        buffer_pool.flushAll();
+        return 0;
+    }
+    if (buffer_pool.logDirtyPages() == 0) {
+        return 0;
+    }
+    uint64_t lsn = wal.appendCommit();
+    // A checkpoint writes the log out first, so the commit is durable either way
+    if (wal.size() > WAL_CHECKPOINT_SIZE) {
+        checkpoint();
+    }
+    return lsn;
+}
+
+bool DatabaseManager::waitForCommit(uint64_t lsn) {
+    if (lsn == 0) {
+        return true;
+    }
+    if (!wal.flushTo(lsn)) {
+        std::cerr << "Error: Changes not committed, the write-ahead log could not be written" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseManager::commitChanges() {
+    return waitForCommit(logCommit());
+}
+
+bool DatabaseManager::checkpoint() {
+    if (!wal.isOpen()) {
+        return true;
+    }
+    // The log is the only copy of whatever did not reach the data files
+    if (!buffer_pool.syncAll()) {
+        std::cerr << "Error: Checkpoint failed, keeping the write-ahead log" << std::endl;
+        return false;
+    }
+    wal.truncate();
+    return true;
+}
+
+int DatabaseManager::vacuum(const std::string& table_name) {
+    std::unique_lock<std::recursive_mutex> lock(db_mutex);
+    if (current_database.empty()) {
+        std::cerr << "Error: No database selected. Use 'USE DATABASE' first." << std::endl;
+        return -1;
+    }
+
+    int reclaimed = 0;
+    bool found = false;
+    for (const auto& table : catalog.tables) {
+        if (!table_name.empty() && table.name != table_name) {
+            continue;
+        }
+        found = true;
+        HeapFile* heap = openDataFile(table);
+        if (heap) {
+            // One pass over every page of the table
+            reclaimed += heap->vacuum(heap->pageCount());
+        }
+    }
+    if (!found && !table_name.empty()) {
+        std::cerr << "Table '" << table_name << "' not found" << std::endl;
+        return -1;
+    }
+    uint64_t commit_lsn = logCommit();
+    lock.unlock();
+    if (!waitForCommit(commit_lsn)) {
+        return -1;
+    }
+
+    std::cout << "Vacuum reclaimed " << reclaimed << " records" << std::endl;
+    return reclaimed;
+}
+
+int DatabaseManager::analyze(const std::string& table_name) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    if (current_database.empty()) {
+        std::cerr << "Error: No database selected. Use 'USE DATABASE' first." << std::endl;
+        return -1;
+    }
+
+    int analyzed = 0;
+    bool found = false;
+    for (const auto& table : catalog.tables) {
+        if (!table_name.empty() && table.name != table_name) {
+            continue;
+        }
+        found = true;
+        HeapFile* heap = openDataFile(table);
+        if (!heap) {
+            std::cerr << "Failed to open data file: " << table.data_file_path << std::endl;
+            return -1;
+        }
+
+        int primary_key = -1;
+        for (size_t i = 0; i < table.columns.size(); i++) {
+            if (table.columns[i].is_primary_key && table.columns[i].type == Column::INT) {
+                primary_key = static_cast<int>(i);
+            }
+        }
+        std::vector<DistinctCounter> counters(table.columns.size());
+        TableStatistics result;
+        result.columns.resize(table.columns.size());
+        uint64_t ascending = 0; // Rows whose key is larger than the previous row's
+        int previous_key = 0;
+
+        HeapScanner scanner(*heap);
+        RecordId rid;
+        const char* data;
+        uint16_t length;
+        while (scanner.next(rid, data, length)) {
+            Row row = loadRow(data, length, table);
+            for (size_t i = 0; i < row.size() && i < table.columns.size(); i++) {
+                // std::hash of an int is the int itself; the sketch needs bits spread over 64
+                uint64_t hash = std::hash<FieldValue>{}(row[i]) + 0x9e3779b97f4a7c15ULL;
+                hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+                counters[i].add(hash ^ (hash >> 31));
+
+                double number;
+                if (std::holds_alternative<int>(row[i])) {
+                    number = std::get<int>(row[i]);
+                } else if (std::holds_alternative<float>(row[i])) {
+                    number = std::get<float>(row[i]);
+                } else {
+                    continue;
+                }
+                ColumnStatistics& column = result.columns[i];
+                column.min = column.has_range ? std::min(column.min, number) : number;
+                column.max = column.has_range ? std::max(column.max, number) : number;
+                column.has_range = true;
+            }
+            if (primary_key >= 0) {
+                int key = std::get<int>(row[primary_key]);
+                if (result.rows > 0 && key > previous_key) {
+                    ascending++;
+                }
+                previous_key = key;
+            }
+            result.rows++;
+        }
+
+        for (size_t i = 0; i < counters.size(); i++) {
+            result.columns[i].distinct = counters[i].estimate();
+        }
+        result.pages = heap->pageCount();
+        // Keys in random order rise half of the time, which counts as no clustering at all
+        if (result.rows > 1) {
+            result.key_clustering = std::max(0.0, 2.0 * ascending / (result.rows - 1) - 1);
+        }
+        statistics.tables[table.name] = result;
+        analyzed += static_cast<int>(result.rows);
+    }
+    if (!found && !table_name.empty()) {
+        std::cerr << "Table '" << table_name << "' not found" << std::endl;
+        return -1;
+    }
+    statistics.save(statisticsPath());
+    statistics_version++;
+
+    std::cout << "Analyzed " << analyzed << " rows" << std::endl;
+    return analyzed;
+}
+
+std::string DatabaseManager::statisticsPath() const {
+    if (catalog_path.empty()) {
+        return "";
+    }
+    return (fs::path(catalog_path).parent_path() / "statistics.bin").string();
+}
+
+TableStatistics DatabaseManager::tableStatistics(const TableSchema& schema) {
+    TableStatistics result;
+    auto analyzed = statistics.tables.find(schema.name);
+    if (analyzed != statistics.tables.end() && analyzed->second.columns.size() == schema.columns.size()) {
+        result = analyzed->second;
+    }
+    result.columns.resize(schema.columns.size());
+    uint64_t analyzed_rows = result.rows;
+
+    HeapFile* heap = openDataFile(schema);
+    result.rows = heap ? heap->recordCount() : 0;
+    result.pages = heap ? heap->pageCount() : 0;
+    for (size_t i = 0; i < schema.columns.size(); i++) {
+        ColumnStatistics& column = result.columns[i];
+        // A column that was (nearly) unique stays so as rows are added
+        if (analyzed_rows > 0 && column.distinct * 10 >= analyzed_rows * 9) {
+            column.distinct = result.rows;
+        }
+        column.distinct = std::min<uint64_t>(column.distinct, result.rows);
+
+        if (!schema.columns[i].is_primary_key || schema.columns[i].type != Column::INT) {
+            continue;
+        }
+        column.distinct = result.rows;
+        auto index = indexes.find(schema.name);
+        if (index == indexes.end() || !index->second || index->second->get_root_offset() < 0) {
+            continue;
+        }
+        // The first key of a walk in each direction
+        int key = 0;
+        int offset = 0;
+        BPlusCursor lowest(*index->second, INT_MIN, INT_MAX, BPlusCursor::FORWARD);
+        if (lowest.next(key, offset)) {
+            column.min = key;
+            BPlusCursor highest(*index->second, INT_MIN, INT_MAX, BPlusCursor::BACKWARD);
+            highest.next(key, offset);
+            column.max = key;
+            column.has_range = true;
+        }
+    }
+    return result;
+}
+
+void DatabaseManager::compactorLoop() {
+    std::unique_lock<std::mutex> lock(compactor_mutex);
+    while (!stop_compactor) {
+        compactor_wakeup.wait_for(lock, COMPACT_INTERVAL);
+        if (stop_compactor) {
+            break;
+        }
+        lock.unlock();
+
+        // Small rounds, releasing the database between them so statements are not held up
+        while (!stop_compactor && compactRound()) {
+        }
+
+        lock.lock();
     }
 }
 
+bool DatabaseManager::compactRound() {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    bool more = false;
+    for (auto& [name, heap] : data_files) {
+        if (heap->deadRecords() < COMPACT_THRESHOLD) {
+            continue;
+        }
+        heap->vacuum(COMPACT_PAGES_PER_ROUND);
+        more = more || heap->deadRecords() >= COMPACT_THRESHOLD;
+    }
+    commitChanges();
+    return more;
+}
+
+bool DatabaseManager::openLog(const std::filesystem::path& db_path) {
+    closeLog();
+    // Replays committed pages before any table file is cached
+    if (!wal.open((db_path / "wal.log").string())) {
+        return false;
+    }
+    buffer_pool.attachLog(&wal);
+    return true;
+}
+
+void DatabaseManager::closeLog() {
+    buffer_pool.attachLog(nullptr);
+    wal.close();
+}
+
 
 bool DatabaseManager::insertRecord(const std::string& table_name, const Record& record) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     // Validate table name
     if (table_name.empty()) {
         std::cerr << "Error: Table name cannot be empty" << std::endl;
@@ -292,166 +695,582 @@ bool DatabaseManager::insertRecord(const std::string& table_name, const Record&
             }
         }
     }
-
-    // Validate data types
     for (const auto& [col_name, value] : record) {
-        bool column_found = false;
-        for (const auto& column : schema.columns) {
-            if (column.name == col_name) {
-                column_found = true;
-                // Check if value type matches column type
-                if ((column.type == Column::INT && !std::holds_alternative<int>(value)) ||
-                    (column.type == Column::FLOAT && !std::holds_alternative<float>(value)) ||
-                    (column.type == Column::STRING && !std::holds_alternative<std::string>(value)) ||
-                    (column.type == Column::CHAR && !std::holds_alternative<std::string>(value)) ||
-                    (column.type == Column::BOOL && !std::holds_alternative<bool>(value))) {
-                    std::cerr << "Error: Invalid data type for column '" << col_name << "'" << std::endl;
-                    return false;
-                }
-                
-                // Check string length for STRING and CHAR types
-                if ((column.type == Column::STRING || column.type == Column::CHAR) && 
-                    std::holds_alternative<std::string>(value)) {
-                    const std::string& str_value = std::get<std::string>(value);
-                    if (str_value.length() > static_cast<size_t>(column.length)) {
-                        std::cerr << "Error: String length exceeds maximum length for column '" << col_name << "'" << std::endl;
-                        return false;
-                    }
-                }
-                break;
-            }
-        }
+        bool column_found = std::any_of(schema.columns.begin(), schema.columns.end(),
+            [&](const Column& column) { return column.name == col_name; });
         if (!column_found) {
             std::cerr << "Error: Column '" << col_name << "' does not exist in table '" << table_name << "'" << std::endl;
             return false;
         }
     }
 
-    // Get the primary key value
-    int primary_key_value = 0;
-    std::string primary_key_column;
-    for (const auto& column : schema.columns) {
-        if (column.is_primary_key) {
-            primary_key_column = column.name;
-            if (record.find(primary_key_column) == record.end()) {
-                std::cerr << "Record is missing primary key '" << primary_key_column << "'" << std::endl;
-                return false;
-            }
-            if (column.type == Column::INT) {
-                primary_key_value = std::get<int>(record.at(primary_key_column));
+    // Types, keys and foreign keys are checked with the row
+    return insertRows(table_name, { recordToRow(record, schema) }) == 1;
+}
+
+int DatabaseManager::insertRows(const std::string& table_name, const std::vector<Row>& rows) {
+    std::unique_lock<std::recursive_mutex> lock(db_mutex);
+
+    // Find the table
+    auto table = std::find_if(catalog.tables.begin(), catalog.tables.end(),
+        [&](const TableSchema& schema) { return schema.name == table_name; });
+    if (table == catalog.tables.end()) {
+        std::cerr << "Error: Table '" << table_name << "' not found" << std::endl;
+        return -1;
+    }
+    const TableSchema& schema = *table;
+
+    int key_ordinal = -1;
+    for (size_t i = 0; i < schema.columns.size(); i++) {
+        if (schema.columns[i].is_primary_key) {
+            key_ordinal = static_cast<int>(i);
+            break;
+        }
+    }
+    if (key_ordinal < 0 || schema.columns[key_ordinal].type != Column::INT) {
+        std::cerr << "Primary key must be an integer" << std::endl;
+        return -1;
+    }
+
+    // Validate data types and lengths; (key, row number) pairs are collected on the way
+    std::vector<std::pair<int, size_t>> keys;
+    keys.reserve(rows.size());
+    for (size_t r = 0; r < rows.size(); r++) {
+        const Row& row = rows[r];
+        if (row.size() != schema.columns.size()) {
+            std::cerr << "Error: Row has " << row.size() << " values, table '" << table_name << "' has "
+                      << schema.columns.size() << " columns" << std::endl;
+            return -1;
+        }
+        for (size_t i = 0; i < schema.columns.size(); i++) {
+            const Column& column = schema.columns[i];
+            const FieldValue& value = row[i];
+            // Check if value type matches column type
+            if ((column.type == Column::INT && !std::holds_alternative<int>(value)) ||
+                (column.type == Column::FLOAT && !std::holds_alternative<float>(value)) ||
+                (column.type == Column::STRING && !std::holds_alternative<std::string>(value)) ||
+                (column.type == Column::CHAR && !std::holds_alternative<std::string>(value)) ||
+                (column.type == Column::BOOL && !std::holds_alternative<bool>(value))) {
+                std::cerr << "Error: Invalid data type for column '" << column.name << "'" << std::endl;
+                return -1;
             }
-            else {
-                std::cerr << "Primary key must be an integer" << std::endl;
-                return false;
+
+            // Check string length for STRING and CHAR types
+            if ((column.type == Column::STRING || column.type == Column::CHAR) &&
+                std::get<std::string>(value).length() > static_cast<size_t>(column.length)) {
+                std::cerr << "Error: String length exceeds maximum length for column '" << column.name << "'" << std::endl;
+                return -1;
             }
-            break;
         }
+        keys.emplace_back(std::get<int>(row[key_ordinal]), r);
+    }
+
+    // In key order, duplicates inside the batch are neighbours, and the index is searched and
+    // filled one leaf after the next instead of at random
+    std::sort(keys.begin(), keys.end());
+    for (size_t i = 1; i < keys.size(); i++) {
+        if (keys[i].first == keys[i - 1].first) {
+            std::cerr << "Error: Primary key value " << keys[i].first << " appears more than once" << std::endl;
+            return -1;
+        }
+    }
+
+    // Ensure the index exists
+    if (indexes.find(table_name) == indexes.end()) {
+        createIndex(schema);
+    }
+    BPlusTree* index = indexes[table_name];
+    if (!index) {
+        std::cerr << "Index creation failed for table " << table_name << std::endl;
+        return -1;
     }
 
     // Check if primary key already exists
-    if (indexes.find(table_name) != indexes.end()) {
-        auto existing_offsets = indexes[table_name]->search(primary_key_value);
-        if (!existing_offsets.empty()) {
-            std::cerr << "Error: Primary key value " << primary_key_value << " already exists in table '" << table_name << "'" << std::endl;
-            return false;
+    bool index_empty = index->get_root_offset() < 0;
+    if (!index_empty) {
+        for (const auto& [key, row] : keys) {
+            if (!index->search(key).empty()) {
+                std::cerr << "Error: Primary key value " << key << " already exists in table '" << table_name << "'" << std::endl;
+                return -1;
+            }
         }
     }
 
-    // Check foreign key constraints
-    for (const auto& column : schema.columns) {
-        if (column.is_foreign_key) {
-            // Get the foreign key value
-            if (record.find(column.name) == record.end()) {
-                std::cerr << "Record is missing foreign key '" << column.name << "'" << std::endl;
-                return false;
+    // Check foreign key constraints; each distinct value is looked up once
+    for (size_t i = 0; i < schema.columns.size(); i++) {
+        const Column& column = schema.columns[i];
+        if (!column.is_foreign_key) {
+            continue;
+        }
+        if (column.type != Column::INT) {
+            std::cerr << "Foreign key must be an integer" << std::endl;
+            return -1;
+        }
+        bool ref_found = std::any_of(catalog.tables.begin(), catalog.tables.end(),
+            [&](const TableSchema& ref_schema) { return ref_schema.name == column.references_table; });
+        if (!ref_found) {
+            std::cerr << "Referenced table '" << column.references_table << "' not found for foreign key '" << column.name << "'" << std::endl;
+            return -1;
+        }
+        auto ref_index = indexes.find(column.references_table);
+        if (ref_index == indexes.end() || !ref_index->second) {
+            std::cerr << "No index found for referenced table '" << column.references_table << "'" << std::endl;
+            return -1;
+        }
+
+        std::vector<int> values;
+        values.reserve(rows.size());
+        for (const auto& row : rows) {
+            values.push_back(std::get<int>(row[i]));
+        }
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+        for (int value : values) {
+            // A table referring to itself may refer to rows of the same batch
+            bool in_batch = column.references_table == table_name && std::binary_search(keys.begin(), keys.end(),
+                std::make_pair(value, size_t{ 0 }),
+                [](const auto& a, const auto& b) { return a.first < b.first; });
+            if (!in_batch && ref_index->second->search(value).empty()) {
+                std::cerr << "Foreign key value " << value << " not found in referenced table '" << column.references_table << "'" << std::endl;
+                return -1;
             }
+        }
+    }
 
-            // Find the referenced table
-            TableSchema ref_schema;
-            bool ref_found = false;
-            for (const auto& table : catalog.tables) {
-                if (table.name == column.references_table) {
-                    ref_schema = table;
-                    ref_found = true;
-                    break;
-                }
+    // Open the table's heap file
+    HeapFile* heap = openDataFile(schema);
+    if (!heap) {
+        std::cerr << "Failed to open data file: " << schema.data_file_path << std::endl;
+        return -1;
+    }
+
+    // Append the records in input order, sequentially from the end of the file
+    std::vector<std::string> records;
+    records.reserve(rows.size());
+    for (const auto& row : rows) {
+        records.push_back(encodeRow(row, schema));
+    }
+    std::vector<RecordId> rids;
+    if (!heap->append(records, rids)) {
+        std::cerr << "Failed to write records to data file: " << schema.data_file_path << std::endl;
+        // The statement inserts all of its rows or none: delete the ones already written
+        for (const RecordId& rid : rids) {
+            heap->erase(rid);
+        }
+        commitChanges();
+        return -1;
+    }
+
+    // Index the records in key order; an empty index is built bottom-up
+    std::vector<std::pair<int, int>> entries;
+    entries.reserve(rids.size());
+    for (const auto& [key, row] : keys) {
+        entries.emplace_back(key, packRecordId(rids[row]));
+    }
+    bool bulk = index_empty && !entries.empty();
+    if (bulk && !index->bulkLoad(entries)) {
+        // Never leave the index empty over stored rows: fall back to one insert per key
+        std::cerr << "Bulk load failed for table '" << table_name << "', inserting keys one by one" << std::endl;
+        bulk = false;
+    }
+    if (!bulk) {
+        for (const auto& [key, rid] : entries) {
+            index->insert(key, rid);
+        }
+    }
+
+    // The pages are logged now and written back lazily
+    uint64_t commit_lsn = logCommit();
+    lock.unlock();
+    // Wait for the log without the lock, so that statements committing meanwhile share its sync
+    if (!waitForCommit(commit_lsn)) {
+        return -1;
+    }
+
+    return static_cast<int>(rows.size());
+}
+
+// Encodes one CSV field in the column's on-disk format, as serializeField would encode the
+// value; an INT column's value is also stored in int_value. False if the text is not a value
+// of the column.
+static bool encodeTextField(std::string& buffer, std::string_view text, const Column& column, int& int_value) {
+    const char* text_end = text.data() + text.size();
+    switch (column.type) {
+    case Column::INT: {
+        auto [end, error] = std::from_chars(text.data(), text_end, int_value);
+        if (error != std::errc() || end != text_end) {
+            return false;
+        }
+        buffer.append(reinterpret_cast<const char*>(&int_value), sizeof(int_value));
+        return true;
+    }
+    case Column::FLOAT: {
+        float value = 0.0f;
+        auto [end, error] = std::from_chars(text.data(), text_end, value);
+        if (error != std::errc() || end != text_end) {
+            return false;
+        }
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        return true;
+    }
+    case Column::STRING: {
+        if (text.size() > static_cast<size_t>(column.length)) {
+            return false;
+        }
+        int len = static_cast<int>(text.size());
+        buffer.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        buffer.append(text.data(), text.size());
+        return true;
+    }
+    case Column::CHAR: {
+        if (text.size() > static_cast<size_t>(column.length)) {
+            return false;
+        }
+        buffer.append(text.data(), text.size());
+        buffer.append(column.length - text.size(), '\0');
+        return true;
+    }
+    case Column::BOOL: {
+        bool value = false;
+        if (text == "true" || text == "TRUE" || text == "1") {
+            value = true;
+        } else if (text != "false" && text != "FALSE" && text != "0") {
+            return false;
+        }
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// Checks that a record holds exactly one valid encoded field per column of the schema, and
+// stores the values of its INT columns in int_values
+static bool checkEncodedRecord(const char* data, size_t length, const TableSchema& schema, std::vector<int>& int_values) {
+    const char* cursor = data;
+    const char* end = data + length;
+    for (size_t i = 0; i < schema.columns.size(); i++) {
+        const Column& column = schema.columns[i];
+        size_t available = end - cursor;
+        switch (column.type) {
+        case Column::INT:
+            if (available < sizeof(int)) {
+                return false;
             }
-            if (!ref_found) {
-                std::cerr << "Referenced table '" << column.references_table << "' not found for foreign key '" << column.name << "'" << std::endl;
+            std::memcpy(&int_values[i], cursor, sizeof(int));
+            cursor += sizeof(int);
+            break;
+        case Column::FLOAT:
+            if (available < sizeof(float)) {
                 return false;
             }
-
-            // Get the foreign key value
-            int foreign_key_value = 0;
-            if (column.type == Column::INT) {
-                foreign_key_value = std::get<int>(record.at(column.name));
+            cursor += sizeof(float);
+            break;
+        case Column::STRING: {
+            int len = 0;
+            if (available < sizeof(len)) {
+                return false;
             }
-            else {
-                std::cerr << "Foreign key must be an integer" << std::endl;
+            std::memcpy(&len, cursor, sizeof(len));
+            if (len < 0 || len > column.length || static_cast<size_t>(len) > available - sizeof(len)) {
                 return false;
             }
-
-            // Check if the value exists in the referenced table
-            if (indexes.find(column.references_table) != indexes.end()) {
-                auto ref_offsets = indexes[column.references_table]->search(foreign_key_value);
-                if (ref_offsets.empty()) {
-                    std::cerr << "Foreign key value " << foreign_key_value << " not found in referenced table '" << column.references_table << "'" << std::endl;
-                    return false;
-                }
+            cursor += sizeof(len) + len;
+            break;
+        }
+        case Column::CHAR:
+            if (available < static_cast<size_t>(column.length)) {
+                return false;
             }
-            else {
-                std::cerr << "No index found for referenced table '" << column.references_table << "'" << std::endl;
+            cursor += column.length;
+            break;
+        case Column::BOOL:
+            if (available < 1 || (cursor[0] != 0 && cursor[0] != 1)) {
                 return false;
             }
+            cursor += 1;
+            break;
+        default:
+            return false;
         }
     }
+    return cursor == end;
+}
+
+int DatabaseManager::copyFrom(const std::string& table_name, const std::string& path, const CopyOptions& options) {
+    std::unique_lock<std::recursive_mutex> lock(db_mutex);
+
+    // Find the table
+    auto table = std::find_if(catalog.tables.begin(), catalog.tables.end(),
+        [&](const TableSchema& schema) { return schema.name == table_name; });
+    if (table == catalog.tables.end()) {
+        std::cerr << "Error: Table '" << table_name << "' not found" << std::endl;
+        return -1;
+    }
+    const TableSchema& schema = *table;
+
+    int key_ordinal = -1;
+    for (size_t i = 0; i < schema.columns.size(); i++) {
+        if (schema.columns[i].is_primary_key) {
+            key_ordinal = static_cast<int>(i);
+            break;
+        }
+    }
+    if (key_ordinal < 0 || schema.columns[key_ordinal].type != Column::INT) {
+        std::cerr << "Primary key must be an integer" << std::endl;
+        return -1;
+    }
 
     // Ensure the index exists
     if (indexes.find(table_name) == indexes.end()) {
         createIndex(schema);
     }
+    BPlusTree* index = indexes[table_name];
+    if (!index) {
+        std::cerr << "Index creation failed for table " << table_name << std::endl;
+        return -1;
+    }
+    bool index_empty = index->get_root_offset() < 0;
+
+    // Foreign keys to check, and the values read for them when that happens at the end
+    struct ForeignKeyCheck {
+        size_t ordinal;
+        const Column* column;
+        BPlusTree* index;
+        bool deferred;
+        std::vector<int> values;
+        int last_found = 0;
+        bool found_any = false;
+    };
+    std::vector<ForeignKeyCheck> foreign_keys;
+    for (size_t i = 0; i < schema.columns.size(); i++) {
+        const Column& column = schema.columns[i];
+        if (!column.is_foreign_key) {
+            continue;
+        }
+        if (column.type != Column::INT) {
+            std::cerr << "Foreign key must be an integer" << std::endl;
+            return -1;
+        }
+        bool ref_found = std::any_of(catalog.tables.begin(), catalog.tables.end(),
+            [&](const TableSchema& ref_schema) { return ref_schema.name == column.references_table; });
+        if (!ref_found) {
+            std::cerr << "Referenced table '" << column.references_table << "' not found for foreign key '" << column.name << "'" << std::endl;
+            return -1;
+        }
+        auto ref_index = indexes.find(column.references_table);
+        if (ref_index == indexes.end() || !ref_index->second) {
+            std::cerr << "No index found for referenced table '" << column.references_table << "'" << std::endl;
+            return -1;
+        }
+        bool self_reference = column.references_table == table_name;
+        foreign_keys.push_back({ i, &column, ref_index->second, options.defer_foreign_keys || self_reference, {} });
+    }
+
+    // Open the table's heap file
+    HeapFile* heap = openDataFile(schema);
+    if (!heap) {
+        std::cerr << "Failed to open data file: " << schema.data_file_path << std::endl;
+        return -1;
+    }
+
+    std::unique_ptr<CsvReader> csv;
+    std::unique_ptr<RecordFileReader> binary;
+    bool opened = false;
+    if (options.format == CopyOptions::CSV) {
+        csv = std::make_unique<CsvReader>(path);
+        opened = csv->isOpen();
+    } else {
+        binary = std::make_unique<RecordFileReader>(path, MAX_HEAP_RECORD_SIZE);
+        opened = binary->isOpen();
+    }
+    if (!opened) {
+        std::cerr << "Error: Cannot open '" << path << "'" << std::endl;
+        return -1;
+    }
+    auto position = [&]() {
+        return csv ? "line " + std::to_string(csv->lineNumber()) : "record " + std::to_string(binary->recordNumber());
+    };
+
+    std::vector<std::pair<int, int>> entries; // (key, packed record id) of every row written
+    std::vector<std::string> records;         // Encoded rows waiting to be appended
+    std::vector<int> keys;                    // and their keys
+    size_t batch_bytes = 0;
+    std::string failure;
+
+    auto appendBatch = [&]() {
+        std::vector<RecordId> rids;
+        if (!heap->append(records, rids)) {
+            failure = "Failed to write records to data file: " + schema.data_file_path;
+        }
+        for (size_t i = 0; i < rids.size(); i++) {
+            entries.emplace_back(keys[i], packRecordId(rids[i]));
+        }
+        records.clear();
+        keys.clear();
+        batch_bytes = 0;
+        // The batch's pages are logged while they are still cached, so the pool does not have
+        // to sync the log each time it evicts one of them. The commit record only follows once
+        // the rows are checked and indexed, so after a crash recovery drops the whole load.
+        if (wal.isOpen() && !wal.flushTo(buffer_pool.logStatementPages())) {
+            failure = "The write-ahead log could not be written";
+        }
+    };
+
+    std::vector<std::string_view> fields;
+    std::vector<int> int_values(schema.columns.size());
+    bool skip_header = csv && options.header;
+    while (failure.empty()) {
+        std::string record;
+        if (csv) {
+            if (!csv->next(fields)) {
+                if (!csv->error().empty()) {
+                    failure = position() + ": " + csv->error();
+                }
+                break;
+            }
+            if (skip_header) {
+                skip_header = false;
+                continue;
+            }
+            if (fields.size() != schema.columns.size()) {
+                failure = position() + ": " + std::to_string(fields.size()) + " fields, table '" + table_name +
+                    "' has " + std::to_string(schema.columns.size()) + " columns";
+                break;
+            }
+            for (size_t i = 0; i < fields.size() && failure.empty(); i++) {
+                if (!encodeTextField(record, fields[i], schema.columns[i], int_values[i])) {
+                    failure = position() + ": Invalid value '" + std::string(fields[i]) + "' for column '" +
+                        schema.columns[i].name + "'";
+                }
+            }
+            if (record.size() > MAX_HEAP_RECORD_SIZE && failure.empty()) {
+                failure = position() + ": Row is too large for a page";
+            }
+        } else {
+            const char* data = nullptr;
+            uint32_t length = 0;
+            if (!binary->next(data, length)) {
+                failure = binary->error();
+                break;
+            }
+            if (!checkEncodedRecord(data, length, schema, int_values)) {
+                failure = position() + ": Not a valid row of table '" + table_name + "'";
+            }
+            record.assign(data, length);
+        }
+        if (!failure.empty()) {
+            break;
+        }
 
-    // Make sure directories exist
-    std::filesystem::path dataFilePath(schema.data_file_path);
-    std::filesystem::create_directories(dataFilePath.parent_path());
+        for (auto& foreign_key : foreign_keys) {
+            int value = int_values[foreign_key.ordinal];
+            if (foreign_key.deferred) {
+                foreign_key.values.push_back(value);
+            } else if (!foreign_key.found_any || foreign_key.last_found != value) {
+                if (foreign_key.index->search(value).empty()) {
+                    failure = position() + ": Foreign key value " + std::to_string(value) +
+                        " not found in referenced table '" + foreign_key.column->references_table + "'";
+                    break;
+                }
+                foreign_key.last_found = value;
+                foreign_key.found_any = true;
+            }
+        }
+        if (!failure.empty()) {
+            break;
+        }
 
-    // Open data file in appropriate mode
-    std::ofstream data_file(schema.data_file_path, std::ios::binary | std::ios::app);
-    if (!data_file) {
-        std::cerr << "Failed to open data file: " << schema.data_file_path << std::endl;
-        return false;
+        keys.push_back(int_values[key_ordinal]);
+        batch_bytes += record.size();
+        records.push_back(std::move(record));
+        if (batch_bytes >= COPY_BATCH_BYTES) {
+            appendBatch();
+        }
+    }
+    if (failure.empty() && !records.empty()) {
+        appendBatch();
     }
 
-    // Get current position in file (will be the record offset)
-    int offset = data_file.tellp();
+    // In key order, duplicates in the file are neighbours, and the index is searched and
+    // filled one leaf after the next
+    std::sort(entries.begin(), entries.end());
+    for (size_t i = 1; i < entries.size() && failure.empty(); i++) {
+        if (entries[i].first == entries[i - 1].first) {
+            failure = "Primary key value " + std::to_string(entries[i].first) + " appears more than once";
+        }
+    }
+    for (size_t i = 0; i < entries.size() && failure.empty() && !index_empty; i++) {
+        if (!index->search(entries[i].first).empty()) {
+            failure = "Primary key value " + std::to_string(entries[i].first) + " already exists in table '" + table_name + "'";
+        }
+    }
 
-    // Save the record using the fixed serialization function
-    saveRecord(data_file, record, schema, offset);
-    data_file.close();
+    // Deferred foreign keys: each distinct value is looked up once, rows of a table referring
+    // to itself may refer to rows of the file
+    for (auto& foreign_key : foreign_keys) {
+        std::sort(foreign_key.values.begin(), foreign_key.values.end());
+        foreign_key.values.erase(std::unique(foreign_key.values.begin(), foreign_key.values.end()), foreign_key.values.end());
+        for (size_t i = 0; i < foreign_key.values.size() && failure.empty(); i++) {
+            int value = foreign_key.values[i];
+            bool in_file = foreign_key.index == index && std::binary_search(entries.begin(), entries.end(),
+                std::make_pair(value, 0),
+                [](const auto& a, const auto& b) { return a.first < b.first; });
+            if (!in_file && foreign_key.index->search(value).empty()) {
+                failure = "Foreign key value " + std::to_string(value) + " not found in referenced table '" +
+                    foreign_key.column->references_table + "'";
+            }
+        }
+    }
 
-    // Index the record
-    if (indexes[table_name]) {
-        indexes[table_name]->insert(primary_key_value, offset);
+    if (!failure.empty()) {
+        std::cerr << "Error: COPY into '" << table_name << "' failed, " << failure << std::endl;
+        // Delete the rows already written, in file order
+        std::vector<int> written;
+        written.reserve(entries.size());
+        for (const auto& entry : entries) {
+            written.push_back(entry.second);
+        }
+        std::sort(written.begin(), written.end());
+        for (int rid : written) {
+            heap->erase(unpackRecordId(rid));
+        }
+        commitChanges();
+        return -1;
     }
-    else {
-        std::cerr << "Index creation failed for table " << table_name << std::endl;
-        return false;
+
+    // An empty index is built bottom-up
+    bool bulk = index_empty && !entries.empty();
+    if (bulk && !index->bulkLoad(entries)) {
+        std::cerr << "Bulk load failed for table '" << table_name << "', inserting keys one by one" << std::endl;
+        bulk = false;
+    }
+    if (!bulk) {
+        for (const auto& [key, rid] : entries) {
+            index->insert(key, rid);
+        }
+    }
+    uint64_t commit_lsn = logCommit();
+    lock.unlock();
+    if (!waitForCommit(commit_lsn)) {
+        return -1;
     }
 
-    return true;
+    return static_cast<int>(entries.size());
 }
 
 // Best combined implementation of serializeField
-void DatabaseManager::serializeField(std::ofstream& file, const FieldValue& value, const Column& column) {
+void DatabaseManager::serializeField(std::string& buffer, const FieldValue& value, const Column& column) {
     switch (column.type) {
     case Column::INT: {
         int val = std::get<int>(value);
-        file.write(reinterpret_cast<const char*>(&val), sizeof(val));
+        buffer.append(reinterpret_cast<const char*>(&val), sizeof(val));
         break;
     }
     case Column::FLOAT: {
         float val = std::get<float>(value);
-        file.write(reinterpret_cast<const char*>(&val), sizeof(val));
+        buffer.append(reinterpret_cast<const char*>(&val), sizeof(val));
         break;
     }
     case Column::STRING: {
@@ -461,8 +1280,8 @@ void DatabaseManager::serializeField(std::ofstream& file, const FieldValue& valu
         }
         // No truncation - length check is done in insertRecord
         int len = val.size();
-        file.write(reinterpret_cast<const char*>(&len), sizeof(len));
-        file.write(val.c_str(), len);
+        buffer.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        buffer.append(val.c_str(), len);
         break;
     }
     case Column::CHAR: {
@@ -471,35 +1290,50 @@ void DatabaseManager::serializeField(std::ofstream& file, const FieldValue& valu
             val = std::get<std::string>(value);
         }
         // No truncation - length check is done in insertRecord
-        file.write(val.c_str(), column.length);
+        val.resize(column.length, '\0');
+        buffer.append(val.c_str(), column.length);
         break;
     }
     case Column::BOOL: {
         bool val = std::get<bool>(value);
-        file.write(reinterpret_cast<const char*>(&val), sizeof(val));
+        buffer.append(reinterpret_cast<const char*>(&val), sizeof(val));
         break;
     }
     }
 }
 
+// Copies len bytes out of a record buffer, failing instead of reading past its end
+static bool readBytes(const char*& cursor, const char* end, void* dst, size_t len) {
+    if (static_cast<size_t>(end - cursor) < len) {
+        cursor = end;
+        return false;
+    }
+    std::memcpy(dst, cursor, len);
+    cursor += len;
+    return true;
+}
+
 // Best combined implementation of deserializeField
-FieldValue DatabaseManager::deserializeField(std::ifstream& file, const Column& column) {
+FieldValue DatabaseManager::deserializeField(const char*& cursor, const char* end, const Column& column) {
     switch (column.type) {
     case Column::INT: {
-        int val;
-        file.read(reinterpret_cast<char*>(&val), sizeof(val));
+        int val = 0;
+        readBytes(cursor, end, &val, sizeof(val));
         return val;
     }
     case Column::FLOAT: {
-        float val;
-        file.read(reinterpret_cast<char*>(&val), sizeof(val));
+        float val = 0.0f;
+        readBytes(cursor, end, &val, sizeof(val));
         return val;
     }
     case Column::STRING: {
-        int len;
-        file.read(reinterpret_cast<char*>(&len), sizeof(len));
-        std::string val(len, '\0');
-        file.read(&val[0], len);
+        int len = 0;
+        if (!readBytes(cursor, end, &len, sizeof(len)) || len < 0 || len > end - cursor) {
+            cursor = end;
+            return std::string();
+        }
+        std::string val(cursor, len);
+        cursor += len;
         // Trim null characters
         size_t nullPos = val.find('\0');
         if (nullPos != std::string::npos) {
@@ -509,7 +1343,7 @@ FieldValue DatabaseManager::deserializeField(std::ifstream& file, const Column&
     }
     case Column::CHAR: {
         std::string val(column.length, '\0');
-        file.read(&val[0], column.length);
+        readBytes(cursor, end, &val[0], column.length);
         // Trim null characters
         size_t nullPos = val.find('\0');
         if (nullPos != std::string::npos) {
@@ -518,8 +1352,8 @@ FieldValue DatabaseManager::deserializeField(std::ifstream& file, const Column&
         return val;
     }
     case Column::BOOL: {
-        bool val;
-        file.read(reinterpret_cast<char*>(&val), sizeof(val));
+        bool val = false;
+        readBytes(cursor, end, &val, sizeof(val));
         return val;
     }
     default:
@@ -527,7 +1361,18 @@ FieldValue DatabaseManager::deserializeField(std::ifstream& file, const Column&
     }
 }
 
+void DatabaseManager::skipField(const char*& cursor, const char* end, const Column& column) const {
+    size_t size = getFieldSize(column);
+    if (column.type == Column::STRING) {
+        // Only the length prefix is read; the payload is stepped over
+        int len = 0;
+        size = readBytes(cursor, end, &len, sizeof(len)) && len >= 0 ? len : end - cursor;
+    }
+    cursor += std::min<size_t>(size, end - cursor);
+}
+
 std::vector<Record> DatabaseManager::searchRecords(const std::string& table_name, const std::string& key_column, const FieldValue& key_value) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     std::vector<Record> results;
 
     // Find the table
@@ -548,23 +1393,14 @@ std::vector<Record> DatabaseManager::searchRecords(const std::string& table_name
     }
 
     // Check if the key column is the primary key
-    bool is_primary_key = false;
-    for (const auto& column : schema.columns) {
-        if (column.name == key_column && column.is_primary_key) {
-            is_primary_key = true;
-            break;
-        }
-    }
-
-    // Check if data file exists
-    if (!std::filesystem::exists(schema.data_file_path)) {
-        std::cerr << "Data file not found: " << schema.data_file_path << std::endl;
-        return results;
-    }
-
-    // Open data file for reading
-    std::ifstream data_file(schema.data_file_path, std::ios::binary);
-    if (!data_file) {
+    RowSet rows;
+    rows.columns = columnNames(schema);
+    int key_ordinal = rows.columnIndex(key_column);
+    bool is_primary_key = key_ordinal >= 0 && schema.columns[key_ordinal].is_primary_key;
+
+    // Open the table's heap file
+    HeapFile* heap = openDataFile(schema);
+    if (!heap) {
         std::cerr << "Failed to open data file: " << schema.data_file_path << std::endl;
         return results;
     }
@@ -574,32 +1410,40 @@ std::vector<Record> DatabaseManager::searchRecords(const std::string& table_name
         int key_int = std::get<int>(key_value);
         auto offsets = indexes[table_name]->search(key_int);
 
+        std::string bytes;
         for (int offset : offsets) {
-            data_file.seekg(offset);
-            results.push_back(loadRecord(data_file, schema));
+            if (!heap->read(unpackRecordId(offset), bytes)) {
+                continue;
+            }
+            Row row = loadRow(bytes.data(), bytes.size(), schema);
+            // Only records still holding the key; see findMatches
+            const int* stored = std::get_if<int>(&row[key_ordinal]);
+            if (stored && *stored == key_int) {
+                rows.rows.push_back(std::move(row));
+            }
         }
     }
-    else {
+    else if (key_ordinal >= 0) {
         // Sequential scan
-        data_file.seekg(0, std::ios::end);
-        size_t file_size = data_file.tellg();
-        data_file.seekg(0);
-
-        while (data_file.tellg() < file_size) {
-            size_t record_start = data_file.tellg();
-            Record record = loadRecord(data_file, schema);
+        HeapScanner scanner(*heap, HeapScanner::MAPPED);
+        RecordId rid;
+        const char* data;
+        uint16_t length;
+        while (scanner.next(rid, data, length)) {
+            Row row = loadRow(data, length, schema);
 
             // Check if this record matches the search criteria
-            if (record.find(key_column) != record.end() && record[key_column] == key_value) {
-                results.push_back(record);
+            if (row[key_ordinal] == key_value) {
+                rows.rows.push_back(std::move(row));
             }
         }
     }
 
-    return results;
+    return rows.toRecords();
 }
 
 std::vector<std::string> DatabaseManager::listTables() const {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     std::vector<std::string> table_names;
     for (const auto& table : catalog.tables) {
         table_names.push_back(table.name);
@@ -608,6 +1452,7 @@ std::vector<std::string> DatabaseManager::listTables() const {
 }
 
 TableSchema DatabaseManager::getTableSchema(const std::string& table_name) const {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     for (const auto& table : catalog.tables) {
         if (table.name == table_name) {
             return table;
@@ -628,267 +1473,314 @@ Column::Type DatabaseManager::stringToColumnType(const std::string& type_str) {
     return Column::STRING;
 }
 
-void DatabaseManager::saveRecord(std::ofstream& file, const Record& record, const TableSchema& schema, int& offset) {
-    // Store current position as record start
-    offset = file.tellp();
-
-    // Write each field according to schema
+std::vector<std::string> columnNames(const TableSchema& schema) {
+    std::vector<std::string> names;
+    names.reserve(schema.columns.size());
     for (const auto& column : schema.columns) {
-        if (record.find(column.name) != record.end()) {
-            serializeField(file, record.at(column.name), column);
-        }
-        else {
-            // Write default value if field is missing
-            FieldValue default_value;
-            switch (column.type) {
-            case Column::INT: default_value = 0; break;
-            case Column::FLOAT: default_value = 0.0f; break;
-            case Column::STRING:
-            case Column::CHAR: default_value = std::string(""); break;
-            case Column::BOOL: default_value = false; break;
-            }
-            serializeField(file, default_value, column);
+        names.push_back(column.name);
+    }
+    return names;
+}
+
+int RowSet::columnIndex(const std::string& name) const {
+    for (size_t i = 0; i < columns.size(); i++) {
+        if (columns[i] == name) {
+            return static_cast<int>(i);
         }
     }
+    return -1;
 }
 
-Record DatabaseManager::loadRecord(std::ifstream& file, const TableSchema& schema) {
+Record RowSet::toRecord(size_t row) const {
     Record record;
-
-    for (const auto& column : schema.columns) {
-        record[column.name] = deserializeField(file, column);
+    for (size_t i = 0; i < columns.size() && i < rows[row].size(); i++) {
+        record[columns[i]] = rows[row][i];
     }
-
     return record;
 }
 
-int DatabaseManager::getFieldSize(const Column& column) const {
-    switch (column.type) {
-    case Column::INT: return sizeof(int);
-    case Column::FLOAT: return sizeof(float);
-    case Column::STRING: return sizeof(int) + column.length; // Length + max chars
-    case Column::CHAR: return column.length;
-    case Column::BOOL: return sizeof(bool);
-    default: return 0;
+std::vector<Record> RowSet::toRecords() const {
+    std::vector<Record> records;
+    records.reserve(rows.size());
+    for (size_t i = 0; i < rows.size(); i++) {
+        records.push_back(toRecord(i));
     }
+    return records;
 }
 
-
-std::vector<Record> DatabaseManager::getAllRecords(const std::string& table_name) {
-    std::vector<Record> results;
-
-    // Find the table schema
-    TableSchema schema;
-    bool found = false;
-
-    for (const auto& table : catalog.tables) {
-        if (table.name == table_name) {
-            schema = table;
-            found = true;
-            break;
+Row DatabaseManager::recordToRow(const Record& record, const TableSchema& schema) {
+    Row row;
+    row.reserve(schema.columns.size());
+    for (const auto& column : schema.columns) {
+        auto it = record.find(column.name);
+        if (it != record.end()) {
+            row.push_back(it->second);
+            continue;
+        }
+        // Default value for a missing field
+        switch (column.type) {
+        case Column::INT: row.push_back(0); break;
+        case Column::FLOAT: row.push_back(0.0f); break;
+        case Column::BOOL: row.push_back(false); break;
+        default: row.push_back(std::string()); break;
         }
     }
+    return row;
+}
 
-    if (!found) {
-        std::cerr << "Table '" << table_name << "' not found" << std::endl;
-        return results;
-    }
-
-    // Check if data file exists
-    if (!std::filesystem::exists(schema.data_file_path)) {
-        std::cerr << "Data file not found: " << schema.data_file_path << std::endl;
-        return results;
-    }
+std::string DatabaseManager::encodeRow(const Row& row, const TableSchema& schema) {
+    std::string buffer;
 
-    // Open data file for reading
-    std::ifstream data_file(schema.data_file_path, std::ios::binary);
-    if (!data_file) {
-        std::cerr << "Failed to open data file: " << schema.data_file_path << std::endl;
-        return results;
+    // Write each field according to schema
+    for (size_t i = 0; i < schema.columns.size(); i++) {
+        serializeField(buffer, row[i], schema.columns[i]);
     }
+    return buffer;
+}
 
-    // Read all records from the data file
-    data_file.seekg(0, std::ios::end);
-    size_t file_size = data_file.tellg();
-    data_file.seekg(0);
+Row DatabaseManager::loadRow(const char* data, size_t length, const TableSchema& schema) {
+    Row row;
+    row.reserve(schema.columns.size());
 
-    while (data_file.tellg() < file_size && data_file.good()) {
-        results.push_back(loadRecord(data_file, schema));
+    const char* end = data + length;
+    for (const auto& column : schema.columns) {
+        row.push_back(deserializeField(data, end, column));
     }
 
-    return results;
+    return row;
 }
-// Add these implementations at the end of DatabaseManager.cpp
-
-bool evaluateSingleCondition(const Record& record, const std::string& column, const std::string& op, const FieldValue& value) {
-    if (record.find(column) == record.end()) {
-        return false;
-    }
-
-    const FieldValue& record_value = record.at(column);
 
-    // Handle different comparison operators
-    if (op == "=") {
-        return record_value == value;
-    }
-    else if (op == "!=") {
-        return record_value != value;
-    }
-    else if (op == ">") {
-        if (std::holds_alternative<int>(record_value) && std::holds_alternative<int>(value)) {
-            return std::get<int>(record_value) > std::get<int>(value);
-        }
-        else if (std::holds_alternative<float>(record_value) && std::holds_alternative<float>(value)) {
-            return std::get<float>(record_value) > std::get<float>(value);
-        }
-        // Could add string comparison for lexicographic ordering if needed
-    }
-    else if (op == "<") {
-        if (std::holds_alternative<int>(record_value) && std::holds_alternative<int>(value)) {
-            return std::get<int>(record_value) < std::get<int>(value);
-        }
-        else if (std::holds_alternative<float>(record_value) && std::holds_alternative<float>(value)) {
-            return std::get<float>(record_value) < std::get<float>(value);
+Row DatabaseManager::loadRow(const char* data, size_t length, const TableSchema& schema, const std::vector<bool>& wanted) {
+    Row row;
+    const char* end = data + length;
+    // Nothing after the last wanted column is looked at
+    size_t last = schema.columns.size();
+    while (last > 0 && !wanted[last - 1]) {
+        last--;
+    }
+    for (size_t i = 0; i < last; i++) {
+        if (wanted[i]) {
+            row.push_back(deserializeField(data, end, schema.columns[i]));
+        } else {
+            skipField(data, end, schema.columns[i]);
         }
     }
-    else if (op == ">=") {
-        if (std::holds_alternative<int>(record_value) && std::holds_alternative<int>(value)) {
-            return std::get<int>(record_value) >= std::get<int>(value);
-        }
-        else if (std::holds_alternative<float>(record_value) && std::holds_alternative<float>(value)) {
-            return std::get<float>(record_value) >= std::get<float>(value);
+    return row;
+}
+
+std::vector<bool> DatabaseManager::referencedColumns(
+    const TableSchema& schema,
+    const std::vector<std::string>& names,
+    const std::string& column_prefix) const {
+    bool all = std::find(names.begin(), names.end(), "*") != names.end();
+    std::vector<bool> wanted(schema.columns.size(), all);
+    for (size_t i = 0; i < schema.columns.size() && !all; i++) {
+        const std::string& column = schema.columns[i].name;
+        for (const auto& name : names) {
+            if (name == column || name == schema.name + "." + column || name == column_prefix + column) {
+                wanted[i] = true;
+                break;
+            }
         }
     }
-    else if (op == "<=") {
-        if (std::holds_alternative<int>(record_value) && std::holds_alternative<int>(value)) {
-            return std::get<int>(record_value) <= std::get<int>(value);
-        }
-        else if (std::holds_alternative<float>(record_value) && std::holds_alternative<float>(value)) {
-            return std::get<float>(record_value) <= std::get<float>(value);
+    return wanted;
+}
+
+uint16_t DatabaseManager::fieldOffset(const Row& row, const TableSchema& schema, size_t ordinal) const {
+    uint16_t offset = 0;
+    for (size_t i = 0; i < ordinal; i++) {
+        const Column& column = schema.columns[i];
+        if (column.type == Column::STRING) {
+            size_t length = std::holds_alternative<std::string>(row[i]) ? std::get<std::string>(row[i]).size() : 0;
+            offset += static_cast<uint16_t>(sizeof(int) + length);
+        } else {
+            offset += static_cast<uint16_t>(getFieldSize(column));
         }
     }
-    else if (op == "LIKE" && std::holds_alternative<std::string>(record_value) && std::holds_alternative<std::string>(value)) {
-        // Simple LIKE implementation - could be extended for patterns
-        return std::get<std::string>(record_value).find(std::get<std::string>(value)) != std::string::npos;
+    return offset;
+}
+
+int DatabaseManager::getFieldSize(const Column& column) const {
+    switch (column.type) {
+    case Column::INT: return sizeof(int);
+    case Column::FLOAT: return sizeof(float);
+    case Column::STRING: return sizeof(int) + column.length; // Length + max chars
+    case Column::CHAR: return column.length;
+    case Column::BOOL: return sizeof(bool);
+    default: return 0;
     }
+}
+
 
-    return false;
+std::vector<Record> DatabaseManager::getAllRecords(const std::string& table_name) {
+    return getAllRows(table_name).toRecords();
+}
+
+RowSet DatabaseManager::getAllRows(const std::string& table_name) {
+    LogicalNode scan(LogicalNode::SCAN);
+    scan.table = table_name;
+    std::unique_ptr<RowOperator> plan = Optimizer(*this).open(scan);
+    return plan ? collectRows(*plan) : RowSet();
 }
+// Add these implementations at the end of DatabaseManager.cpp
 
-bool DatabaseManager::evaluateCondition(
-    const Record& record,
+std::vector<Record> DatabaseManager::searchRecordsWithFilter(
+    const std::string& table_name,
     const std::vector<std::tuple<std::string, std::string, FieldValue>>& conditions,
     const std::vector<std::string>& operators) {
+    return searchRowsWithFilter(table_name, conditions, operators).toRecords();
+}
 
-    if (conditions.empty()) {
-        return true; // No conditions means all records match
-    }
-
-    bool result = false;
-    size_t op_index = 0;
-    bool apply_not = false;
-
-    for (size_t i = 0; i < conditions.size(); ++i) {
-        // Check for NOT operator
-        if (op_index < operators.size() && operators[op_index] == "NOT") {
-            apply_not = true;
-            std::cerr << "Applying operator: NOT" << std::endl;
-            op_index++;
-        }
+RowSet DatabaseManager::searchRowsWithFilter(
+    const std::string& table_name,
+    const std::vector<std::tuple<std::string, std::string, FieldValue>>& conditions,
+    const std::vector<std::string>& operators) {
+    auto scan = std::make_unique<LogicalNode>(LogicalNode::SCAN);
+    scan->table = table_name;
+    LogicalNode filter(LogicalNode::FILTER, std::move(scan));
+    filter.conditions = conditions;
+    filter.operators = operators;
+    std::unique_ptr<RowOperator> plan = Optimizer(*this).open(filter);
+    return plan ? collectRows(*plan) : RowSet();
+}
 
-        // Evaluate the current condition
-        bool cond_result = evaluateSingleCondition(
-            record,
-            std::get<0>(conditions[i]),
-            std::get<1>(conditions[i]),
-            std::get<2>(conditions[i])
-        );
+std::vector<std::pair<RecordId, Row>> DatabaseManager::findMatches(
+    const TableSchema& schema,
+    HeapFile& heap,
+    const std::vector<std::tuple<std::string, std::string, FieldValue>>& conditions,
+    const std::vector<std::string>& operators) {
 
-        // Apply NOT if specified
-        if (apply_not) {
-            cond_result = !cond_result;
-            apply_not = false;
+    std::vector<std::pair<RecordId, Row>> matches;
+    AccessPath path = chooseAccessPath(schema, conditions, operators);
+    std::unique_ptr<Predicate> predicate =
+        compilePredicate(columnNames(schema), path.residual_conditions, path.residual_operators);
+
+    // Bounds on the primary key narrow the scan to a slice of the index
+    if (path.kind != AccessPath::FULL_SCAN) {
+        int primary_key = -1;
+        for (size_t i = 0; i < schema.columns.size(); i++) {
+            if (schema.columns[i].is_primary_key && schema.columns[i].type == Column::INT) {
+                primary_key = static_cast<int>(i);
+                break;
+            }
         }
-
-        std::cerr << "Evaluated condition " << i + 1 << ": " << (cond_result ? "true" : "false") << std::endl;
-
-        // Combine with previous result
-        if (i == 0) {
-            result = cond_result;
-        } else {
-            if (op_index >= operators.size()) {
-                std::cerr << "Error: Missing operator for condition " << i + 1 << std::endl;
-                return false;
+        BPlusCursor cursor = indexes[schema.name]->range(path.lo, path.hi);
+        int key, offset;
+        std::string bytes;
+        while (cursor.next(key, offset)) {
+            RecordId rid = unpackRecordId(offset);
+            if (!heap.read(rid, bytes)) {
+                continue;
             }
-            const std::string& op = operators[op_index];
-            std::cerr << "Applying operator: " << op << std::endl;
-            if (op == "AND") {
-                result = result && cond_result;
-            } else if (op == "OR") {
-                result = result || cond_result;
-            } else {
-                std::cerr << "Error: Invalid operator '" << op << "'" << std::endl;
-                return false;
+            Row row = loadRow(bytes.data(), bytes.size(), schema);
+            // An entry that outlived its key must not select another record
+            const int* stored = std::get_if<int>(&row[primary_key]);
+            if (!stored || *stored != key) {
+                continue;
+            }
+            if (predicate->matches(row)) {
+                matches.emplace_back(rid, std::move(row));
             }
-            op_index++;
         }
+        return matches;
     }
 
-    std::cerr << "Final condition result: " << (result ? "true" : "false") << std::endl;
-    return result;
+    // Read all records and apply filter
+    HeapScanner scanner(heap, HeapScanner::MAPPED);
+    RecordId rid;
+    const char* data;
+    uint16_t length;
+    while (scanner.next(rid, data, length)) {
+        Row row = loadRow(data, length, schema);
+
+        // Apply filter conditions
+        if (predicate->matches(row)) {
+            matches.emplace_back(rid, std::move(row));
+        }
+    }
+    return matches;
 }
 
-std::vector<Record> DatabaseManager::searchRecordsWithFilter(
-    const std::string& table_name,
+AccessPath DatabaseManager::chooseAccessPath(
+    const TableSchema& schema,
     const std::vector<std::tuple<std::string, std::string, FieldValue>>& conditions,
     const std::vector<std::string>& operators) {
 
-    std::vector<Record> results;
-
-    // Find the table schema
-    TableSchema schema;
-    bool found = false;
-    for (const auto& table : catalog.tables) {
-        if (table.name == table_name) {
-            schema = table;
-            found = true;
-            break;
-        }
+    AccessPath path;
+    path.residual_conditions = conditions;
+    path.residual_operators = operators;
+    for (size_t i = 0; i < conditions.size(); i++) {
+        path.residual_positions.push_back(i);
     }
 
-    if (!found) {
-        std::cerr << "Table '" << table_name << "' not found" << std::endl;
-        return results;
+    if (indexes.find(schema.name) == indexes.end()) {
+        return path;
     }
 
-    // Check if data file exists
-    if (!std::filesystem::exists(schema.data_file_path)) {
-        std::cerr << "Data file not found: " << schema.data_file_path << std::endl;
-        return results;
+    // Only a pure conjunction can be answered from a single key range
+    for (const auto& op : operators) {
+        if (op != "AND") {
+            return path;
+        }
     }
 
-    // Open data file for reading
-    std::ifstream data_file(schema.data_file_path, std::ios::binary);
-    if (!data_file) {
-        std::cerr << "Failed to open data file: " << schema.data_file_path << std::endl;
-        return results;
+    std::string primary_key_column;
+    for (const auto& column : schema.columns) {
+        if (column.is_primary_key && column.type == Column::INT) {
+            primary_key_column = column.name;
+            break;
+        }
     }
-
-    // Read all records and apply filter
-    data_file.seekg(0, std::ios::end);
-    size_t file_size = data_file.tellg();
-    data_file.seekg(0);
-
-    while (data_file.tellg() < file_size && data_file.good()) {
-        Record record = loadRecord(data_file, schema);
-
-        // Apply filter conditions
-        if (evaluateCondition(record, conditions, operators)) {
-            results.push_back(record);
+    if (primary_key_column.empty()) {
+        return path;
+    }
+
+    long long low = INT_MIN, high = INT_MAX;
+    bool bounded = false;
+    std::vector<std::tuple<std::string, std::string, FieldValue>> residual;
+    std::vector<size_t> residual_positions;
+    for (size_t i = 0; i < conditions.size(); i++) {
+        const auto& [column, op, value] = conditions[i];
+        if (column != primary_key_column || !std::holds_alternative<int>(value)) {
+            residual.push_back(conditions[i]);
+            residual_positions.push_back(i);
+            continue;
+        }
+        long long v = std::get<int>(value);
+        if (op == "=") {
+            low = std::max(low, v);
+            high = std::min(high, v);
+        } else if (op == ">") {
+            low = std::max(low, v + 1);
+        } else if (op == ">=") {
+            low = std::max(low, v);
+        } else if (op == "<") {
+            high = std::min(high, v - 1);
+        } else if (op == "<=") {
+            high = std::min(high, v);
+        } else {
+            residual.push_back(conditions[i]);
+            residual_positions.push_back(i);
+            continue;
         }
+        bounded = true;
+    }
+    if (!bounded) {
+        return path;
     }
 
-    return results;
+    // An empty range still counts: the cursor simply yields nothing
+    path.kind = low == high ? AccessPath::INDEX_POINT : AccessPath::INDEX_RANGE;
+    path.lo = static_cast<int>(std::clamp(low, (long long)INT_MIN, (long long)INT_MAX));
+    path.hi = static_cast<int>(std::clamp(high, (long long)INT_MIN, (long long)INT_MAX));
+    if (low > high) {
+        path.lo = 1;
+        path.hi = 0;
+    }
+    path.residual_operators.assign(residual.empty() ? 0 : residual.size() - 1, "AND");
+    path.residual_conditions = std::move(residual);
+    path.residual_positions = std::move(residual_positions);
+    return path;
 }
 
 bool DatabaseManager::updateRecordsWithFilter(
@@ -896,6 +1788,7 @@ bool DatabaseManager::updateRecordsWithFilter(
     const std::map<std::string, FieldValue>& update_values,
     const std::vector<std::tuple<std::string, std::string, FieldValue>>& conditions,
     const std::vector<std::string>& operators) {
+    std::unique_lock<std::recursive_mutex> lock(db_mutex);
 
     // Find the table schema
     TableSchema schema;
@@ -913,85 +1806,151 @@ bool DatabaseManager::updateRecordsWithFilter(
         return false;
     }
 
-    // Check if data file exists
-    if (!std::filesystem::exists(schema.data_file_path)) {
-        std::cerr << "Data file not found: " << schema.data_file_path << std::endl;
+    // Open the table's heap file
+    HeapFile* heap = openDataFile(schema);
+    if (!heap) {
+        std::cerr << "Failed to open data file: " << schema.data_file_path << std::endl;
         return false;
     }
 
-    // First, read all records and identify which ones need to be updated
-    std::ifstream read_file(schema.data_file_path, std::ios::binary);
-    if (!read_file) {
-        std::cerr << "Failed to open data file: " << schema.data_file_path << std::endl;
-        return false;
+    int primary_key = -1;
+    for (size_t i = 0; i < schema.columns.size(); i++) {
+        if (schema.columns[i].is_primary_key && schema.columns[i].type == Column::INT) {
+            primary_key = static_cast<int>(i);
+            break;
+        }
     }
 
-    // Create a temporary file for the updated data
-    std::string temp_file_path = schema.data_file_path + ".tmp";
-    std::ofstream write_file(temp_file_path, std::ios::binary);
-    if (!write_file) {
-        std::cerr << "Failed to create temporary file" << std::endl;
-        return false;
+    // Check the new values against the schema; only fixed-width, non-key columns can be
+    // patched inside the stored rows
+    bool in_place = true;
+    std::vector<std::pair<size_t, FieldValue>> new_values; // column ordinal -> value
+    for (const auto& [col_name, update_value] : update_values) {
+        auto column = std::find_if(schema.columns.begin(), schema.columns.end(),
+            [&](const Column& c) { return c.name == col_name; });
+        if (column == schema.columns.end()) {
+            std::cerr << "Error: Column '" << col_name << "' does not exist in table '" << table_name << "'" << std::endl;
+            return false;
+        }
+        FieldValue value = update_value;
+        // Integer literals are accepted for FLOAT columns
+        if (column->type == Column::FLOAT && std::holds_alternative<int>(value)) {
+            value = static_cast<float>(std::get<int>(value));
+        }
+        bool type_ok = (column->type == Column::INT && std::holds_alternative<int>(value)) ||
+            (column->type == Column::FLOAT && std::holds_alternative<float>(value)) ||
+            ((column->type == Column::STRING || column->type == Column::CHAR) && std::holds_alternative<std::string>(value)) ||
+            (column->type == Column::BOOL && std::holds_alternative<bool>(value));
+        if (!type_ok) {
+            std::cerr << "Error: Invalid data type for column '" << col_name << "'" << std::endl;
+            return false;
+        }
+        if ((column->type == Column::STRING || column->type == Column::CHAR) &&
+            std::get<std::string>(value).length() > static_cast<size_t>(column->length)) {
+            std::cerr << "Error: String length exceeds maximum length for column '" << col_name << "'" << std::endl;
+            return false;
+        }
+        if (column->type == Column::STRING || column->is_primary_key) {
+            in_place = false;
+        }
+        new_values.emplace_back(column - schema.columns.begin(), std::move(value));
     }
 
-    read_file.seekg(0, std::ios::end);
-    size_t file_size = read_file.tellg();
-    read_file.seekg(0);
+    // First identify the matching records, so that records moved by the update are not visited twice
+    std::vector<std::pair<RecordId, Row>> matches = findMatches(schema, *heap, conditions, operators);
 
-    // Track record offsets for updating the index
-    std::map<int, int> updated_offsets; // original_offset -> new_offset
-    int records_updated = 0;
-    int record_index = 0;
+    // A new primary key goes to one record only, and must not be held by any other record.
+    // Checked before anything is written.
+    if (primary_key >= 0 && indexes.find(table_name) == indexes.end()) {
+        createIndex(schema);
+    }
+    auto index_it = indexes.find(table_name);
+    BPlusTree* index = index_it != indexes.end() ? index_it->second : nullptr;
+    auto new_key = std::find_if(new_values.begin(), new_values.end(),
+        [&](const auto& value) { return static_cast<int>(value.first) == primary_key; });
+    if (primary_key >= 0 && new_key != new_values.end() && !matches.empty()) {
+        int key = std::get<int>(new_key->second);
+        if (matches.size() > 1) {
+            std::cerr << "Error: Primary key value " << key << " would be given to " << matches.size() << " records" << std::endl;
+            return false;
+        }
+        bool unchanged = std::get<int>(matches[0].second[primary_key]) == key;
+        if (!unchanged && index && !index->search(key).empty()) {
+            std::cerr << "Error: Primary key value " << key << " already exists in table '" << table_name << "'" << std::endl;
+            return false;
+        }
+    }
+
+    if (in_place) {
+        // Same row size: overwrite just the changed fields, the index is unaffected
+        int records_updated = 0;
+        for (auto& [rid, row] : matches) {
+            bool ok = true;
+            for (const auto& [ordinal, value] : new_values) {
+                std::string bytes;
+                serializeField(bytes, value, schema.columns[ordinal]);
+                ok = ok && heap->overwrite(rid, fieldOffset(row, schema, ordinal), bytes);
+            }
+            if (ok) {
+                records_updated++;
+            } else {
+                std::cerr << "Failed to update record in table '" << table_name << "'" << std::endl;
+            }
+        }
+        uint64_t commit_lsn = logCommit();
+        lock.unlock();
+        if (!waitForCommit(commit_lsn)) {
+            return false;
+        }
 
-    while (read_file.tellg() < file_size && read_file.good()) {
-        int original_offset = read_file.tellg();
-        Record record = loadRecord(read_file, schema);
+        std::cout << "Updated " << records_updated << " records in place" << std::endl;
+        return true;
+    }
 
-        // Create a new record with updated values if the condition matches
-        Record updated_record = record;
-        bool should_update = evaluateCondition(record, conditions, operators);
+    // Rewrite each match in its slot; only records that had to move or changed key need new
+    // index entries
+    std::map<int, int> updated_offsets; // primary_key -> new record id
+    std::vector<int> removed_keys;
+    int records_updated = 0;
 
-        if (should_update) {
-            // Apply updates
-            for (const auto& [key, value] : update_values) {
-                updated_record[key] = value;
-            }
-            records_updated++;
+    for (auto& [rid, row] : matches) {
+        Row updated_row = row;
+        for (const auto& [ordinal, value] : new_values) {
+            updated_row[ordinal] = value;
         }
 
-        // Write the record (original or updated) to the temporary file
-        int new_offset = write_file.tellp();
-        saveRecord(write_file, updated_record, schema, new_offset);
+        RecordId new_rid;
+        if (!heap->update(rid, encodeRow(updated_row, schema), new_rid)) {
+            std::cerr << "Failed to update record in table '" << table_name << "'" << std::endl;
+            continue;
+        }
+        records_updated++;
 
-        // Store the offset mapping if this record has a primary key
-        // and especially if it was updated (for index update)
-        if (should_update) {
-            // Find primary key
-            for (const auto& column : schema.columns) {
-                if (column.is_primary_key && column.type == Column::INT) {
-                    int pk_value = std::get<int>(updated_record[column.name]);
-                    updated_offsets[pk_value] = new_offset;
-                    break;
-                }
+        if (primary_key >= 0) {
+            if (!(row[primary_key] == updated_row[primary_key])) {
+                removed_keys.push_back(std::get<int>(row[primary_key]));
+                updated_offsets[std::get<int>(updated_row[primary_key])] = packRecordId(new_rid);
+            }
+            else if (!(new_rid == rid)) {
+                updated_offsets[std::get<int>(updated_row[primary_key])] = packRecordId(new_rid);
             }
         }
-
-        record_index++;
     }
 
-    read_file.close();
-    write_file.close();
-
-    // Replace the original file with the temporary file
-    std::filesystem::rename(temp_file_path, schema.data_file_path);
-
-    // Update the index with the new record offsets
-    if (!updated_offsets.empty() && indexes.find(table_name) != indexes.end()) {
-        BPlusTree* index = indexes[table_name];
+    // Update the index with the new keys and record locations
+    if (index) {
+        for (int key : removed_keys) {
+            index->remove(key);
+        }
         for (const auto& [key, new_offset] : updated_offsets) {
             index->insert(key, new_offset);
         }
     }
+    uint64_t commit_lsn = logCommit();
+    lock.unlock();
+    if (!waitForCommit(commit_lsn)) {
+        return false;
+    }
 
     std::cout << "Updated " << records_updated << " records" << std::endl;
     return true;
@@ -1001,6 +1960,7 @@ int DatabaseManager::deleteRecordsWithFilter(
     const std::string& table_name,
     const std::vector<std::tuple<std::string, std::string, FieldValue>>& conditions,
     const std::vector<std::string>& operators) {
+    std::unique_lock<std::recursive_mutex> lock(db_mutex);
 
     // Find the table schema
     TableSchema schema;
@@ -1018,91 +1978,48 @@ int DatabaseManager::deleteRecordsWithFilter(
         return 0;
     }
 
-    // Check if data file exists
-    if (!std::filesystem::exists(schema.data_file_path)) {
-        std::cerr << "Data file not found: " << schema.data_file_path << std::endl;
-        return 0;
-    }
-
-    // First, read all records and identify which ones need to be kept
-    std::ifstream read_file(schema.data_file_path, std::ios::binary);
-    if (!read_file) {
+    // Open the table's heap file
+    HeapFile* heap = openDataFile(schema);
+    if (!heap) {
         std::cerr << "Failed to open data file: " << schema.data_file_path << std::endl;
         return 0;
     }
 
-    // Create a temporary file that will contain only the kept records
-    std::string temp_file_path = schema.data_file_path + ".tmp";
-    std::ofstream write_file(temp_file_path, std::ios::binary);
-    if (!write_file) {
-        std::cerr << "Failed to create temporary file" << std::endl;
-        return 0;
+    int primary_key = -1;
+    for (size_t i = 0; i < schema.columns.size(); i++) {
+        if (schema.columns[i].is_primary_key && schema.columns[i].type == Column::INT) {
+            primary_key = static_cast<int>(i);
+            break;
+        }
     }
 
-    read_file.seekg(0, std::ios::end);
-    size_t file_size = read_file.tellg();
-    read_file.seekg(0);
+    // Identify the records to delete
+    std::vector<std::pair<RecordId, Row>> deleted_records = findMatches(schema, *heap, conditions, operators);
 
-    // Track deleted record primary keys for updating the index
-    std::vector<int> deleted_keys;
-    std::map<int, int> kept_records; // primary_key -> new_offset
+    // Tombstone them and drop their keys; the compactor reclaims the space later.
+    // Open the index if nothing has yet, so the keys cannot outlive their records.
+    if (primary_key >= 0 && indexes.find(table_name) == indexes.end()) {
+        createIndex(schema);
+    }
+    auto index_it = indexes.find(table_name);
+    BPlusTree* index = index_it != indexes.end() ? index_it->second : nullptr;
     int records_deleted = 0;
-
-    while (read_file.tellg() < file_size && read_file.good()) {
-        int original_offset = read_file.tellg();
-        Record record = loadRecord(read_file, schema);
-
-        // Determine if this record should be deleted
-        bool should_delete = evaluateCondition(record, conditions, operators);
-
-        // Find primary key value
-        int primary_key_value = -1;
-        for (const auto& column : schema.columns) {
-            if (column.is_primary_key && column.type == Column::INT) {
-                primary_key_value = std::get<int>(record[column.name]);
-                break;
-            }
-        }
-
-        if (should_delete) {
-            // Add to the list of deleted keys for index update
-            if (primary_key_value != -1) {
-                deleted_keys.push_back(primary_key_value);
-            }
-            records_deleted++;
+    for (auto& [rid, row] : deleted_records) {
+        if (!heap->markDeleted(rid)) {
+            continue;
         }
-        else {
-            // Keep this record
-            int new_offset = write_file.tellp();
-            saveRecord(write_file, record, schema, new_offset);
-
-            // Update the offset mapping for the index
-            if (primary_key_value != -1) {
-                kept_records[primary_key_value] = new_offset;
-            }
+        records_deleted++;
+        if (index && primary_key >= 0) {
+            index->remove(std::get<int>(row[primary_key]));
         }
     }
-
-    read_file.close();
-    write_file.close();
-
-    // Replace the original file with the temporary file
-    std::filesystem::rename(temp_file_path, schema.data_file_path);
-
-    // Rebuild the index with the kept records
-    if (indexes.find(table_name) != indexes.end() && !kept_records.empty()) {
-        // It might be simpler to rebuild the index completely
-        delete indexes[table_name];
-
-        // Create a new index
-        auto* new_index = new BPlusTree(schema.index_file_path);
-
-        // Insert all kept records
-        for (const auto& [key, offset] : kept_records) {
-            new_index->insert(key, offset);
-        }
-
-        indexes[table_name] = new_index;
+    if (heap->deadRecords() >= COMPACT_THRESHOLD) {
+        compactor_wakeup.notify_one();
+    }
+    uint64_t commit_lsn = logCommit();
+    lock.unlock();
+    if (!waitForCommit(commit_lsn)) {
+        return -1;
     }
 
     std::cout << "Deleted " << records_deleted << " records" << std::endl;
@@ -1115,89 +2032,33 @@ std::vector<Record> DatabaseManager::joinTables(
     const Condition& join_condition,
     const std::vector<std::tuple<std::string, std::string, FieldValue>>& where_conditions,
     const std::vector<std::string>& where_operators) {
-    
-    std::vector<Record> results;
-    
-   TableSchema schema1, schema2;
-bool found1 = false, found2 = false;
-for (const auto& table : catalog.tables) {
-    if (table.name == table1_name) {
-        schema1 = table;
-        found1 = true;
-    } else if (table.name == table2_name) {
-        schema2 = table;
-        found2 = true;
-    }
-}
-    
-    if (!found1) {
-        std::cerr << "Table '" << table1_name << "' not found" << std::endl;
-        return results;
-    }
-    if (!found2) {
-        std::cerr << "Table '" << table2_name << "' not found" << std::endl;
-        return results;
-    }
-    
-    // Get all records from both tables
-    std::vector<Record> records1 = getAllRecords(table1_name);
-    std::vector<Record> records2 = getAllRecords(table2_name);
-    
-    // Extract join condition columns
-    std::string left_col = join_condition.column; // e.g., users.id
-    std::string right_col = std::holds_alternative<std::string>(join_condition.value)
-        ? std::get<std::string>(join_condition.value) // e.g., orders.user_id
-        : "";
-    
-    // Validate join condition columns
-    std::string left_table = left_col.substr(0, left_col.find('.'));
-    std::string left_col_name = left_col.substr(left_col.find('.') + 1);
-    std::string right_table = right_col.substr(0, right_col.find('.'));
-    std::string right_col_name = right_col.substr(right_col.find('.') + 1);
-    
-    bool left_valid = false, right_valid = false;
-    for (const auto& col : schema1.columns) {
-        if (col.name == left_col_name && left_table == table1_name) {
-            left_valid = true;
-            break;
-        }
-    }
-    for (const auto& col : schema2.columns) {
-        if (col.name == right_col_name && right_table == table2_name) {
-            right_valid = true;
-            break;
-        }
-    }
-    
-    if (!left_valid || !right_valid) {
-        std::cerr << "Error: Invalid join condition columns: " << left_col << " = " << right_col << std::endl;
-        return results;
-    }
-    
-    // Perform nested loop join
-    for (const auto& rec1 : records1) {
-        for (const auto& rec2 : records2) {
-            // Check join condition (equality)
-            if (rec1.find(left_col_name) != rec1.end() && rec2.find(right_col_name) != rec2.end()) {
-                if (rec1.at(left_col_name) == rec2.at(right_col_name)) {
-                    // Combine records
-                    Record combined;
-                    for (const auto& [key, value] : rec1) {
-                        combined[table1_name + "." + key] = value;
-                    }
-                    for (const auto& [key, value] : rec2) {
-                        combined[table2_name + "." + key] = value;
-                    }
-                    
-                    // Apply WHERE conditions if any
-                    if (where_conditions.empty() || evaluateCondition(combined, where_conditions, where_operators)) {
-                        results.push_back(combined);
-                    }
-                }
-            }
-        }
-    }
-    
+    return joinRows(table1_name, table2_name, join_condition, where_conditions, where_operators).toRecords();
+}
+
+RowSet DatabaseManager::joinRows(
+    const std::string& table1_name,
+    const std::string& table2_name,
+    const Condition& join_condition,
+    const std::vector<std::tuple<std::string, std::string, FieldValue>>& where_conditions,
+    const std::vector<std::string>& where_operators) {
+    // The join condition compares two "table.column" names, e.g. users.id = orders.user_id
+    auto join = std::make_unique<LogicalNode>(LogicalNode::JOIN);
+    join->left_column = join_condition.column;
+    if (std::holds_alternative<std::string>(join_condition.value)) {
+        join->right_column = std::get<std::string>(join_condition.value);
+    }
+    for (const std::string& table_name : { table1_name, table2_name }) {
+        join->inputs.push_back(std::make_unique<LogicalNode>(LogicalNode::SCAN));
+        join->inputs.back()->table = table_name;
+    }
+    LogicalNode filter(LogicalNode::FILTER, std::move(join));
+    filter.conditions = where_conditions;
+    filter.operators = where_operators;
+    std::unique_ptr<RowOperator> plan = Optimizer(*this).open(filter);
+    if (!plan) {
+        return RowSet();
+    }
+    RowSet results = collectRows(*plan);
     std::cout << "Joined " << results.size() << " records" << std::endl;
     return results;
 }
@@ -1265,6 +2126,7 @@ std::filesystem::path DatabaseManager::getDatabasePath(const std::string& db_nam
 }
 
 bool DatabaseManager::dropDatabase(const std::string& db_name) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     std::filesystem::path dbDir = getDatabasePath(db_name);
 
     if (!std::filesystem::exists(dbDir)) {
@@ -1276,8 +2138,11 @@ bool DatabaseManager::dropDatabase(const std::string& db_name) {
     if (current_database == db_name) {
         current_database.clear();
         catalog.tables.clear();  // Clear the catalog
-        indexes.clear();         // Clear all indexes
+        schema_version++;
+        closeAllTables();        // Close all indexes and data files
+        closeLog();
         catalog_path.clear();    // Clear catalog path
+        statistics.tables.clear();
     }
 
     try {
@@ -1295,6 +2160,7 @@ bool DatabaseManager::dropDatabase(const std::string& db_name) {
 
 
 bool DatabaseManager::useDatabase(const std::string& db_name) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     // Check if already using this database
     if (current_database == db_name) {
         std::cout << "Already using database: " << db_name << std::endl;
@@ -1311,16 +2177,18 @@ bool DatabaseManager::useDatabase(const std::string& db_name) {
     // Clear existing context
     current_database.clear();
     catalog.tables.clear();
-    for (auto& index : indexes) {
-        index.second->close();
-        delete index.second;
+    schema_version++;
+    closeAllTables();
+    if (!openLog(db_path)) {
+        std::cerr << "Failed to open the write-ahead log of database '" << db_name << "'" << std::endl;
+        return false;
     }
-    indexes.clear();
 
     // Set new database
     current_database = db_name;
     catalog_path = (db_path / "catalog.bin").string(); // Convert path to string
     catalog.load(catalog_path);
+    statistics.load(statisticsPath());
     std::cout << "Switching to database: " << db_name << std::endl;
 
     // Load indexes
@@ -1331,6 +2199,7 @@ bool DatabaseManager::useDatabase(const std::string& db_name) {
 }
 
 bool DatabaseManager::dropTable(const std::string& table_name) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     if (current_database.empty()) {
         std::cerr << "No database selected. Use 'USE DATABASE' first." << std::endl;
         return false;
@@ -1356,6 +2225,11 @@ bool DatabaseManager::dropTable(const std::string& table_name) {
     std::string saved_database = current_database;
 
     try {
+        // Make the log forget the table's pages before its files are removed
+        if (!commitChanges() || !checkpoint()) {
+            return false;
+        }
+
         // Close and remove the index from memory
         auto it = indexes.find(table_name);
         if (it != indexes.end()) {
@@ -1364,8 +2238,10 @@ bool DatabaseManager::dropTable(const std::string& table_name) {
             indexes.erase(it);
             std::cout << "Closed and removed index for table: " << table_name << std::endl;
         }
+        closeDataFile(table_name);
 
         // Remove table from catalog first
+        schema_version++;
         if (!catalog.removeTable(table_name)) {
             std::cerr << "Failed to remove table from catalog." << std::endl;
             current_database = saved_database;
@@ -1374,11 +2250,12 @@ bool DatabaseManager::dropTable(const std::string& table_name) {
 
         // Save the updated catalog
         catalog.save(catalog_path);
+        statistics.tables.erase(table_name);
+        statistics.save(statisticsPath());
         std::cout << "Catalog updated for table: " << table_name << std::endl;
 
         // Clear database context to prevent reloading
         current_database.clear(); // Temporarily "unuse" database
-        indexes.clear(); // Ensure no indexes remain active
         std::cout << "Cleared database context for table: " << table_name << std::endl;
 
         // Delete the table's data file
@@ -1444,5 +2321,6 @@ std::vector<std::string> DatabaseManager::listDatabases() const {
 }
 
 std::string DatabaseManager::getCurrentDatabase() const {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     return current_database;
 }
\ No newline at end of file
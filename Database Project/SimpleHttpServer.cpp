@@ -2,6 +2,7 @@
 #include <iostream>
 #include <sstream>
 #include "../third_party/json.hpp"
+#include "operators.h"
 #include "query_parser.h"
 
 using json = nlohmann::json;
@@ -22,35 +23,41 @@ SimpleHttpServer::~SimpleHttpServer() {
 
 void SimpleHttpServer::start() {
     running = true;
-    serverThread = std::thread(&SimpleHttpServer::run, this);
+    startAccept();
+    for (size_t i = 0; i < HTTP_SERVER_THREADS; i++) {
+        serverThreads.emplace_back(&SimpleHttpServer::run, this);
+    }
     std::cout << "HTTP Server listening on port " << acceptor.local_endpoint().port() << std::endl;
 }
 
 void SimpleHttpServer::stop() {
     running = false;
     ioc.stop();
-    if (serverThread.joinable()) {
-        serverThread.join();
+    for (auto& thread : serverThreads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
     }
+    serverThreads.clear();
 }
 
 void SimpleHttpServer::run() {
-    startAccept();
     ioc.run();
 }
 
 void SimpleHttpServer::startAccept() {
     auto socket = std::make_shared<tcp::socket>(ioc);
     acceptor.async_accept(*socket, [this, socket](boost::system::error_code ec) {
+        // Wait for the next connection first, so another thread serves it meanwhile
+        if (running) {
+            startAccept();
+        }
         if (!ec) {
             beast::flat_buffer buffer;
             http::request<http::string_body> req;
             http::read(*socket, buffer, req);
             handleRequest(std::move(req), *socket);
         }
-        if (running) {
-            startAccept();
-        }
     });
 }
 
@@ -62,25 +69,60 @@ void SimpleHttpServer::handleRequest(http::request<http::string_body>&& req, tcp
 
     try {
         if (req.method() == http::verb::post) {
-            if (req.target() == "/query") {
+            if (req.target() == "/query" || req.target() == "/execute") {
                 auto json_data = json::parse(req.body());
-                std::string query = json_data["query"];
-                
-                // Create a new QueryParser for each request
-                QueryParser parser(dbManager);
-                
+
+                // Create a new QueryParser for each request; prepared statements outlive it
+                QueryParser parser(dbManager, &prepared_statements);
+
                 json response;
-                if (parser.parse(query)) {
-                    if (parser.execute()) {
+                bool parsed = false;
+                std::string parse_error = "Invalid query syntax";
+                if (req.target() == "/query") {
+                    std::string query = json_data["query"];
+                    parsed = parser.parse(query);
+                } else {
+                    // A statement from an earlier PREPARE and its parameters, e.g.
+                    // {"statement": "find_user", "params": [42, "ann"]}
+                    std::string statement = json_data["statement"];
+                    std::vector<FieldValue> parameters;
+                    parse_error.clear();
+                    for (const auto& param : json_data.value("params", json::array())) {
+                        if (param.is_boolean()) {
+                            parameters.push_back(param.get<bool>());
+                        } else if (param.is_number_integer()) {
+                            parameters.push_back(param.get<int>());
+                        } else if (param.is_number()) {
+                            parameters.push_back(param.get<float>());
+                        } else if (param.is_string()) {
+                            parameters.push_back(param.get<std::string>());
+                        } else {
+                            parse_error = "Parameters must be numbers, strings or booleans";
+                        }
+                    }
+                    if (parse_error.empty()) {
+                        parsed = parser.bind(statement, std::move(parameters));
+                        parse_error = parser.current_query.error_message;
+                    }
+                }
+                if (parsed) {
+                    // HTTP/1.1 clients get SELECT rows in a chunked response, without the whole
+                    // result set held in memory
+                    if (parser.execute(req.version() >= 11)) {
+                        if (parser.current_query.cursor) {
+                            streamResults(parser.current_query, req.version(), socket);
+                            return;
+                        }
                         response["success"] = true;
-                        // Convert Record objects to JSON
+                        // Convert rows to JSON objects keyed by column name
+                        const RowSet& rows = parser.current_query.results;
                         json results_array = json::array();
-                        for (const auto& record : parser.current_query.results) {
+                        for (const auto& row : rows.rows) {
                             json record_obj;
-                            for (const auto& [key, value] : record) {
+                            for (size_t i = 0; i < rows.columns.size(); i++) {
                                 std::visit([&](const auto& val) {
-                                    record_obj[key] = val;
-                                }, value);
+                                    record_obj[rows.columns[i]] = val;
+                                }, row[i]);
                             }
                             results_array.push_back(record_obj);
                         }
@@ -93,7 +135,7 @@ void SimpleHttpServer::handleRequest(http::request<http::string_body>&& req, tcp
                     }
                 } else {
                     response["success"] = false;
-                    response["error_message"] = "Invalid query syntax";
+                    response["error_message"] = parse_error;
                 }
                 res.body() = response.dump();
             }
@@ -130,6 +172,26 @@ void SimpleHttpServer::handleRequest(http::request<http::string_body>&& req, tcp
                 response["records_found"] = tables.size();
                 res.body() = response.dump();
             }
+            else if (req.target() == "/stats") {
+                BufferPoolStats stats = dbManager.getBufferPoolStats();
+                json response;
+                response["success"] = true;
+                response["buffer_pool"] = {
+                    {"hits", stats.hits},
+                    {"misses", stats.misses},
+                    {"evictions", stats.evictions},
+                    {"writebacks", stats.writebacks},
+                    {"hit_rate", stats.hitRate()}
+                };
+                WalStats wal_stats = dbManager.getWalStats();
+                response["wal"] = {
+                    {"page_records", wal_stats.page_records},
+                    {"undo_records", wal_stats.undo_records},
+                    {"commits", wal_stats.commits},
+                    {"syncs", wal_stats.syncs}
+                };
+                res.body() = response.dump();
+            }
         }
     }
     catch (const std::exception& e) {
@@ -142,4 +204,72 @@ void SimpleHttpServer::handleRequest(http::request<http::string_body>&& req, tcp
 
     res.prepare_payload();
     http::write(socket, res);
+}
+
+void SimpleHttpServer::streamResults(Query& query, unsigned version, tcp::socket& socket) {
+    // Read every row first; the socket may block, and the scans hold the database lock
+    const std::vector<std::string> columns = query.cursor->columns();
+    RowBatch buffered;
+    std::unique_ptr<SpillFile> spilled;
+    RowBatch batch;
+    while (query.cursor->next(batch)) {
+        for (auto& row : batch) {
+            if (buffered.size() < STREAM_MEMORY_ROWS) {
+                buffered.push_back(std::move(row));
+                continue;
+            }
+            if (!spilled) {
+                spilled = std::make_unique<SpillFile>();
+            }
+            spilled->write(row);
+        }
+    }
+    // Release the scan, and with it the database lock, before the response is written
+    query.cursor.reset();
+    if (spilled) {
+        spilled->rewind();
+    }
+
+    http::response<http::empty_body> res{http::status::ok, version};
+    res.set(http::field::server, "Simple HTTP Server");
+    res.set(http::field::content_type, "application/json");
+    res.set(http::field::access_control_allow_origin, "*");
+    res.chunked(true);
+    http::response_serializer<http::empty_body> serializer{res};
+    http::write_header(socket, serializer);
+
+    // Same document as a buffered /query response, written a batch of rows at a time
+    std::string chunk = "{\"success\":true,\"results\":[";
+    size_t records_found = 0;
+    auto append = [&](const Row& row) {
+        json record_obj;
+        for (size_t i = 0; i < columns.size(); i++) {
+            std::visit([&](const auto& val) {
+                record_obj[columns[i]] = val;
+            }, row[i]);
+        }
+        if (records_found++ > 0) {
+            chunk += ',';
+        }
+        chunk += record_obj.dump();
+        if (records_found % ROW_BATCH_SIZE == 0) {
+            net::write(socket, http::make_chunk(net::buffer(chunk)));
+            chunk.clear();
+        }
+    };
+    for (const auto& row : buffered) {
+        append(row);
+    }
+    Row row;
+    while (spilled && spilled->read(row)) {
+        append(row);
+    }
+
+    json trailer_fields;
+    trailer_fields["error_message"] = records_found == 0 ? query.empty_message : query.error_message;
+    trailer_fields["records_found"] = records_found;
+    std::string tail = trailer_fields.dump();
+    chunk += "]," + tail.substr(1);
+    net::write(socket, http::make_chunk(net::buffer(chunk)));
+    net::write(socket, http::make_chunk_last());
 }
\ No newline at end of file
@@ -4,25 +4,41 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
+#include <atomic>
 #include <string>
 #include <thread>
 #include <memory>
+#include <vector>
 #include "database_manager.h"
+#include "query_parser.h"
 
 namespace beast = boost::beast;
 namespace http = beast::http;
 namespace net = boost::asio;
 using tcp = boost::asio::ip::tcp;
 
+// Rows of a streamed result held in memory; any further rows wait in a spill file
+constexpr size_t STREAM_MEMORY_ROWS = 64 * ROW_BATCH_SIZE;
+// Connections served at once. Statements still run one at a time under the database lock,
+// but their commits overlap, so they can share a write-ahead log sync.
+constexpr size_t HTTP_SERVER_THREADS = 4;
+
 class SimpleHttpServer {
 private:
     DatabaseManager& dbManager;
     net::io_context ioc;
     tcp::acceptor acceptor;
-    std::thread serverThread;
-    bool running;
+    std::vector<std::thread> serverThreads;
+    std::atomic<bool> running;
+    // Kept across requests, for EXECUTE and /execute
+    PreparedStatements prepared_statements;
 
     void handleRequest(http::request<http::string_body>&& req, tcp::socket& socket);
+    // Sends the rows of an executed query's cursor as a chunked /query response, one chunk
+    // per batch. The cursor is drained, past STREAM_MEMORY_ROWS into a spill file, before
+    // anything is written, so a slow client never stalls the database while the scans hold
+    // its lock.
+    void streamResults(Query& query, unsigned version, tcp::socket& socket);
     void startAccept();
     void run();
 
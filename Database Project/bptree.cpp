@@ -1,24 +1,64 @@
 #include "bptree.h"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
-BPlusTree::BPlusTree(const std::string& index_file) : root_offset(-1), is_closed(false) {
+namespace {
+
+constexpr uint32_t BPTREE_MAGIC = 0x45455254; // "TREE"
+constexpr uint32_t META_PAGE = 0;
+constexpr int MAX_TREE_DEPTH = 64;
+
+// Stored in the data area of page 0
+struct BPlusMeta {
+    uint32_t magic;
+    uint32_t root_page; // 0 while the tree is empty
+    uint32_t max_keys;
+};
+
+} // namespace
+
+BPlusTree::BPlusTree(const std::string& index_file, BufferPool& pool, int max_keys)
+    : pool(pool), file_id(-1), root_page(0), max_keys(std::clamp(max_keys, 3, FANOUT)), is_closed(false) {
     std::filesystem::path indexPath(index_file);
     std::filesystem::create_directories(indexPath.parent_path());
 
-    file.open(index_file, std::ios::binary | std::ios::in | std::ios::out);
-    if (!file) {
+    if (!std::filesystem::exists(index_file)) {
         std::cout << "Creating new index file: " << index_file << std::endl;
-        file.clear();
-        file.open(index_file, std::ios::binary | std::ios::out | std::ios::trunc);
-        file.close();
-        file.open(index_file, std::ios::binary | std::ios::in | std::ios::out);
+    }
+    file_id = pool.openFile(index_file);
+    if (file_id < 0) {
+        is_closed = true;
+        return;
+    }
+
+    if (pool.fileSize(file_id) == 0) {
+        uint32_t page_no;
+        Page* meta = pool.newPage(file_id, page_no);
+        if (!meta) {
+            close();
+            return;
+        }
+        std::memset(meta, 0, sizeof(Page));
+        pool.unpinPage(file_id, page_no, true);
+        write_meta();
+        return;
     }
 
-    file.seekg(0, std::ios::end);
-    if (file.tellg() >= sizeof(root_offset)) {
-        file.seekg(0);
-        file.read(reinterpret_cast<char*>(&root_offset), sizeof(root_offset));
+    Page* page = pool.fetchPage(file_id, META_PAGE);
+    BPlusMeta meta{};
+    if (page) {
+        std::memcpy(&meta, page->data, sizeof(meta));
+        pool.unpinPage(file_id, META_PAGE, false);
+    }
+    if (meta.magic != BPTREE_MAGIC || pool.fileSize(file_id) % PAGE_SIZE != 0) {
+        std::cerr << "Error: '" << index_file << "' is not a B+ tree index file" << std::endl;
+        pool.closeFile(file_id);
+        is_closed = true;
+        return;
     }
+    root_page = meta.root_page;
+    this->max_keys = std::clamp(static_cast<int>(meta.max_keys), 3, FANOUT);
 }
 
 BPlusTree::~BPlusTree() {
@@ -26,302 +66,505 @@ BPlusTree::~BPlusTree() {
 }
 
 int BPlusTree::get_root_offset() const {
-    return root_offset;
+    return root_page == 0 ? -1 : static_cast<int>(root_page);
 }
 
-BPlusNode BPlusTree::get_node(int offset) const {
-    return read_node(offset);
+BPlusNodeHeader* BPlusTree::node_header(Page* page) {
+    return reinterpret_cast<BPlusNodeHeader*>(page->data);
 }
 
-BPlusNode BPlusTree::read_node(int offset) const {
-    if (is_closed) {
-        std::cerr << "Error: Attempt to read from closed BPlusTree file" << std::endl;
-        return BPlusNode();
-    }
-    BPlusNode node;
-    file.seekg(offset);
-    if (!file) {
-        std::cerr << "Error: Failed to seek to offset " << offset << std::endl;
-        file.clear();
-        return node;
-    }
-    // Rest unchanged
-    file.read(reinterpret_cast<char*>(&node.is_leaf), sizeof(node.is_leaf));
-    file.read(reinterpret_cast<char*>(&node.parent), sizeof(node.parent));
-    int key_count;
-    file.read(reinterpret_cast<char*>(&key_count), sizeof(key_count));
-    if (key_count < 0 || key_count > FANOUT) {
-        std::cerr << "Corrupted key_count at offset " << offset << ": " << key_count << std::endl;
-        file.clear();
-        return node;
-    }
-    node.keys.resize(key_count);
-    file.read(reinterpret_cast<char*>(node.keys.data()), key_count * sizeof(int));
-    if (node.is_leaf) {
-        node.data_ptrs.resize(key_count);
-        file.read(reinterpret_cast<char*>(node.data_ptrs.data()), key_count * sizeof(int));
-    } else {
-        node.children.resize(key_count + 1);
-        file.read(reinterpret_cast<char*>(node.children.data()), (key_count + 1) * sizeof(int));
+int32_t* BPlusTree::node_keys(Page* page) {
+    return reinterpret_cast<int32_t*>(page->data + sizeof(BPlusNodeHeader));
+}
+
+int32_t* BPlusTree::node_values(Page* page) {
+    return node_keys(page) + FANOUT;
+}
+
+Page* BPlusTree::new_node(uint32_t& page_id, bool is_leaf) {
+    Page* page = pool.newPage(file_id, page_id);
+    if (!page) {
+        std::cerr << "Error: Failed to allocate B+ tree node" << std::endl;
+        return nullptr;
     }
-    return node;
+    std::memset(page, 0, sizeof(Page));
+    node_header(page)->is_leaf = is_leaf ? 1 : 0;
+    return page;
 }
 
-void BPlusTree::write_node(int offset, const BPlusNode& node) {
+void BPlusTree::write_meta() {
+    Page* page = pool.fetchPage(file_id, META_PAGE);
+    if (!page) {
+        return;
+    }
+    BPlusMeta meta{ BPTREE_MAGIC, root_page, static_cast<uint32_t>(max_keys) };
+    std::memcpy(page->data, &meta, sizeof(meta));
+    pool.unpinPage(file_id, META_PAGE, true);
+}
+
+uint32_t BPlusTree::find_leaf(int key, std::vector<uint32_t>* path) {
+    uint32_t page_id = root_page;
+    for (int depth = 0; depth < MAX_TREE_DEPTH; depth++) {
+        Page* page = pool.fetchPage(file_id, page_id);
+        if (!page) {
+            return 0;
+        }
+        BPlusNodeHeader* header = node_header(page);
+        if (header->is_leaf) {
+            pool.unpinPage(file_id, page_id, false);
+            return page_id;
+        }
+
+        // Keys equal to a separator live in the right subtree
+        int32_t* keys = node_keys(page);
+        int child = static_cast<int>(std::upper_bound(keys, keys + header->key_count, key) - keys);
+        uint32_t next = static_cast<uint32_t>(node_values(page)[child]);
+        pool.unpinPage(file_id, page_id, false);
+
+        if (path) {
+            path->push_back(page_id);
+        }
+        page_id = next;
+    }
+    std::cerr << "Error: B+ tree deeper than " << MAX_TREE_DEPTH << " levels, index is corrupted" << std::endl;
+    return 0;
+}
+
+void BPlusTree::insert(int key, int data_offset) {
     if (is_closed) {
         std::cerr << "Error: Attempt to write to closed BPlusTree file" << std::endl;
         return;
     }
-    file.seekp(offset);
-    if (!file) {
-        std::cerr << "Error: Failed to seek to offset " << offset << std::endl;
-        file.clear();
+
+    if (root_page == 0) {
+        // First key: the root starts out as a leaf
+        uint32_t page_id;
+        Page* root = new_node(page_id, true);
+        if (!root) {
+            return;
+        }
+        node_keys(root)[0] = key;
+        node_values(root)[0] = data_offset;
+        node_header(root)->key_count = 1;
+        pool.unpinPage(file_id, page_id, true);
+
+        root_page = page_id;
+        write_meta();
         return;
     }
-    // Rest unchanged
-    file.write(reinterpret_cast<const char*>(&node.is_leaf), sizeof(node.is_leaf));
-    file.write(reinterpret_cast<const char*>(&node.parent), sizeof(node.parent));
-    int key_count = node.keys.size();
-    file.write(reinterpret_cast<const char*>(&key_count), sizeof(key_count));
-    file.write(reinterpret_cast<const char*>(node.keys.data()), key_count * sizeof(int));
-    if (node.is_leaf) {
-        file.write(reinterpret_cast<const char*>(node.data_ptrs.data()), key_count * sizeof(int));
-    } else {
-        file.write(reinterpret_cast<const char*>(node.children.data()), (key_count + 1) * sizeof(int));
+
+    std::vector<uint32_t> path;
+    uint32_t leaf_id = find_leaf(key, &path);
+    Page* leaf = leaf_id ? pool.fetchPage(file_id, leaf_id) : nullptr;
+    if (!leaf) {
+        return;
     }
-    file.flush();
-}
 
-void BPlusTree::insert(int key, int data_offset) {
-    if (root_offset == -1) {
-        // Create root node at the end of the file
-        BPlusNode root;
-        root.is_leaf = true;
-        root.parent = -1;  // Root has no parent
-        root.keys.push_back(key);
-        root.data_ptrs.push_back(data_offset);
-
-        file.seekp(sizeof(root_offset), std::ios::beg);  // Skip the root_offset storage
-        root_offset = file.tellp();
-        write_node(root_offset, root);
-
-        // Update root_offset at the start of the file
-        file.seekp(0);
-        file.write(reinterpret_cast<const char*>(&root_offset), sizeof(root_offset));
-        file.flush();
-
-        std::cout << "Created root node at offset: " << root_offset << std::endl;
-    }
-    else {
-        // Find the leaf node where the key should be inserted
-        int current_offset = root_offset;
-        BPlusNode current = read_node(current_offset);
-
-        std::cout << "Starting search at root offset: " << root_offset << std::endl;
-
-        // Traverse to leaf
-        while (!current.is_leaf) {
-            int i = 0;
-            while (i < current.keys.size() && key > current.keys[i]) {
-                i++;
-            }
-            std::cout << "Moving from node at offset " << current_offset
-                << " to child at index " << i << " (offset " << current.children[i] << ")" << std::endl;
-            current_offset = current.children[i];
-            current = read_node(current_offset);
-        }
+    BPlusNodeHeader* header = node_header(leaf);
+    int32_t* keys = node_keys(leaf);
+    int32_t* values = node_values(leaf);
+    int count = header->key_count;
+    int pos = static_cast<int>(std::lower_bound(keys, keys + count, key) - keys);
 
-        std::cout << "Found leaf node at offset: " << current_offset << std::endl;
+    // Existing key: point it at the new record
+    if (pos < count && keys[pos] == key) {
+        values[pos] = data_offset;
+        pool.unpinPage(file_id, leaf_id, true);
+        return;
+    }
 
-        // Insert the key into the leaf node
-        int i = 0;
-        while (i < current.keys.size() && key > current.keys[i]) {
-            i++;
-        }
+    if (count < max_keys) {
+        std::memmove(keys + pos + 1, keys + pos, (count - pos) * sizeof(int32_t));
+        std::memmove(values + pos + 1, values + pos, (count - pos) * sizeof(int32_t));
+        keys[pos] = key;
+        values[pos] = data_offset;
+        header->key_count = static_cast<uint16_t>(count + 1);
+        pool.unpinPage(file_id, leaf_id, true);
+        return;
+    }
 
-        // Check for duplicate key
-        if (i < current.keys.size() && current.keys[i] == key) {
-            std::cout << "Key " << key << " already exists, updating data pointer" << std::endl;
-            current.data_ptrs[i] = data_offset;
-        }
-        else {
-            std::cout << "Inserting key " << key << " at position " << i << std::endl;
-            current.keys.insert(current.keys.begin() + i, key);
-            current.data_ptrs.insert(current.data_ptrs.begin() + i, data_offset);
-        }
+    // Full leaf: split the count + 1 entries, the left node keeps the lower half
+    std::vector<int32_t> all_keys(keys, keys + count);
+    std::vector<int32_t> all_values(values, values + count);
+    all_keys.insert(all_keys.begin() + pos, key);
+    all_values.insert(all_values.begin() + pos, data_offset);
 
-        // Write the updated node back to the file
-        write_node(current_offset, current);
-        std::cout << "Updated leaf node at offset: " << current_offset << std::endl;
+    uint32_t right_id;
+    Page* right = new_node(right_id, true);
+    if (!right) {
+        pool.unpinPage(file_id, leaf_id, false);
+        return;
+    }
 
-        // Check if the node needs to be split
-        if (current.keys.size() > FANOUT) {
-            std::cout << "Node at offset " << current_offset << " needs splitting" << std::endl;
-            split_node(current, current_offset);
+    int total = count + 1;
+    int left_count = total / 2;
+    std::memcpy(keys, all_keys.data(), left_count * sizeof(int32_t));
+    std::memcpy(values, all_values.data(), left_count * sizeof(int32_t));
+    header->key_count = static_cast<uint16_t>(left_count);
+
+    std::memcpy(node_keys(right), all_keys.data() + left_count, (total - left_count) * sizeof(int32_t));
+    std::memcpy(node_values(right), all_values.data() + left_count, (total - left_count) * sizeof(int32_t));
+    node_header(right)->key_count = static_cast<uint16_t>(total - left_count);
+
+    // Link the new leaf in after the old one
+    uint32_t old_next = header->next_leaf;
+    node_header(right)->next_leaf = old_next;
+    node_header(right)->prev_leaf = leaf_id;
+    header->next_leaf = right_id;
+    if (old_next != 0) {
+        Page* next = pool.fetchPage(file_id, old_next);
+        if (next) {
+            node_header(next)->prev_leaf = right_id;
+            pool.unpinPage(file_id, old_next, true);
         }
     }
+
+    int separator = all_keys[left_count];
+    pool.unpinPage(file_id, leaf_id, true);
+    pool.unpinPage(file_id, right_id, true);
+
+    insert_into_parent(path, leaf_id, separator, right_id);
 }
 
-void BPlusTree::split_node(BPlusNode& node, int node_offset) {
-    std::cout << "Splitting node at offset: " << node_offset << std::endl;
-
-    // Create a new node
-    BPlusNode new_node;
-    new_node.is_leaf = node.is_leaf;
-    new_node.parent = node.parent;
-
-    int mid = node.keys.size() / 2;
-    int promoted_key = node.keys[mid];
-
-    // For non-leaf nodes, we promote the middle key but don't keep it in the children
-    if (!node.is_leaf) {
-        new_node.keys.assign(node.keys.begin() + mid + 1, node.keys.end());
-        new_node.children.assign(node.children.begin() + mid + 1, node.children.end());
-
-        // Remove the promoted key and the children to the right from the original node
-        node.keys.erase(node.keys.begin() + mid, node.keys.end());
-        node.children.erase(node.children.begin() + mid + 1, node.children.end());
-    }
-    else {
-        // For leaf nodes, we copy the middle key to the parent but keep it in the leaf
-        new_node.keys.assign(node.keys.begin() + mid, node.keys.end());
-        new_node.data_ptrs.assign(node.data_ptrs.begin() + mid, node.data_ptrs.end());
-
-        // Remove the keys and data_ptrs from the original node
-        node.keys.erase(node.keys.begin() + mid, node.keys.end());
-        node.data_ptrs.erase(node.data_ptrs.begin() + mid, node.data_ptrs.end());
-    }
-
-    // Write new node at the end of the file
-    file.seekp(0, std::ios::end);
-    int new_offset = file.tellp();
-    write_node(new_offset, new_node);
-    std::cout << "Created new node at offset: " << new_offset << std::endl;
-
-    // Update original node
-    write_node(node_offset, node);
-    std::cout << "Updated original node at offset: " << node_offset << std::endl;
-
-    // Update parent pointers for all children of the new node
-    if (!new_node.is_leaf) {
-        for (int child_offset : new_node.children) {
-            BPlusNode child = read_node(child_offset);
-            child.parent = new_offset;
-            write_node(child_offset, child);
-            std::cout << "Updated parent pointer for child at offset " << child_offset << std::endl;
+void BPlusTree::insert_into_parent(std::vector<uint32_t>& path, uint32_t left_page, int key, uint32_t right_page) {
+    if (path.empty()) {
+        // The root was split: grow the tree by one level
+        uint32_t page_id;
+        Page* root = new_node(page_id, false);
+        if (!root) {
+            return;
         }
+        node_keys(root)[0] = key;
+        node_values(root)[0] = static_cast<int32_t>(left_page);
+        node_values(root)[1] = static_cast<int32_t>(right_page);
+        node_header(root)->key_count = 1;
+        pool.unpinPage(file_id, page_id, true);
+
+        root_page = page_id;
+        write_meta();
+        return;
     }
 
-    // Handle the parent node creation or update
-    if (node.parent == -1) {
-        // This was the root node, create a new root
-        BPlusNode new_root;
-        new_root.is_leaf = false;
-        new_root.parent = -1;
-        new_root.keys.push_back(promoted_key);
-        new_root.children.push_back(node_offset);
-        new_root.children.push_back(new_offset);
-
-        file.seekp(0, std::ios::end);
-        int new_root_offset = file.tellp();
-        write_node(new_root_offset, new_root);
-        std::cout << "Created new root at offset: " << new_root_offset << std::endl;
-
-        // Update parent pointers in the split nodes
-        node.parent = new_root_offset;
-        write_node(node_offset, node);
-
-        new_node.parent = new_root_offset;
-        write_node(new_offset, new_node);
-
-        // Update root_offset
-        root_offset = new_root_offset;
-        file.seekp(0);
-        file.write(reinterpret_cast<const char*>(&root_offset), sizeof(root_offset));
-        file.flush();
-        std::cout << "Updated root_offset to: " << root_offset << std::endl;
-    }
-    else {
-        // Update the parent node
-        BPlusNode parent = read_node(node.parent);
-        std::cout << "Updating parent node at offset: " << node.parent << std::endl;
-
-        // Find where to insert the promoted key
-        int i = 0;
-        while (i < parent.keys.size() && promoted_key > parent.keys[i]) {
-            i++;
-        }
+    uint32_t parent_id = path.back();
+    path.pop_back();
+    Page* parent = pool.fetchPage(file_id, parent_id);
+    if (!parent) {
+        return;
+    }
 
-        // Insert the promoted key and the new child pointer
-        parent.keys.insert(parent.keys.begin() + i, promoted_key);
-        parent.children.insert(parent.children.begin() + i + 1, new_offset);
+    BPlusNodeHeader* header = node_header(parent);
+    int32_t* keys = node_keys(parent);
+    int32_t* children = node_values(parent);
+    int count = header->key_count;
+    int pos = static_cast<int>(std::upper_bound(keys, keys + count, key) - keys);
+
+    if (count < max_keys) {
+        std::memmove(keys + pos + 1, keys + pos, (count - pos) * sizeof(int32_t));
+        std::memmove(children + pos + 2, children + pos + 1, (count - pos) * sizeof(int32_t));
+        keys[pos] = key;
+        children[pos + 1] = static_cast<int32_t>(right_page);
+        header->key_count = static_cast<uint16_t>(count + 1);
+        pool.unpinPage(file_id, parent_id, true);
+        return;
+    }
 
-        // Write the updated parent back to the file
-        write_node(node.parent, parent);
-        std::cout << "Updated parent node at offset: " << node.parent << std::endl;
+    // Full internal node: the middle key moves up instead of being copied
+    std::vector<int32_t> all_keys(keys, keys + count);
+    std::vector<int32_t> all_children(children, children + count + 1);
+    all_keys.insert(all_keys.begin() + pos, key);
+    all_children.insert(all_children.begin() + pos + 1, static_cast<int32_t>(right_page));
 
-        // Check if the parent now needs to be split
-        if (parent.keys.size() > FANOUT) {
-            std::cout << "Parent node needs splitting" << std::endl;
-            split_node(parent, node.parent);
-        }
+    uint32_t sibling_id;
+    Page* sibling = new_node(sibling_id, false);
+    if (!sibling) {
+        pool.unpinPage(file_id, parent_id, false);
+        return;
+    }
+
+    int total = count + 1;
+    int mid = total / 2;
+    int promoted_key = all_keys[mid];
+
+    std::memcpy(keys, all_keys.data(), mid * sizeof(int32_t));
+    std::memcpy(children, all_children.data(), (mid + 1) * sizeof(int32_t));
+    header->key_count = static_cast<uint16_t>(mid);
+
+    int right_count = total - mid - 1;
+    std::memcpy(node_keys(sibling), all_keys.data() + mid + 1, right_count * sizeof(int32_t));
+    std::memcpy(node_values(sibling), all_children.data() + mid + 1, (right_count + 1) * sizeof(int32_t));
+    node_header(sibling)->key_count = static_cast<uint16_t>(right_count);
+
+    pool.unpinPage(file_id, parent_id, true);
+    pool.unpinPage(file_id, sibling_id, true);
+
+    insert_into_parent(path, parent_id, promoted_key, sibling_id);
+}
+
+bool BPlusTree::remove(int key) {
+    if (is_closed) {
+        std::cerr << "Error: Attempt to write to closed BPlusTree file" << std::endl;
+        return false;
     }
+    if (root_page == 0) {
+        return false;
+    }
+
+    uint32_t leaf_id = find_leaf(key, nullptr);
+    Page* leaf = leaf_id ? pool.fetchPage(file_id, leaf_id) : nullptr;
+    if (!leaf) {
+        return false;
+    }
+
+    BPlusNodeHeader* header = node_header(leaf);
+    int32_t* keys = node_keys(leaf);
+    int32_t* values = node_values(leaf);
+    int count = header->key_count;
+    int pos = static_cast<int>(std::lower_bound(keys, keys + count, key) - keys);
+    if (pos == count || keys[pos] != key) {
+        pool.unpinPage(file_id, leaf_id, false);
+        return false;
+    }
+
+    std::memmove(keys + pos, keys + pos + 1, (count - pos - 1) * sizeof(int32_t));
+    std::memmove(values + pos, values + pos + 1, (count - pos - 1) * sizeof(int32_t));
+    header->key_count = static_cast<uint16_t>(count - 1);
+    pool.unpinPage(file_id, leaf_id, true);
+    return true;
 }
 
 std::vector<int> BPlusTree::search(int key) {
     std::vector<int> result;
-    if (root_offset == -1) {
-        std::cout << "Tree is empty, returning empty result" << std::endl;
+    if (is_closed || root_page == 0) {
         return result;
     }
 
-    int current_offset = root_offset;
-    BPlusNode current = read_node(current_offset);
-    std::cout << "Starting search for key " << key << " at root offset: " << root_offset << std::endl;
+    uint32_t leaf_id = find_leaf(key, nullptr);
+    Page* leaf = leaf_id ? pool.fetchPage(file_id, leaf_id) : nullptr;
+    if (!leaf) {
+        return result;
+    }
 
-    // Find the leaf node that might contain the key
-    while (!current.is_leaf) {
-        int i = 0;
-        while (i < current.keys.size() && key > current.keys[i]) {
-            i++;
+    int32_t* keys = node_keys(leaf);
+    int count = node_header(leaf)->key_count;
+    int32_t* pos = std::lower_bound(keys, keys + count, key);
+    if (pos != keys + count && *pos == key) {
+        result.push_back(node_values(leaf)[pos - keys]);
+    }
+    pool.unpinPage(file_id, leaf_id, false);
+    return result;
+}
+
+bool BPlusTree::bulkLoad(const std::vector<std::pair<int, int>>& sorted_entries) {
+    size_t i = 0;
+    return bulkLoad([&](int& key, int& data_offset) {
+        if (i == sorted_entries.size()) {
+            return false;
         }
-        std::cout << "Moving from node at offset " << current_offset
-            << " to child at index " << i << " (offset " << current.children[i] << ")" << std::endl;
-        current_offset = current.children[i];
-        current = read_node(current_offset);
+        key = sorted_entries[i].first;
+        data_offset = sorted_entries[i].second;
+        i++;
+        return true;
+    });
+}
+
+bool BPlusTree::bulkLoad(const std::function<bool(int& key, int& data_offset)>& next) {
+    if (is_closed) {
+        std::cerr << "Error: Attempt to write to closed BPlusTree file" << std::endl;
+        return false;
+    }
+    if (root_page != 0) {
+        std::cerr << "Error: Bulk load requires an empty B+ tree" << std::endl;
+        return false;
     }
 
-    std::cout << "Found leaf node at offset: " << current_offset << std::endl;
+    // levels[0] is the leaf being filled, levels[i] the internal node above it
+    std::vector<BulkLevel> levels;
+    bool ok = true;
+    bool first = true;
+    int key, data_offset, last_key = 0;
+    while (ok && next(key, data_offset)) {
+        if (!first && key <= last_key) {
+            std::cerr << "Error: Bulk load keys must be unique and ascending (" << key
+                      << " after " << last_key << ")" << std::endl;
+            ok = false;
+            break;
+        }
 
-    // Search for the key in the leaf node
-    for (size_t i = 0; i < current.keys.size(); i++) {
-        if (current.keys[i] == key) {
-            std::cout << "Found key " << key << " at position " << i << std::endl;
-            result.push_back(current.data_ptrs[i]);
+        if (levels.empty() || node_header(levels[0].page)->key_count == max_keys) {
+            uint32_t leaf_id;
+            Page* leaf = new_node(leaf_id, true);
+            if (!leaf) {
+                ok = false;
+                break;
+            }
+            if (!levels.empty()) {
+                // Chain the full leaf to the new one and hand the new leaf to its parent
+                node_header(levels[0].page)->next_leaf = leaf_id;
+                node_header(leaf)->prev_leaf = levels[0].page_id;
+                uint32_t full_id = levels[0].page_id;
+                pool.unpinPage(file_id, full_id, true);
+                levels[0] = BulkLevel{ leaf_id, leaf };
+                ok = bulk_append(levels, 1, full_id, key, leaf_id);
+            } else {
+                levels.push_back(BulkLevel{ leaf_id, leaf });
+            }
         }
+
+        BPlusNodeHeader* header = node_header(levels[0].page);
+        node_keys(levels[0].page)[header->key_count] = key;
+        node_values(levels[0].page)[header->key_count] = data_offset;
+        header->key_count++;
+        last_key = key;
+        first = false;
     }
 
-    if (result.empty()) {
-        std::cout << "Key " << key << " not found" << std::endl;
+    for (auto& level : levels) {
+        pool.unpinPage(file_id, level.page_id, true);
+    }
+    if (!ok) {
+        return false;
     }
-    else {
-        std::cout << "Found " << result.size() << " matching records" << std::endl;
+    if (!levels.empty()) {
+        root_page = levels.back().page_id;
+        write_meta();
     }
+    return true;
+}
 
-    return result;
+bool BPlusTree::bulk_append(std::vector<BulkLevel>& levels, size_t level, uint32_t left, int key, uint32_t right) {
+    if (level == levels.size()) {
+        // The level below just got its second node: start a new root above it
+        uint32_t page_id;
+        Page* node = new_node(page_id, false);
+        if (!node) {
+            return false;
+        }
+        node_keys(node)[0] = key;
+        node_values(node)[0] = static_cast<int32_t>(left);
+        node_values(node)[1] = static_cast<int32_t>(right);
+        node_header(node)->key_count = 1;
+        levels.push_back(BulkLevel{ page_id, node });
+        return true;
+    }
+
+    Page* node = levels[level].page;
+    BPlusNodeHeader* header = node_header(node);
+    if (header->key_count < max_keys) {
+        node_keys(node)[header->key_count] = key;
+        node_values(node)[header->key_count + 1] = static_cast<int32_t>(right);
+        header->key_count++;
+        return true;
+    }
+
+    // Full node: the new child opens the next node on this level and its key moves up
+    uint32_t page_id;
+    Page* sibling = new_node(page_id, false);
+    if (!sibling) {
+        return false;
+    }
+    node_values(sibling)[0] = static_cast<int32_t>(right);
+    uint32_t full_id = levels[level].page_id;
+    pool.unpinPage(file_id, full_id, true);
+    levels[level] = BulkLevel{ page_id, sibling };
+    return bulk_append(levels, level + 1, full_id, key, page_id);
+}
+
+BPlusCursor BPlusTree::range(int lo, int hi, BPlusCursor::Direction direction) {
+    return BPlusCursor(*this, lo, hi, direction);
 }
+
+int BPlusTree::height() {
+    if (is_closed || root_page == 0) {
+        return 0;
+    }
+    std::vector<uint32_t> path;
+    find_leaf(0, &path);
+    return static_cast<int>(path.size()) + 1;
+}
+
+void BPlusTree::flush() {
+    if (!is_closed) {
+        pool.flushFile(file_id);
+    }
+}
+
 void BPlusTree::close() {
-    if (file.is_open() && !is_closed) {
-        file.seekp(0);
-        file.write(reinterpret_cast<const char*>(&root_offset), sizeof(root_offset));
-        file.flush(); // Ensure all writes are committed
-        file.close();
+    if (!is_closed) {
+        pool.closeFile(file_id); // Writes back every cached node of this index
         is_closed = true;
-        std::cerr << "Closed BPlusTree file at offset: " << root_offset << std::endl;
-        if (file.is_open()) {
-            std::cerr << "Warning: BPlusTree file failed to close" << std::endl;
-        }
-    } else if (is_closed) {
+        std::cerr << "Closed BPlusTree file with root page: " << root_page << std::endl;
+    } else {
         std::cerr << "BPlusTree file already closed" << std::endl;
     }
-}
\ No newline at end of file
+}
+
+BPlusCursor::BPlusCursor(BPlusTree& tree, int lo, int hi, Direction direction)
+    : tree(tree), lo(lo), hi(hi), direction(direction) {
+    if (tree.is_closed || tree.root_page == 0 || lo > hi) {
+        done = true;
+        return;
+    }
+
+    // Start at the first key >= lo, or at the last key <= hi when walking backwards
+    int start = direction == FORWARD ? lo : hi;
+    uint32_t page_id = tree.find_leaf(start, nullptr);
+    if (page_id == 0 || !moveTo(page_id)) {
+        done = true;
+        return;
+    }
+    int32_t* keys = BPlusTree::node_keys(leaf);
+    int count = BPlusTree::node_header(leaf)->key_count;
+    if (direction == FORWARD) {
+        slot = static_cast<int>(std::lower_bound(keys, keys + count, lo) - keys);
+    } else {
+        slot = static_cast<int>(std::upper_bound(keys, keys + count, hi) - keys) - 1;
+    }
+}
+
+BPlusCursor::~BPlusCursor() {
+    release();
+}
+
+bool BPlusCursor::next(int& key, int& data_offset) {
+    while (!done) {
+        BPlusNodeHeader* header = BPlusTree::node_header(leaf);
+        if (slot < 0 || slot >= header->key_count) {
+            // Ran off this leaf: continue with its neighbour
+            uint32_t sibling = direction == FORWARD ? header->next_leaf : header->prev_leaf;
+            if (sibling == 0 || !moveTo(sibling)) {
+                break;
+            }
+            slot = direction == FORWARD ? 0 : BPlusTree::node_header(leaf)->key_count - 1;
+            continue;
+        }
+
+        int current = BPlusTree::node_keys(leaf)[slot];
+        if (direction == FORWARD ? current > hi : current < lo) {
+            break;
+        }
+        key = current;
+        data_offset = BPlusTree::node_values(leaf)[slot];
+        slot += direction == FORWARD ? 1 : -1;
+        return true;
+    }
+    done = true;
+    release();
+    return false;
+}
+
+bool BPlusCursor::moveTo(uint32_t page_id) {
+    release();
+    leaf = tree.pool.fetchPage(tree.file_id, page_id);
+    if (!leaf) {
+        return false;
+    }
+    leaf_id = page_id;
+    return true;
+}
+
+void BPlusCursor::release() {
+    if (leaf) {
+        tree.pool.unpinPage(tree.file_id, leaf_id, false);
+        leaf = nullptr;
+    }
+}
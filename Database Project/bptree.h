@@ -1,39 +1,107 @@
 #ifndef BPTREE_H
 #define BPTREE_H
 
+#include "buffer_pool.h"
+#include <cstdint>
 #include <vector>
-#include <fstream>
+#include <climits>
+#include <functional>
+#include <utility>
 #include <iostream>
 #include <filesystem>
 
-constexpr int FANOUT = 4; // Maximum number of keys per node
+// Every node occupies one page: a small header followed by flat key and pointer arrays
+// that are binary-searched in place.
+struct BPlusNodeHeader {
+    uint8_t is_leaf;
+    uint8_t reserved;
+    uint16_t key_count;
+    uint32_t next_leaf; // Leaf chain in key order, 0 at either end
+    uint32_t prev_leaf;
+};
+
+// Maximum number of keys per node: what fits in one page (508 with 4KB pages)
+constexpr int FANOUT = static_cast<int>(
+    (sizeof(Page::data) - sizeof(BPlusNodeHeader) - sizeof(int32_t)) / (2 * sizeof(int32_t)));
+
+class BPlusTree;
+
+// Streams (key, data pointer) pairs of a key range along the leaf chain, keeping one leaf pinned.
+// The tree must not be modified while a cursor is open.
+class BPlusCursor {
+public:
+    enum Direction { FORWARD, BACKWARD };
+
+    // Covers keys in [lo, hi], walked in ascending or descending order
+    BPlusCursor(BPlusTree& tree, int lo, int hi, Direction direction = FORWARD);
+    ~BPlusCursor();
+
+    BPlusCursor(const BPlusCursor&) = delete;
+    BPlusCursor& operator=(const BPlusCursor&) = delete;
 
-struct BPlusNode {
-    bool is_leaf;
-    int parent;
-    std::vector<int> keys;
-    std::vector<int> children;    // Non-leaf nodes
-    std::vector<int> data_ptrs;   // Leaf nodes
+    bool next(int& key, int& data_offset);
+
+private:
+    BPlusTree& tree;
+    int lo;
+    int hi;
+    Direction direction;
+    uint32_t leaf_id = 0;
+    Page* leaf = nullptr;
+    int slot = 0;
+    bool done = false;
+
+    bool moveTo(uint32_t page_id);
+    void release();
 };
 
 class BPlusTree {
 public:
-    BPlusTree(const std::string& index_file);
+    // max_keys lowers the node capacity below FANOUT; it is fixed when the index file is created
+    BPlusTree(const std::string& index_file, BufferPool& pool, int max_keys = FANOUT);
     ~BPlusTree();
+    bool isOpen() const { return !is_closed; }
     void insert(int key, int data_offset);
+    // Drops a key from its leaf; leaves are not merged, so a leaf may become underfull or empty
+    bool remove(int key);
+    // Builds an empty tree bottom-up: leaves are packed left to right, then each internal level
+    // above them. next() supplies (key, data pointer) pairs in strictly ascending key order and
+    // returns false at the end of the stream.
+    bool bulkLoad(const std::function<bool(int& key, int& data_offset)>& next);
+    bool bulkLoad(const std::vector<std::pair<int, int>>& sorted_entries);
+    void flush();
     void close();
     std::vector<int> search(int key);
+    // Inclusive key range; use INT_MIN / INT_MAX for an open end
+    BPlusCursor range(int lo, int hi, BPlusCursor::Direction direction = BPlusCursor::FORWARD);
     int get_root_offset() const;
-    BPlusNode get_node(int offset) const;
+    int height();
 
 private:
-    mutable std::fstream file; // Mark file as mutable
-    int root_offset;
+    friend class BPlusCursor;
 
-    BPlusNode read_node(int offset) const;
-    void write_node(int offset, const BPlusNode& node);
-    void split_node(BPlusNode& node, int offset);
+    BufferPool& pool;
+    int file_id;
+    uint32_t root_page;
+    int max_keys;
     bool is_closed;
+
+    // Views over a pinned node page
+    static BPlusNodeHeader* node_header(Page* page);
+    static int32_t* node_keys(Page* page);
+    static int32_t* node_values(Page* page); // data pointers in leaves, child pages in internal nodes
+
+    Page* new_node(uint32_t& page_id, bool is_leaf);
+    void write_meta();
+    uint32_t find_leaf(int key, std::vector<uint32_t>* path);
+    void insert_into_parent(std::vector<uint32_t>& path, uint32_t left_page, int key, uint32_t right_page);
+
+    // One partially filled node per level while bulk loading, kept pinned until it is full
+    struct BulkLevel {
+        uint32_t page_id;
+        Page* page;
+    };
+    bool bulk_append(std::vector<BulkLevel>& levels, size_t level, uint32_t left, int key, uint32_t right);
 };
 
-#endif
\ No newline at end of file
+#endif
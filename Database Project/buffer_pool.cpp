@@ -0,0 +1,484 @@
+#include "buffer_pool.h"
+#include "wal.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+BufferPool::BufferPool(size_t frame_count) : frames(frame_count == 0 ? 1 : frame_count) {
+    page_table.reserve(frames.size());
+}
+
+BufferPool::~BufferPool() {
+    closeAll();
+}
+
+int BufferPool::openFile(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto existing = file_ids.find(path);
+    if (existing != file_ids.end()) {
+        return existing->second;
+    }
+
+    std::filesystem::path filePath(path);
+    if (filePath.has_parent_path()) {
+        std::filesystem::create_directories(filePath.parent_path());
+    }
+
+    auto file = std::make_unique<PooledFile>();
+    file->path = path;
+    file->stream.open(path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file->stream) {
+        file->stream.clear();
+        file->stream.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+        file->stream.close();
+        file->stream.open(path, std::ios::binary | std::ios::in | std::ios::out);
+    }
+    if (!file->stream) {
+        std::cerr << "Error: Buffer pool failed to open file: " << path << std::endl;
+        return -1;
+    }
+
+    file->stream.seekg(0, std::ios::end);
+    std::streamoff end = file->stream.tellg();
+    file->size = end > 0 ? static_cast<uint64_t>(end) : 0;
+    file->committed_size = file->size;
+
+    int file_id = next_file_id++;
+    files[file_id] = std::move(file);
+    file_ids[path] = file_id;
+    return file_id;
+}
+
+void BufferPool::closeFile(int file_id) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = files.find(file_id);
+    if (it == files.end()) {
+        return;
+    }
+
+    for (auto& frame : frames) {
+        if (frame.file_id != file_id) continue;
+        if (frame.pin_count > 0) {
+            std::cerr << "Warning: Closing file with pinned page " << frame.page_no
+                << ": " << it->second->path << std::endl;
+        }
+        if (frame.dirty) {
+            writeFrame(frame);
+        }
+        page_table.erase(pageKey(frame.file_id, frame.page_no));
+        frame = Frame();
+    }
+
+    it->second->stream.flush();
+    it->second->stream.close();
+    file_ids.erase(it->second->path);
+    files.erase(it);
+}
+
+void BufferPool::closeAll() {
+    std::vector<int> ids;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& [id, file] : files) {
+            ids.push_back(id);
+        }
+    }
+    for (int id : ids) {
+        closeFile(id);
+    }
+}
+
+Page* BufferPool::fetchPage(int file_id, uint32_t page_no) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Frame* frame = pinFrame(file_id, page_no, true);
+    return frame ? &frame->page : nullptr;
+}
+
+Page* BufferPool::newPage(int file_id, uint32_t& page_no) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = files.find(file_id);
+    if (it == files.end()) {
+        std::cerr << "Error: newPage on unknown file id " << file_id << std::endl;
+        return nullptr;
+    }
+
+    PooledFile& file = *it->second;
+    page_no = static_cast<uint32_t>((file.size + PAGE_SIZE - 1) / PAGE_SIZE);
+    Frame* frame = pinFrame(file_id, page_no, false);
+    if (!frame) {
+        return nullptr;
+    }
+    file.size = static_cast<uint64_t>(page_no + 1) * PAGE_SIZE;
+    markDirty(*frame);
+    return &frame->page;
+}
+
+void BufferPool::unpinPage(int file_id, uint32_t page_no, bool dirty) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = page_table.find(pageKey(file_id, page_no));
+    if (it == page_table.end()) {
+        std::cerr << "Error: Unpin of page " << page_no << " that is not in the buffer pool" << std::endl;
+        return;
+    }
+    Frame& frame = frames[it->second];
+    if (frame.pin_count > 0) {
+        frame.pin_count--;
+    }
+    if (dirty) {
+        markDirty(frame);
+    }
+}
+
+void BufferPool::flushFile(int file_id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    flushFileLocked(file_id);
+}
+
+void BufferPool::flushAll() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& [id, file] : files) {
+        flushFileLocked(id);
+    }
+}
+
+bool BufferPool::syncAll() {
+    std::lock_guard<std::mutex> lock(mutex);
+    bool ok = true;
+    for (const auto& [id, file] : files) {
+        ok = flushFileLocked(id) && ok;
+        if (!syncFileToDisk(file->path)) {
+            std::cerr << "Error: Failed to sync " << file->path << " to disk" << std::endl;
+            ok = false;
+        }
+    }
+    // The data files now hold every committed image
+    if (ok) {
+        logged_pages.clear();
+    }
+    return ok;
+}
+
+void BufferPool::attachLog(WriteAheadLog* wal) {
+    std::lock_guard<std::mutex> lock(mutex);
+    log = wal;
+    for (auto& frame : frames) {
+        frame.unlogged = log && frame.dirty;
+        frame.lsn = 0;
+    }
+    logged_pages.clear();
+    statement_pages.clear();
+    statement_lsn = 0;
+    for (auto& [id, file] : files) {
+        file->committed_size = file->size;
+    }
+}
+
+uint64_t BufferPool::logDirtyPages() {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t last_lsn = statement_lsn;
+    if (!log) {
+        return 0;
+    }
+    for (auto& frame : frames) {
+        if (frame.file_id != -1 && frame.unlogged) {
+            logFrame(frame);
+            last_lsn = std::max(last_lsn, frame.lsn);
+            logged_pages.insert(pageKey(frame.file_id, frame.page_no));
+        }
+    }
+    // Pages logged early are committed along with the rest
+    logged_pages.insert(statement_pages.begin(), statement_pages.end());
+    statement_pages.clear();
+    statement_lsn = 0;
+    for (auto& [id, file] : files) {
+        file->committed_size = file->size;
+    }
+    return last_lsn;
+}
+
+uint64_t BufferPool::logStatementPages() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!log) {
+        return 0;
+    }
+    for (auto& frame : frames) {
+        auto it = files.find(frame.file_id);
+        if (frame.unlogged && it != files.end()) {
+            logUncommitted(frame, *it->second);
+        }
+    }
+    return statement_lsn;
+}
+
+uint64_t BufferPool::fileSize(int file_id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = files.find(file_id);
+    return it == files.end() ? 0 : it->second->size;
+}
+
+uint32_t BufferPool::pageCount(int file_id) const {
+    return static_cast<uint32_t>((fileSize(file_id) + PAGE_SIZE - 1) / PAGE_SIZE);
+}
+
+bool BufferPool::readBytes(int file_id, uint64_t offset, void* dst, size_t len) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = files.find(file_id);
+    if (it == files.end() || offset + len > it->second->size) {
+        return false;
+    }
+
+    char* out = static_cast<char*>(dst);
+    while (len > 0) {
+        uint32_t page_no = static_cast<uint32_t>(offset / PAGE_SIZE);
+        size_t in_page = static_cast<size_t>(offset % PAGE_SIZE);
+        size_t chunk = std::min(len, static_cast<size_t>(PAGE_SIZE) - in_page);
+
+        Frame* frame = pinFrame(file_id, page_no, true);
+        if (!frame) {
+            return false;
+        }
+        std::memcpy(out, reinterpret_cast<const char*>(&frame->page) + in_page, chunk);
+        frame->pin_count--;
+
+        out += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+bool BufferPool::writeBytes(int file_id, uint64_t offset, const void* src, size_t len) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = files.find(file_id);
+    if (it == files.end()) {
+        return false;
+    }
+    PooledFile& file = *it->second;
+
+    const char* in = static_cast<const char*>(src);
+    while (len > 0) {
+        uint32_t page_no = static_cast<uint32_t>(offset / PAGE_SIZE);
+        size_t in_page = static_cast<size_t>(offset % PAGE_SIZE);
+        size_t chunk = std::min(len, static_cast<size_t>(PAGE_SIZE) - in_page);
+
+        // Pages past the end of the file have nothing on disk to load
+        bool exists = static_cast<uint64_t>(page_no) * PAGE_SIZE < file.size;
+        Frame* frame = pinFrame(file_id, page_no, exists);
+        if (!frame) {
+            return false;
+        }
+        std::memcpy(reinterpret_cast<char*>(&frame->page) + in_page, in, chunk);
+        markDirty(*frame);
+        frame->pin_count--;
+
+        in += chunk;
+        offset += chunk;
+        len -= chunk;
+        file.size = std::max(file.size, offset);
+    }
+    return true;
+}
+
+BufferPoolStats BufferPool::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+double BufferPool::hitRate() const {
+    return getStats().hitRate();
+}
+
+BufferPool::Frame* BufferPool::pinFrame(int file_id, uint32_t page_no, bool load) {
+    auto file_it = files.find(file_id);
+    if (file_it == files.end()) {
+        std::cerr << "Error: Page request on unknown file id " << file_id << std::endl;
+        return nullptr;
+    }
+
+    uint64_t key = pageKey(file_id, page_no);
+    auto it = page_table.find(key);
+    if (it != page_table.end()) {
+        Frame& frame = frames[it->second];
+        frame.pin_count++;
+        frame.referenced = true;
+        stats.hits++;
+        return &frame;
+    }
+
+    stats.misses++;
+    size_t index;
+    if (!findVictim(index)) {
+        std::cerr << "Error: Buffer pool exhausted, all " << frames.size() << " frames are pinned" << std::endl;
+        return nullptr;
+    }
+
+    Frame& frame = frames[index];
+    if (frame.file_id != -1) {
+        // A page that cannot be written back stays cached rather than being lost
+        if (frame.dirty && !writeFrame(frame)) {
+            return nullptr;
+        }
+        page_table.erase(pageKey(frame.file_id, frame.page_no));
+        stats.evictions++;
+    }
+
+    std::memset(&frame.page, 0, sizeof(Page));
+    if (load) {
+        PooledFile& file = *file_it->second;
+        file.stream.clear();
+        file.stream.seekg(static_cast<std::streamoff>(page_no) * PAGE_SIZE);
+        file.stream.read(reinterpret_cast<char*>(&frame.page), PAGE_SIZE);
+        // A short read at the end of the file leaves the rest of the frame zeroed
+        file.stream.clear();
+    }
+
+    frame.file_id = file_id;
+    frame.page_no = page_no;
+    frame.pin_count = 1;
+    frame.dirty = false;
+    frame.referenced = true;
+    frame.unlogged = false;
+    frame.lsn = 0;
+    page_table[key] = index;
+    return &frame;
+}
+
+bool BufferPool::findVictim(size_t& frame_index) {
+    // Two full sweeps: the first clears reference bits, the second finds an unpinned frame.
+    // Pages not yet logged are passed over while anything else is available, since writing
+    // one back first costs a log sync.
+    bool have_fallback = false;
+    size_t fallback = 0;
+    for (size_t step = 0; step < frames.size() * 2; step++) {
+        Frame& frame = frames[clock_hand];
+        size_t current = clock_hand;
+        clock_hand = (clock_hand + 1) % frames.size();
+
+        if (frame.file_id == -1) {
+            frame_index = current;
+            return true;
+        }
+        if (frame.pin_count > 0) {
+            continue;
+        }
+        if (frame.referenced) {
+            frame.referenced = false;
+            continue;
+        }
+        if (frame.unlogged) {
+            if (!have_fallback) {
+                fallback = current;
+                have_fallback = true;
+            }
+            continue;
+        }
+        frame_index = current;
+        return true;
+    }
+    frame_index = fallback;
+    return have_fallback;
+}
+
+void BufferPool::markDirty(Frame& frame) {
+    frame.dirty = true;
+    frame.unlogged = log != nullptr;
+}
+
+void BufferPool::logFrame(Frame& frame) {
+    auto it = files.find(frame.file_id);
+    if (it == files.end()) {
+        return;
+    }
+    frame.lsn = log->appendPage(it->second->path, frame.page_no, frame.page);
+    frame.unlogged = false;
+}
+
+void BufferPool::logBeforeImage(Frame& frame, PooledFile& file) {
+    // Redo already restores pages with a committed image in the log, and a page logged
+    // earlier in this statement had its before-image saved the first time
+    uint64_t key = pageKey(frame.file_id, frame.page_no);
+    if (logged_pages.count(key) || !statement_pages.insert(key).second) {
+        return;
+    }
+
+    // Otherwise the committed image is the one on disk; pages past the committed end have none
+    std::string image;
+    uint64_t page_start = static_cast<uint64_t>(frame.page_no) * PAGE_SIZE;
+    if (page_start < file.committed_size) {
+        image.assign(PAGE_SIZE, '\0');
+        file.stream.clear();
+        file.stream.seekg(static_cast<std::streamoff>(page_start));
+        file.stream.read(&image[0], PAGE_SIZE);
+        file.stream.clear();
+    }
+    statement_lsn = log->appendUndo(file.path, frame.page_no, file.committed_size, image);
+}
+
+void BufferPool::logUncommitted(Frame& frame, PooledFile& file) {
+    logBeforeImage(frame, file);
+    logFrame(frame);
+    statement_lsn = std::max(statement_lsn, frame.lsn);
+}
+
+bool BufferPool::writeFrame(Frame& frame) {
+    auto it = files.find(frame.file_id);
+    if (it == files.end()) {
+        return false;
+    }
+    PooledFile& file = *it->second;
+
+    uint64_t page_start = static_cast<uint64_t>(frame.page_no) * PAGE_SIZE;
+    if (page_start >= file.size) {
+        frame.dirty = false;
+        return true;
+    }
+    // Write-ahead rule: the page's image must be durable in the log first. A page not yet
+    // logged belongs to the statement in progress, so its committed image goes in as well.
+    if (log) {
+        if (frame.unlogged) {
+            logUncommitted(frame, file);
+        }
+        if (!log->flushTo(frame.lsn)) {
+            std::cerr << "Error: Page " << frame.page_no << " of " << file.path
+                << " not written back, the write-ahead log could not be written" << std::endl;
+            return false;
+        }
+    }
+
+    // Byte-stream files may end part-way through their last page
+    size_t length = static_cast<size_t>(std::min<uint64_t>(PAGE_SIZE, file.size - page_start));
+
+    file.stream.clear();
+    file.stream.seekp(static_cast<std::streamoff>(page_start));
+    file.stream.write(reinterpret_cast<const char*>(&frame.page), length);
+    if (!file.stream) {
+        std::cerr << "Error: Failed to write page " << frame.page_no << " of " << file.path << std::endl;
+        file.stream.clear();
+        return false;
+    }
+    frame.dirty = false;
+    stats.writebacks++;
+    return true;
+}
+
+bool BufferPool::flushFileLocked(int file_id) {
+    auto it = files.find(file_id);
+    if (it == files.end()) {
+        return false;
+    }
+    bool ok = true;
+    for (auto& frame : frames) {
+        if (frame.file_id == file_id && frame.dirty) {
+            ok = writeFrame(frame) && ok;
+        }
+    }
+    it->second->stream.flush();
+    return ok && static_cast<bool>(it->second->stream);
+}
@@ -0,0 +1,124 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include "page.h"
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class WriteAheadLog;
+
+constexpr size_t DEFAULT_POOL_FRAMES = 1024; // 4MB of cached pages
+
+struct BufferPoolStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t writebacks = 0;
+
+    double hitRate() const {
+        uint64_t total = hits + misses;
+        return total == 0 ? 0.0 : static_cast<double>(hits) / total;
+    }
+};
+
+// Fixed-size cache of PAGE_SIZE frames shared by the data (.dat) and index (.idx)
+// files. Pages are pinned while in use and written back lazily when evicted
+// (CLOCK replacement) or when their file is flushed. With a write-ahead log attached,
+// a dirty page is logged before it is written back; if its statement has not committed
+// yet, the page's committed image is logged too so recovery can roll it back.
+class BufferPool {
+public:
+    explicit BufferPool(size_t frame_count = DEFAULT_POOL_FRAMES);
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Opens (creating if needed) a file and returns its id; reopening returns the same id
+    int openFile(const std::string& path);
+    // Writes back and drops every cached page of the file, then closes it
+    void closeFile(int file_id);
+    void closeAll();
+
+    Page* fetchPage(int file_id, uint32_t page_no);
+    Page* newPage(int file_id, uint32_t& page_no);
+    void unpinPage(int file_id, uint32_t page_no, bool dirty);
+
+    void flushFile(int file_id);
+    void flushAll();
+    // Writes back every dirty page and forces all open files to disk; false if any of that failed
+    bool syncAll();
+
+    void attachLog(WriteAheadLog* log);
+    // Appends the image of every page changed since it was last logged and ends the statement;
+    // returns the last LSN the statement wrote, 0 if none
+    uint64_t logDirtyPages();
+    // Logs the pages changed so far by the statement in progress, with their committed images,
+    // without ending it, so they can be written back without a log sync; returns the last LSN
+    uint64_t logStatementPages();
+
+    // Logical file size in bytes, including pages that have not been written back yet
+    uint64_t fileSize(int file_id) const;
+    uint32_t pageCount(int file_id) const;
+
+    // Byte-addressed access for files that are not page-structured
+    bool readBytes(int file_id, uint64_t offset, void* dst, size_t len);
+    bool writeBytes(int file_id, uint64_t offset, const void* src, size_t len);
+
+    BufferPoolStats getStats() const;
+    double hitRate() const;
+    size_t frameCount() const { return frames.size(); }
+
+private:
+    struct Frame {
+        Page page;
+        int file_id = -1;
+        uint32_t page_no = 0;
+        int pin_count = 0;
+        bool dirty = false;
+        bool referenced = false;
+        bool unlogged = false; // Changed since its image was last appended to the log
+        uint64_t lsn = 0;      // Log record holding the latest image
+    };
+
+    struct PooledFile {
+        std::string path;
+        std::fstream stream;
+        uint64_t size = 0;
+        uint64_t committed_size = 0; // Size as of the last commit; recovery cuts the file back to it
+    };
+
+    std::vector<Frame> frames;
+    std::unordered_map<uint64_t, size_t> page_table;
+    std::unordered_map<int, std::unique_ptr<PooledFile>> files;
+    std::unordered_map<std::string, int> file_ids;
+    size_t clock_hand = 0;
+    int next_file_id = 0;
+    BufferPoolStats stats;
+    WriteAheadLog* log = nullptr;
+    std::unordered_set<uint64_t> logged_pages; // Committed image is in the log since the last sync
+    std::unordered_set<uint64_t> statement_pages; // Logged by the statement in progress before it commits
+    uint64_t statement_lsn = 0;                   // Last record logged for one of them
+    mutable std::mutex mutex;
+
+    static uint64_t pageKey(int file_id, uint32_t page_no) {
+        return (static_cast<uint64_t>(file_id) << 32) | page_no;
+    }
+
+    Frame* pinFrame(int file_id, uint32_t page_no, bool load);
+    bool findVictim(size_t& frame_index);
+    void markDirty(Frame& frame);
+    void logFrame(Frame& frame);
+    void logBeforeImage(Frame& frame, PooledFile& file);
+    void logUncommitted(Frame& frame, PooledFile& file);
+    bool writeFrame(Frame& frame);
+    bool flushFileLocked(int file_id);
+};
+
+#endif
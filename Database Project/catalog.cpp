@@ -4,9 +4,10 @@
 void Catalog::load(const std::string& path) {
     std::ifstream file(path, std::ios::binary);
     if (file) {
-        int table_count;
+        // An empty catalog file (a database without tables) holds no count at all
+        int table_count = 0;
         file.read(reinterpret_cast<char*>(&table_count), sizeof(table_count));
-        for (int i = 0; i < table_count; i++) {
+        for (int i = 0; i < table_count && file; i++) {
             TableSchema table;
             int name_length;
             file.read(reinterpret_cast<char*>(&name_length), sizeof(name_length));
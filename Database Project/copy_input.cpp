@@ -0,0 +1,162 @@
+#include "copy_input.h"
+#include <algorithm>
+#include <cstring>
+
+ChunkedInput::ChunkedInput(const std::string& path) : file(path, std::ios::binary), buffer(COPY_READ_CHUNK, '\0') {}
+
+bool ChunkedInput::fill() {
+    if (eof) {
+        return false;
+    }
+    if (pos > 0) {
+        std::memmove(&buffer[0], buffer.data() + pos, end - pos);
+        end -= pos;
+        pos = 0;
+    }
+    if (end == buffer.size()) {
+        buffer.resize(buffer.size() * 2);
+    }
+    file.read(&buffer[end], static_cast<std::streamsize>(std::min(buffer.size() - end, COPY_READ_CHUNK)));
+    size_t count = static_cast<size_t>(file.gcount());
+    end += count;
+    if (count == 0) {
+        eof = true;
+    }
+    return count > 0;
+}
+
+bool CsvReader::next(std::vector<std::string_view>& fields) {
+    fields.clear();
+    size_t scanned = pos; // Where the search for the end of the record resumes
+    bool in_quotes = false;
+    size_t newlines = 0;
+    while (true) {
+        // The record ends at the first line break outside quotes
+        size_t record_end = std::string::npos;
+        for (size_t i = scanned; i < end; i++) {
+            char c = buffer[i];
+            if (c == '"') {
+                in_quotes = !in_quotes;
+            } else if (c == '\n') {
+                if (!in_quotes) {
+                    record_end = i;
+                    break;
+                }
+                newlines++;
+            }
+        }
+        if (record_end == std::string::npos) {
+            size_t offset = end - pos;
+            if (fill()) {
+                scanned = pos + offset;
+                continue;
+            }
+            if (pos == end) {
+                return false;
+            }
+            if (in_quotes) {
+                record_line = line;
+                error_message = "unterminated quoted field";
+                return false;
+            }
+            record_end = end; // Last record without a line break
+        }
+
+        size_t start = pos;
+        size_t stop = record_end;
+        if (stop > start && buffer[stop - 1] == '\r') {
+            stop--;
+        }
+        pos = record_end < end ? record_end + 1 : end;
+        record_line = line;
+        line += newlines + 1;
+        if (stop == start) {
+            // Blank line
+            scanned = pos;
+            newlines = 0;
+            continue;
+        }
+        return splitFields(start, stop, fields);
+    }
+}
+
+bool CsvReader::splitFields(size_t start, size_t stop, std::vector<std::string_view>& fields) {
+    size_t i = start;
+    while (true) {
+        if (i < stop && buffer[i] == '"') {
+            // Quoted: the text is copied down over the quotes, which it is never longer than
+            size_t out = i;
+            size_t field_start = out;
+            bool closed = false;
+            i++;
+            while (i < stop) {
+                if (buffer[i] == '"') {
+                    if (i + 1 < stop && buffer[i + 1] == '"') {
+                        buffer[out++] = '"';
+                        i += 2;
+                        continue;
+                    }
+                    i++;
+                    closed = true;
+                    break;
+                }
+                buffer[out++] = buffer[i++];
+            }
+            if (!closed || (i < stop && buffer[i] != ',')) {
+                error_message = "malformed quoted field";
+                return false;
+            }
+            fields.emplace_back(buffer.data() + field_start, out - field_start);
+        } else {
+            size_t field_start = i;
+            while (i < stop && buffer[i] != ',') {
+                if (buffer[i] == '"') {
+                    error_message = "quote inside an unquoted field";
+                    return false;
+                }
+                i++;
+            }
+            fields.emplace_back(buffer.data() + field_start, i - field_start);
+        }
+        if (i >= stop) {
+            return true;
+        }
+        i++; // Skip ','
+    }
+}
+
+bool RecordFileReader::require(size_t count) {
+    while (end - pos < count) {
+        if (buffer.size() < count) {
+            buffer.resize(count);
+        }
+        if (!fill()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RecordFileReader::next(const char*& data, uint32_t& length) {
+    if (!require(sizeof(length))) {
+        if (pos != end) {
+            error_message = "file ends inside the length of record " + std::to_string(record_number + 1);
+        }
+        return false;
+    }
+    std::memcpy(&length, buffer.data() + pos, sizeof(length));
+    record_number++;
+    if (length > max_length) {
+        error_message = "record " + std::to_string(record_number) + " is " + std::to_string(length) +
+            " bytes, more than the " + std::to_string(max_length) + " a record can have";
+        return false;
+    }
+    pos += sizeof(length);
+    if (!require(length)) {
+        error_message = "file ends inside record " + std::to_string(record_number);
+        return false;
+    }
+    data = buffer.data() + pos;
+    pos += length;
+    return true;
+}
@@ -0,0 +1,77 @@
+#ifndef COPY_INPUT_H
+#define COPY_INPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Bytes read from an input file per read call
+constexpr size_t COPY_READ_CHUNK = 1024 * 1024;
+
+// A file read a chunk at a time into a buffer holding the bytes not consumed yet
+class ChunkedInput {
+public:
+    bool isOpen() const { return file.is_open(); }
+    const std::string& error() const { return error_message; }
+
+protected:
+    explicit ChunkedInput(const std::string& path);
+
+    std::ifstream file;
+    std::string buffer;
+    size_t pos = 0; // Start of the unconsumed bytes
+    size_t end = 0; // End of the valid bytes
+    bool eof = false;
+    std::string error_message;
+
+    // Moves the unconsumed bytes to the front of the buffer, growing it if they fill it, and
+    // reads more after them; false once the file has no more
+    bool fill();
+};
+
+// Splits a CSV file into records of fields. Fields are separated by commas and may be
+// enclosed in double quotes, inside which "" stands for one quote and commas and line breaks
+// are literal. Records end at LF or CRLF; blank lines are skipped.
+class CsvReader : public ChunkedInput {
+public:
+    explicit CsvReader(const std::string& path) : ChunkedInput(path) {}
+
+    // Fields of the next record. The views point into the reader's buffer and stay valid until
+    // the following call. False at the end of the file, or with error() set on malformed input.
+    bool next(std::vector<std::string_view>& fields);
+    // Line on which the record last returned starts
+    size_t lineNumber() const { return record_line; }
+
+private:
+    size_t line = 1;
+    size_t record_line = 0;
+
+    // Splits buffer[start, stop), unquoting fields in place
+    bool splitFields(size_t start, size_t stop, std::vector<std::string_view>& fields);
+};
+
+// Reads a file of records that are already in a table's on-disk encoding, each preceded by
+// its length as a 32-bit unsigned integer in the byte order of the machine (as in the data
+// files themselves). Lengths over max_length are reported as errors.
+class RecordFileReader : public ChunkedInput {
+public:
+    RecordFileReader(const std::string& path, uint32_t max_length) : ChunkedInput(path), max_length(max_length) {}
+
+    // The next record, valid until the following call. False at the end of the file, or with
+    // error() set if a record is too long or the file ends inside one.
+    bool next(const char*& data, uint32_t& length);
+    // Position of the record last returned, counting from 1
+    size_t recordNumber() const { return record_number; }
+
+private:
+    uint32_t max_length;
+    size_t record_number = 0;
+
+    // Makes at least count unconsumed bytes available; false if the file ends first
+    bool require(size_t count);
+};
+
+#endif
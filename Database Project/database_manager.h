@@ -3,13 +3,24 @@
 
 #include "catalog.h"
 #include "bptree.h"
+#include "buffer_pool.h"
+#include "heap_file.h"
+#include "statistics.h"
+#include "wal.h"
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <tuple>
 #include <variant>
 #include <fstream>
 #include <iostream>
 #include <filesystem>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
 #include <shlobj.h>  // For SHGetKnownFolderPath
 #pragma comment(lib, "shell32.lib")  // Link with shell32.lib
 #ifdef _WIN32
@@ -19,12 +30,34 @@
 #include <limits.h> // For PATH_MAX
 #endif
 
+// Background compaction: tables with this many tombstoned records are vacuumed a few pages at a time
+constexpr uint32_t COMPACT_THRESHOLD = 256;
+constexpr uint32_t COMPACT_PAGES_PER_ROUND = 16;
+constexpr std::chrono::seconds COMPACT_INTERVAL(5);
+
 // Define a generic record type that can hold different data types
 using FieldValue = std::variant<int, float, std::string, bool>;
+// Name-keyed row, used only where rows leave the engine (console menus, INSERT values)
 using Record = std::map<std::string, FieldValue>;
+// Column values by ordinal; a row's column names come from the schema or RowSet it belongs to
+using Row = std::vector<FieldValue>;
+
+// Rows sharing one list of column names, e.g. a table scan or a join result
+struct RowSet {
+    std::vector<std::string> columns;
+    std::vector<Row> rows;
+
+    // Ordinal of a column, -1 if there is no such column
+    int columnIndex(const std::string& name) const;
+    size_t size() const { return rows.size(); }
+    bool empty() const { return rows.empty(); }
+    Record toRecord(size_t row) const;
+    std::vector<Record> toRecords() const;
+};
 
 // Forward declaration of Condition struct
 struct Condition;
+class RowOperator;
 
 // Comparison operators for FieldValue
 inline bool operator==(const FieldValue& lhs, const FieldValue& rhs) {
@@ -43,6 +76,33 @@ inline bool operator!=(const FieldValue& lhs, const FieldValue& rhs) {
     return !(lhs == rhs);
 }
 
+// How a statement reaches the rows its WHERE clause selects. Index paths cover an inclusive
+// [lo, hi] slice of an INT primary key; the residual conditions are the ones the index does
+// not answer and are still checked on every row it returns.
+struct AccessPath {
+    enum Kind { FULL_SCAN, INDEX_POINT, INDEX_RANGE };
+
+    Kind kind = FULL_SCAN;
+    int lo = 0;
+    int hi = 0;
+    std::vector<std::tuple<std::string, std::string, FieldValue>> residual_conditions;
+    std::vector<std::string> residual_operators;
+    std::vector<size_t> residual_positions; // Of each residual condition among those given
+};
+
+// Encoded rows appended to a table per write during a COPY; each such batch is logged
+constexpr size_t COPY_BATCH_BYTES = 1024 * 1024;
+
+// How the file read by a COPY is laid out: CSV text, or records already in the table's
+// on-disk encoding, each preceded by its length (see RecordFileReader)
+struct CopyOptions {
+    enum Format { CSV, BINARY };
+
+    Format format = CSV;
+    bool header = false;             // CSV: the first record names the columns and is skipped
+    bool defer_foreign_keys = false; // Check foreign keys once for the whole file, at the end
+};
+
 class DatabaseManager {
 public:
     DatabaseManager(const std::string& catalog_path = "catalog.bin");
@@ -56,6 +116,23 @@ public:
     );
 
     bool insertRecord(const std::string& table_name, const Record& record);
+    // Inserts schema-ordered rows as one statement. All rows are validated, and their keys
+    // checked against the index and each other, before any is written; the records are then
+    // appended in one pass, indexed in key order and committed together.
+    // Returns the number of rows inserted, -1 on error.
+    int insertRows(const std::string& table_name, const std::vector<Row>& rows);
+    // Bulk load: reads the file at path a chunk at a time, encodes each row straight into its
+    // record and appends the records to the end of the data file in batches of
+    // COPY_BATCH_BYTES, logging each batch. The primary key index is filled at the end,
+    // from the sorted keys, which is also where duplicate keys are found. Foreign keys are
+    // looked up as rows are read unless the checks are deferred; a table referring to itself
+    // is always checked at the end, as its rows may refer to later ones. If anything fails,
+    // the rows already written are deleted again. The load commits once, after all of this,
+    // so recovery rolls back a load cut short by a crash. Without a write-ahead log its rows
+    // stay in the data file instead; if the index was empty, it is rebuilt from them at the
+    // next start.
+    // Returns the number of rows loaded, -1 on error.
+    int copyFrom(const std::string& table_name, const std::string& path, const CopyOptions& options);
 
     std::vector<Record> searchRecords(const std::string& table_name, const std::string& key_column, const FieldValue& key_value);
 
@@ -67,6 +144,12 @@ public:
         const std::string& table_name,
         const std::vector<std::tuple<std::string, std::string, FieldValue>>& conditions,
         const std::vector<std::string>& operators);
+    // Row-based forms of the above; the columns follow the table's schema order
+    RowSet getAllRows(const std::string& table_name);
+    RowSet searchRowsWithFilter(
+        const std::string& table_name,
+        const std::vector<std::tuple<std::string, std::string, FieldValue>>& conditions,
+        const std::vector<std::string>& operators);
 
     bool updateRecordsWithFilter(
         const std::string& table_name,
@@ -84,35 +167,120 @@ public:
     bool dropTable(const std::string& table_name);
     std::vector<std::string> listDatabases() const;
     std::string getCurrentDatabase() const;
+    BufferPoolStats getBufferPoolStats() const;
+    WalStats getWalStats() const;
+    // Changes whenever a table is created or dropped or another database is opened, so that
+    // statements parsed earlier know to check their tables again
+    uint64_t getSchemaVersion() const;
+    // Reclaims the space of deleted records in one table, or in all tables when the name is empty.
+    // Returns the number of records reclaimed, -1 on error.
+    int vacuum(const std::string& table_name = "");
+    // Gathers the optimizer's statistics (see statistics.h) for one table, or for all tables
+    // when the name is empty, with a full scan of each. Returns the number of rows read, -1 on error.
+    int analyze(const std::string& table_name = "");
     std::vector<Record> joinTables(
         const std::string& table1_name,
         const std::string& table2_name,
         const Condition& join_condition,
         const std::vector<std::tuple<std::string, std::string, FieldValue>>& where_conditions,
         const std::vector<std::string>& where_operators);
+    // Join result columns are named "table.column", those of table1 first
+    RowSet joinRows(
+        const std::string& table1_name,
+        const std::string& table2_name,
+        const Condition& join_condition,
+        const std::vector<std::tuple<std::string, std::string, FieldValue>>& where_conditions,
+        const std::vector<std::string>& where_operators);
 
 private:
+    // Query plans are built from the tables' files, indexes and statistics directly
+    friend class Optimizer;
+
     Catalog catalog;
     std::string catalog_path;
+    Statistics statistics;
+    WriteAheadLog wal; // Declared before the pool, which may still write pages back while destroyed
+    BufferPool buffer_pool;
     std::map<std::string, BPlusTree*> indexes;
+    std::map<std::string, HeapFile*> data_files;
     std::string current_database;
+    uint64_t schema_version = 0;
+    uint64_t statistics_version = 0; // Incremented by every ANALYZE
+
+    // Held by every public operation; the compactor thread takes it between statements
+    mutable std::recursive_mutex db_mutex;
+    std::thread compactor;
+    std::mutex compactor_mutex;
+    std::condition_variable compactor_wakeup;
+    std::atomic<bool> stop_compactor{ false };
 
     Column::Type stringToColumnType(const std::string& type_str);
-    void saveRecord(std::ofstream& file, const Record& record, const TableSchema& schema, int& offset);
-    Record loadRecord(std::ifstream& file, const TableSchema& schema);
+    std::string encodeRow(const Row& row, const TableSchema& schema);
+    Row loadRow(const char* data, size_t length, const TableSchema& schema);
+    // Row of only the wanted columns; the others are stepped over without being decoded
+    Row loadRow(const char* data, size_t length, const TableSchema& schema, const std::vector<bool>& wanted);
+    // Which columns of a table are named in names, bare or qualified with the table name or
+    // column_prefix; all of them if names contains "*"
+    std::vector<bool> referencedColumns(
+        const TableSchema& schema,
+        const std::vector<std::string>& names,
+        const std::string& column_prefix) const;
+    // Schema-ordered row from a name-keyed record; missing columns get their type's default
+    Row recordToRow(const Record& record, const TableSchema& schema);
     int getFieldSize(const Column& column) const;
-    void serializeField(std::ofstream& file, const FieldValue& value, const Column& column);
-    FieldValue deserializeField(std::ifstream& file, const Column& column);
+    // Byte offset of the column at ordinal inside the encoded form of row
+    uint16_t fieldOffset(const Row& row, const TableSchema& schema, size_t ordinal) const;
+    void serializeField(std::string& buffer, const FieldValue& value, const Column& column);
+    FieldValue deserializeField(const char*& cursor, const char* end, const Column& column);
+    // Advances cursor past one encoded field
+    void skipField(const char*& cursor, const char* end, const Column& column) const;
 
-    void createIndex(const TableSchema& schema);
-    void loadIndexes();
-    bool evaluateCondition(
-        const Record& record,
+    HeapFile* openDataFile(const TableSchema& schema);
+    void closeDataFile(const std::string& table_name);
+    void closeAllTables();
+    void rebuildIndex(const TableSchema& schema);
+    // Statistics file of the current database, next to its catalog
+    std::string statisticsPath() const;
+    // Live row and page counts combined with the last ANALYZE of the table; the primary key
+    // column is always known to be unique, with the range its index currently holds
+    TableStatistics tableStatistics(const TableSchema& schema);
+
+    // Logs the pages changed by the current statement followed by its commit record, and
+    // returns the LSN to wait for (0 if there is nothing to wait for). Called under db_mutex.
+    uint64_t logCommit();
+    // Waits until the log is durable up to lsn; false if it could not be written, in which
+    // case the statement did not commit. Statements call it after releasing db_mutex, so
+    // statements that commit meanwhile are made durable by the same log sync.
+    bool waitForCommit(uint64_t lsn);
+    // logCommit and waitForCommit without releasing the lock, for internal changes
+    bool commitChanges();
+    // Writes every cached page to disk, after which the log is emptied; false (and the log
+    // kept) if the pages could not all be written
+    bool checkpoint();
+    bool openLog(const std::filesystem::path& db_path);
+    void compactorLoop();
+    // Vacuums a batch of pages in every table over the threshold; true if work remains
+    bool compactRound();
+    void closeLog();
+    // Matching rows with their ids, read along the access path chosen for the WHERE clause
+    std::vector<std::pair<RecordId, Row>> findMatches(
+        const TableSchema& schema,
+        HeapFile& heap,
+        const std::vector<std::tuple<std::string, std::string, FieldValue>>& conditions,
+        const std::vector<std::string>& operators);
+    // Uses the primary key index when an AND-only WHERE clause compares the INT key with
+    // constants: one key is a point lookup, bounds are a range scan, anything else a full scan
+    AccessPath chooseAccessPath(
+        const TableSchema& schema,
         const std::vector<std::tuple<std::string, std::string, FieldValue>>& conditions,
         const std::vector<std::string>& operators);
+
+    void createIndex(const TableSchema& schema);
+    void loadIndexes();
     std::filesystem::path getDatabasePath(const std::string& db_name);
 };
 
-bool evaluateSingleCondition(const Record& record, const std::string& column, const std::string& op, const FieldValue& value);
+// Column names of a table in schema order
+std::vector<std::string> columnNames(const TableSchema& schema);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,664 @@
+#include "heap_file.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t HEAP_MAGIC = 0x50414548; // "HEAP"
+constexpr uint32_t META_PAGE = 0;
+constexpr uint8_t PAGE_IN_FREE_LIST = 0x01;
+// Pages are offered for reuse once this much space can be reclaimed in them
+constexpr uint16_t FREE_LIST_THRESHOLD = HEAP_PAGE_DATA_SIZE / 4;
+// Meta page data: magic, the number of tombstoned records, the number of live records and a
+// marker saying the live count is maintained (files written before it existed lack it)
+constexpr size_t DEAD_RECORDS_OFFSET = sizeof(HEAP_MAGIC);
+constexpr size_t LIVE_RECORDS_OFFSET = DEAD_RECORDS_OFFSET + sizeof(uint32_t);
+constexpr size_t LIVE_COUNT_MARKER_OFFSET = LIVE_RECORDS_OFFSET + sizeof(uint32_t);
+constexpr uint32_t LIVE_COUNT_MARKER = 0x544E4E43; // "CNNT"
+
+HeapPageHeader* pageHeader(Page* page) {
+    return reinterpret_cast<HeapPageHeader*>(page->data);
+}
+
+HeapSlot* pageSlots(Page* page) {
+    return reinterpret_cast<HeapSlot*>(page->data + sizeof(HeapPageHeader));
+}
+
+const HeapPageHeader* pageHeader(const Page* page) {
+    return reinterpret_cast<const HeapPageHeader*>(page->data);
+}
+
+const HeapSlot* pageSlots(const Page* page) {
+    return reinterpret_cast<const HeapSlot*>(page->data + sizeof(HeapPageHeader));
+}
+
+uint16_t directoryEnd(const HeapPageHeader* header) {
+    return static_cast<uint16_t>(sizeof(HeapPageHeader) + header->slot_count * sizeof(HeapSlot));
+}
+
+void updateFreeSpace(Page* page) {
+    HeapPageHeader* header = pageHeader(page);
+    page->header.free_space = static_cast<uint16_t>(header->data_start - directoryEnd(header));
+}
+
+uint16_t slotLength(const HeapSlot& slot) {
+    return slot.length & ~HEAP_SLOT_TOMBSTONE;
+}
+
+bool isTombstone(const HeapSlot& slot) {
+    return slot.offset != 0 && (slot.length & HEAP_SLOT_TOMBSTONE);
+}
+
+void initDataPage(Page* page) {
+    std::memset(page, 0, sizeof(Page));
+    pageHeader(page)->slot_count = 0;
+    pageHeader(page)->data_start = HEAP_PAGE_DATA_SIZE;
+    updateFreeSpace(page);
+}
+
+// Bytes that a compaction would make available, including holes left by updates and
+// vacuumed records. Tombstoned records still hold their bytes.
+uint16_t reclaimableSpace(Page* page) {
+    HeapPageHeader* header = pageHeader(page);
+    HeapSlot* slots = pageSlots(page);
+    uint32_t live = 0;
+    for (uint16_t i = 0; i < header->slot_count; i++) {
+        if (slots[i].offset != 0) {
+            live += slotLength(slots[i]);
+        }
+    }
+    return static_cast<uint16_t>(HEAP_PAGE_DATA_SIZE - directoryEnd(header) - live);
+}
+
+// Drops trailing empty slots; no record id can refer to them
+void trimSlots(Page* page) {
+    HeapPageHeader* header = pageHeader(page);
+    HeapSlot* slots = pageSlots(page);
+    while (header->slot_count > 0 && slots[header->slot_count - 1].offset == 0) {
+        header->slot_count--;
+    }
+}
+
+// Packs live records against the end of the page so holes become contiguous free space.
+// Slot numbers are preserved, so record ids stay valid.
+void compactPage(Page* page) {
+    Page copy;
+    std::memcpy(&copy, page, sizeof(Page));
+
+    HeapPageHeader* header = pageHeader(page);
+    HeapSlot* slots = pageSlots(page);
+    uint16_t data_start = HEAP_PAGE_DATA_SIZE;
+    for (uint16_t i = 0; i < header->slot_count; i++) {
+        if (slots[i].offset == 0) continue;
+        uint16_t length = slotLength(slots[i]);
+        data_start -= length;
+        std::memcpy(page->data + data_start, copy.data + slots[i].offset, length);
+        slots[i].offset = data_start;
+    }
+    header->data_start = data_start;
+    updateFreeSpace(page);
+}
+
+// A slot holding a live record
+bool validSlot(Page* page, uint16_t slot) {
+    HeapPageHeader* header = pageHeader(page);
+    return slot < header->slot_count && pageSlots(page)[slot].offset != 0 && !isTombstone(pageSlots(page)[slot]);
+}
+
+} // namespace
+
+HeapFile::HeapFile(BufferPool& pool, const std::string& path) : pool(pool), path(path), file_id(-1) {
+    file_id = pool.openFile(path);
+    if (file_id < 0) {
+        return;
+    }
+
+    if (pool.fileSize(file_id) == 0) {
+        uint32_t page_no;
+        Page* meta = pool.newPage(file_id, page_no);
+        if (!meta) {
+            close();
+            return;
+        }
+        std::memset(meta, 0, sizeof(Page));
+        std::memcpy(meta->data, &HEAP_MAGIC, sizeof(HEAP_MAGIC));
+        std::memcpy(meta->data + LIVE_COUNT_MARKER_OFFSET, &LIVE_COUNT_MARKER, sizeof(LIVE_COUNT_MARKER));
+        meta->header.next_page = 0;
+        pool.unpinPage(file_id, page_no, true);
+        pool.flushFile(file_id);
+        return;
+    }
+
+    Page* meta = pool.fetchPage(file_id, META_PAGE);
+    uint32_t magic = 0;
+    uint32_t marker = 0;
+    if (meta) {
+        std::memcpy(&magic, meta->data, sizeof(magic));
+        std::memcpy(&marker, meta->data + LIVE_COUNT_MARKER_OFFSET, sizeof(marker));
+        pool.unpinPage(file_id, META_PAGE, false);
+    }
+    if (magic != HEAP_MAGIC || pool.fileSize(file_id) % PAGE_SIZE != 0) {
+        std::cerr << "Error: '" << path << "' is not a heap data file" << std::endl;
+        close();
+        return;
+    }
+
+    // Older files start counting once, with a scan
+    if (marker != LIVE_COUNT_MARKER) {
+        uint32_t live = 0;
+        {
+            HeapScanner scanner(*this);
+            RecordId rid;
+            const char* data;
+            uint16_t length;
+            while (scanner.next(rid, data, length)) {
+                live++;
+            }
+        }
+        meta = pool.fetchPage(file_id, META_PAGE);
+        if (meta) {
+            std::memcpy(meta->data + LIVE_RECORDS_OFFSET, &live, sizeof(live));
+            std::memcpy(meta->data + LIVE_COUNT_MARKER_OFFSET, &LIVE_COUNT_MARKER, sizeof(LIVE_COUNT_MARKER));
+            pool.unpinPage(file_id, META_PAGE, true);
+        }
+    }
+}
+
+HeapFile::~HeapFile() {
+    close();
+}
+
+uint32_t HeapFile::pageCount() const {
+    return isOpen() ? pool.pageCount(file_id) : 0;
+}
+
+bool HeapFile::insert(const std::string& bytes, RecordId& rid) {
+    if (!place(bytes, rid)) {
+        return false;
+    }
+    adjustCounter(LIVE_RECORDS_OFFSET, 1);
+    return true;
+}
+
+bool HeapFile::append(const std::vector<std::string>& records, std::vector<RecordId>& rids) {
+    rids.clear();
+    if (!isOpen()) {
+        return false;
+    }
+    rids.reserve(records.size());
+
+    uint32_t page_count = pool.pageCount(file_id);
+    uint32_t page_id = page_count - 1;
+    Page* page = page_count > 1 ? pool.fetchPage(file_id, page_id) : nullptr;
+    bool page_dirty = false;
+    bool ok = true;
+    for (const auto& bytes : records) {
+        if (bytes.empty() || bytes.size() > MAX_HEAP_RECORD_SIZE) {
+            std::cerr << "Error: Record of " << bytes.size() << " bytes does not fit in a "
+                << PAGE_SIZE << " byte page" << std::endl;
+            ok = false;
+            break;
+        }
+        uint16_t length = static_cast<uint16_t>(bytes.size());
+        uint16_t slot;
+        if (page && insertIntoPage(page, bytes.data(), length, slot)) {
+            page_dirty = true;
+            rids.push_back(RecordId{ page_id, slot });
+            continue;
+        }
+
+        // The page is full: move on to a new one
+        if (page) {
+            pool.unpinPage(file_id, page_id, page_dirty);
+        }
+        page = pool.newPage(file_id, page_id);
+        if (!page) {
+            ok = false;
+            break;
+        }
+        if (page_id >= (1u << (31 - SLOT_BITS))) {
+            std::cerr << "Error: Heap file '" << path << "' reached its maximum size" << std::endl;
+            pool.unpinPage(file_id, page_id, false);
+            page = nullptr;
+            ok = false;
+            break;
+        }
+        initDataPage(page);
+        insertIntoPage(page, bytes.data(), length, slot);
+        page_dirty = true;
+        rids.push_back(RecordId{ page_id, slot });
+    }
+    if (page) {
+        pool.unpinPage(file_id, page_id, page_dirty);
+    }
+
+    adjustCounter(LIVE_RECORDS_OFFSET, static_cast<int>(rids.size()));
+    return ok;
+}
+
+bool HeapFile::place(const std::string& bytes, RecordId& rid) {
+    if (!isOpen()) {
+        return false;
+    }
+    if (bytes.empty() || bytes.size() > MAX_HEAP_RECORD_SIZE) {
+        std::cerr << "Error: Record of " << bytes.size() << " bytes does not fit in a "
+            << PAGE_SIZE << " byte page" << std::endl;
+        return false;
+    }
+    uint16_t length = static_cast<uint16_t>(bytes.size());
+
+    Page* meta = pool.fetchPage(file_id, META_PAGE);
+    if (!meta) {
+        return false;
+    }
+    bool meta_dirty = false;
+
+    // First reuse space freed by deletes, dropping pages from the list once they fill up
+    while (meta->header.next_page != 0) {
+        uint32_t page_id = meta->header.next_page;
+        Page* page = pool.fetchPage(file_id, page_id);
+        if (!page) {
+            break;
+        }
+        uint16_t slot;
+        bool inserted = insertIntoPage(page, bytes.data(), length, slot);
+        if (!inserted || reclaimableSpace(page) < FREE_LIST_THRESHOLD) {
+            meta->header.next_page = page->header.next_page;
+            page->header.next_page = 0;
+            page->header.flags &= ~PAGE_IN_FREE_LIST;
+            meta_dirty = true;
+        }
+        pool.unpinPage(file_id, page_id, true);
+        if (inserted) {
+            pool.unpinPage(file_id, META_PAGE, meta_dirty);
+            rid = RecordId{ page_id, slot };
+            return true;
+        }
+    }
+    pool.unpinPage(file_id, META_PAGE, meta_dirty);
+
+    // Then the last page of the file
+    uint32_t page_count = pool.pageCount(file_id);
+    if (page_count > 1) {
+        uint32_t page_id = page_count - 1;
+        Page* page = pool.fetchPage(file_id, page_id);
+        if (page) {
+            uint16_t slot;
+            bool inserted = insertIntoPage(page, bytes.data(), length, slot);
+            pool.unpinPage(file_id, page_id, inserted);
+            if (inserted) {
+                rid = RecordId{ page_id, slot };
+                return true;
+            }
+        }
+    }
+
+    // Otherwise grow the file by one page
+    uint32_t page_id;
+    Page* page = pool.newPage(file_id, page_id);
+    if (!page) {
+        return false;
+    }
+    if (page_id >= (1u << (31 - SLOT_BITS))) {
+        std::cerr << "Error: Heap file '" << path << "' reached its maximum size" << std::endl;
+        pool.unpinPage(file_id, page_id, false);
+        return false;
+    }
+    initDataPage(page);
+    uint16_t slot;
+    insertIntoPage(page, bytes.data(), length, slot);
+    pool.unpinPage(file_id, page_id, true);
+    rid = RecordId{ page_id, slot };
+    return true;
+}
+
+bool HeapFile::read(const RecordId& rid, std::string& bytes) {
+    if (!isOpen() || rid.page_id == META_PAGE || rid.page_id >= pageCount()) {
+        return false;
+    }
+    Page* page = pool.fetchPage(file_id, rid.page_id);
+    if (!page) {
+        return false;
+    }
+    bool found = validSlot(page, rid.slot);
+    if (found) {
+        const HeapSlot& entry = pageSlots(page)[rid.slot];
+        bytes.assign(page->data + entry.offset, entry.length);
+    }
+    pool.unpinPage(file_id, rid.page_id, false);
+    return found;
+}
+
+bool HeapFile::update(const RecordId& rid, const std::string& bytes, RecordId& new_rid) {
+    if (!isOpen() || rid.page_id == META_PAGE || rid.page_id >= pageCount()) {
+        return false;
+    }
+    if (bytes.empty() || bytes.size() > MAX_HEAP_RECORD_SIZE) {
+        std::cerr << "Error: Record of " << bytes.size() << " bytes does not fit in a "
+            << PAGE_SIZE << " byte page" << std::endl;
+        return false;
+    }
+    uint16_t length = static_cast<uint16_t>(bytes.size());
+
+    Page* page = pool.fetchPage(file_id, rid.page_id);
+    if (!page) {
+        return false;
+    }
+    if (!validSlot(page, rid.slot)) {
+        pool.unpinPage(file_id, rid.page_id, false);
+        return false;
+    }
+
+    HeapSlot& entry = pageSlots(page)[rid.slot];
+    if (length <= entry.length) {
+        // Same or smaller: overwrite in place, the tail becomes a hole
+        std::memcpy(page->data + entry.offset, bytes.data(), length);
+        entry.length = length;
+        pool.unpinPage(file_id, rid.page_id, true);
+        new_rid = rid;
+        return true;
+    }
+
+    // Larger: keep the record in its slot if the page can make room for it
+    if (reclaimableSpace(page) + entry.length >= length) {
+        entry.offset = 0;
+        entry.length = 0;
+        placeInSlot(page, rid.slot, bytes.data(), length);
+        pool.unpinPage(file_id, rid.page_id, true);
+        new_rid = rid;
+        return true;
+    }
+    pool.unpinPage(file_id, rid.page_id, false);
+
+    // Otherwise write the new copy elsewhere before releasing the old one
+    if (!insert(bytes, new_rid)) {
+        return false;
+    }
+    return erase(rid);
+}
+
+bool HeapFile::overwrite(const RecordId& rid, uint16_t offset, const std::string& bytes) {
+    if (!isOpen() || rid.page_id == META_PAGE || rid.page_id >= pageCount()) {
+        return false;
+    }
+    Page* page = pool.fetchPage(file_id, rid.page_id);
+    if (!page) {
+        return false;
+    }
+    if (!validSlot(page, rid.slot) || offset + bytes.size() > pageSlots(page)[rid.slot].length) {
+        pool.unpinPage(file_id, rid.page_id, false);
+        return false;
+    }
+    std::memcpy(page->data + pageSlots(page)[rid.slot].offset + offset, bytes.data(), bytes.size());
+    pool.unpinPage(file_id, rid.page_id, true);
+    return true;
+}
+
+bool HeapFile::erase(const RecordId& rid) {
+    if (!isOpen() || rid.page_id == META_PAGE || rid.page_id >= pageCount()) {
+        return false;
+    }
+    Page* page = pool.fetchPage(file_id, rid.page_id);
+    if (!page) {
+        return false;
+    }
+    if (!validSlot(page, rid.slot)) {
+        pool.unpinPage(file_id, rid.page_id, false);
+        return false;
+    }
+
+    HeapSlot& entry = pageSlots(page)[rid.slot];
+    entry.offset = 0;
+    entry.length = 0;
+    trimSlots(page);
+    updateFreeSpace(page);
+    adjustCounter(LIVE_RECORDS_OFFSET, -1);
+
+    if (!(page->header.flags & PAGE_IN_FREE_LIST) && reclaimableSpace(page) >= FREE_LIST_THRESHOLD) {
+        Page* meta = pool.fetchPage(file_id, META_PAGE);
+        if (meta) {
+            addToFreeList(meta, page, rid.page_id);
+            pool.unpinPage(file_id, META_PAGE, true);
+        }
+    }
+    pool.unpinPage(file_id, rid.page_id, true);
+    return true;
+}
+
+bool HeapFile::markDeleted(const RecordId& rid) {
+    if (!isOpen() || rid.page_id == META_PAGE || rid.page_id >= pageCount()) {
+        return false;
+    }
+    Page* page = pool.fetchPage(file_id, rid.page_id);
+    if (!page) {
+        return false;
+    }
+    if (!validSlot(page, rid.slot)) {
+        pool.unpinPage(file_id, rid.page_id, false);
+        return false;
+    }
+    pageSlots(page)[rid.slot].length |= HEAP_SLOT_TOMBSTONE;
+    pool.unpinPage(file_id, rid.page_id, true);
+    adjustCounter(DEAD_RECORDS_OFFSET, 1);
+    adjustCounter(LIVE_RECORDS_OFFSET, -1);
+    return true;
+}
+
+uint32_t HeapFile::deadRecords() {
+    return readCounter(DEAD_RECORDS_OFFSET);
+}
+
+uint32_t HeapFile::recordCount() {
+    return readCounter(LIVE_RECORDS_OFFSET);
+}
+
+uint32_t HeapFile::readCounter(size_t offset) {
+    uint32_t value = 0;
+    Page* meta = isOpen() ? pool.fetchPage(file_id, META_PAGE) : nullptr;
+    if (meta) {
+        std::memcpy(&value, meta->data + offset, sizeof(value));
+        pool.unpinPage(file_id, META_PAGE, false);
+    }
+    return value;
+}
+
+uint32_t HeapFile::vacuum(uint32_t max_pages) {
+    if (!isOpen()) {
+        return 0;
+    }
+    uint32_t page_count = pageCount();
+    uint32_t reclaimed = 0;
+    for (uint32_t visited = 0; visited < max_pages && page_count > 1; visited++) {
+        if (vacuum_cursor >= page_count) {
+            vacuum_cursor = 1;
+        }
+        uint32_t page_id = vacuum_cursor++;
+        Page* page = pool.fetchPage(file_id, page_id);
+        if (!page) {
+            break;
+        }
+
+        HeapPageHeader* header = pageHeader(page);
+        HeapSlot* slots = pageSlots(page);
+        uint32_t in_page = 0;
+        for (uint16_t i = 0; i < header->slot_count; i++) {
+            if (isTombstone(slots[i])) {
+                slots[i].offset = 0;
+                slots[i].length = 0;
+                in_page++;
+            }
+        }
+        if (in_page == 0) {
+            pool.unpinPage(file_id, page_id, false);
+            continue;
+        }
+
+        trimSlots(page);
+        compactPage(page);
+        if (!(page->header.flags & PAGE_IN_FREE_LIST) && reclaimableSpace(page) >= FREE_LIST_THRESHOLD) {
+            Page* meta = pool.fetchPage(file_id, META_PAGE);
+            if (meta) {
+                addToFreeList(meta, page, page_id);
+                pool.unpinPage(file_id, META_PAGE, true);
+            }
+        }
+        pool.unpinPage(file_id, page_id, true);
+        reclaimed += in_page;
+    }
+
+    if (reclaimed > 0) {
+        adjustCounter(DEAD_RECORDS_OFFSET, -static_cast<int>(reclaimed));
+    }
+    return reclaimed;
+}
+
+void HeapFile::flush() {
+    if (isOpen()) {
+        pool.flushFile(file_id);
+    }
+}
+
+void HeapFile::close() {
+    if (isOpen()) {
+        pool.closeFile(file_id);
+        file_id = -1;
+    }
+}
+
+bool HeapFile::insertIntoPage(Page* page, const char* data, uint16_t length, uint16_t& slot) {
+    HeapPageHeader* header = pageHeader(page);
+    HeapSlot* slots = pageSlots(page);
+
+    // Reuse an empty slot before growing the directory
+    uint16_t target = header->slot_count;
+    for (uint16_t i = 0; i < header->slot_count; i++) {
+        if (slots[i].offset == 0) {
+            target = i;
+            break;
+        }
+    }
+    if (!placeInSlot(page, target, data, length)) {
+        return false;
+    }
+    slot = target;
+    return true;
+}
+
+bool HeapFile::placeInSlot(Page* page, uint16_t slot, const char* data, uint16_t length) {
+    HeapPageHeader* header = pageHeader(page);
+    uint16_t directory_growth = slot < header->slot_count ? 0 : sizeof(HeapSlot);
+    uint32_t needed = static_cast<uint32_t>(length) + directory_growth;
+
+    if (page->header.free_space < needed) {
+        if (reclaimableSpace(page) < needed) {
+            return false;
+        }
+        compactPage(page);
+    }
+
+    if (directory_growth) {
+        header->slot_count++;
+    }
+    header->data_start -= length;
+    std::memcpy(page->data + header->data_start, data, length);
+    pageSlots(page)[slot] = HeapSlot{ header->data_start, length };
+    updateFreeSpace(page);
+    return true;
+}
+
+void HeapFile::addToFreeList(Page* meta, Page* page, uint32_t page_id) {
+    page->header.next_page = meta->header.next_page;
+    page->header.flags |= PAGE_IN_FREE_LIST;
+    meta->header.next_page = page_id;
+}
+
+void HeapFile::adjustCounter(size_t offset, int delta) {
+    Page* meta = pool.fetchPage(file_id, META_PAGE);
+    if (!meta) {
+        return;
+    }
+    uint32_t value;
+    std::memcpy(&value, meta->data + offset, sizeof(value));
+    value = delta < 0 && static_cast<uint32_t>(-delta) > value ? 0 : value + delta;
+    std::memcpy(meta->data + offset, &value, sizeof(value));
+    pool.unpinPage(file_id, META_PAGE, true);
+}
+
+bool HeapFile::mapForScan(MappedFile& mapping) {
+    uint32_t pages = pageCount();
+    if (pages < MAPPED_SCAN_MIN_PAGES) {
+        return false;
+    }
+    // The mapping sees the file as written, so hand it every cached change first
+    pool.flushFile(file_id);
+    if (!mapping.open(path)) {
+        return false;
+    }
+    if (mapping.size() < static_cast<uint64_t>(pages) * PAGE_SIZE) {
+        mapping.close();
+        return false;
+    }
+    return true;
+}
+
+HeapScanner::HeapScanner(HeapFile& heap, Mode mode)
+    : heap(heap), page_id(1), end_page(heap.pageCount()), slot(0) {
+    if (mode == MAPPED && heap.mapForScan(own_mapping)) {
+        mapping = &own_mapping;
+        mapping->adviseSequential();
+    }
+}
+
+HeapScanner::HeapScanner(HeapFile& heap, MappedFile& mapping, uint32_t first_page, uint32_t end_page)
+    : heap(heap), page_id(first_page), end_page(end_page), slot(0), mapping(&mapping) {
+}
+
+HeapScanner::~HeapScanner() {
+    release();
+}
+
+bool HeapScanner::next(RecordId& rid, const char*& data, uint16_t& length) {
+    while (page_id < end_page) {
+        if (!page) {
+            if (mapping) {
+                if (page_id >= prefetched_to) {
+                    prefetched_to = std::min(end_page, page_id + MAPPED_SCAN_READAHEAD_PAGES);
+                    mapping->willNeed(static_cast<uint64_t>(page_id) * PAGE_SIZE,
+                        static_cast<uint64_t>(prefetched_to - page_id) * PAGE_SIZE);
+                }
+                page = reinterpret_cast<const Page*>(mapping->data() + static_cast<uint64_t>(page_id) * PAGE_SIZE);
+            }
+            else {
+                page = heap.pool.fetchPage(heap.file_id, page_id);
+                if (!page) {
+                    return false;
+                }
+            }
+            slot = 0;
+        }
+
+        const HeapPageHeader* header = pageHeader(page);
+        const HeapSlot* slots = pageSlots(page);
+        while (slot < header->slot_count) {
+            uint16_t current = slot++;
+            if (slots[current].offset == 0 || isTombstone(slots[current])) continue;
+            rid = RecordId{ page_id, current };
+            data = page->data + slots[current].offset;
+            length = slots[current].length;
+            return true;
+        }
+
+        release();
+        page_id++;
+    }
+    return false;
+}
+
+void HeapScanner::release() {
+    if (page && !mapping) {
+        heap.pool.unpinPage(heap.file_id, page_id, false);
+    }
+    page = nullptr;
+}
@@ -0,0 +1,150 @@
+#ifndef HEAP_FILE_H
+#define HEAP_FILE_H
+
+#include "buffer_pool.h"
+#include "mapped_file.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Location of a record inside a heap file
+struct RecordId {
+    uint32_t page_id;
+    uint16_t slot;
+};
+
+inline bool operator==(const RecordId& lhs, const RecordId& rhs) {
+    return lhs.page_id == rhs.page_id && lhs.slot == rhs.slot;
+}
+
+// The index stores record ids as a single int: 19 bits of page, 12 bits of slot (2GB per table)
+constexpr int SLOT_BITS = 12;
+
+inline int packRecordId(const RecordId& rid) {
+    return static_cast<int>((rid.page_id << SLOT_BITS) | rid.slot);
+}
+
+inline RecordId unpackRecordId(int packed) {
+    uint32_t value = static_cast<uint32_t>(packed);
+    return RecordId{ value >> SLOT_BITS, static_cast<uint16_t>(value & ((1u << SLOT_BITS) - 1)) };
+}
+
+// Per-page bookkeeping stored at the start of Page::data, followed by the slot directory.
+// Record bytes are packed from the end of the page towards the slot directory.
+struct HeapPageHeader {
+    uint16_t slot_count;
+    uint16_t data_start;
+};
+
+struct HeapSlot {
+    uint16_t offset; // 0 marks an empty slot
+    uint16_t length; // High bit marks a deleted record whose bytes are not reclaimed yet
+};
+
+constexpr uint16_t HEAP_SLOT_TOMBSTONE = 0x8000;
+
+constexpr uint16_t HEAP_PAGE_DATA_SIZE = sizeof(Page::data);
+constexpr uint16_t MAX_HEAP_RECORD_SIZE = HEAP_PAGE_DATA_SIZE - sizeof(HeapPageHeader) - sizeof(HeapSlot);
+
+// Smaller files are always scanned through the buffer pool
+constexpr uint32_t MAPPED_SCAN_MIN_PAGES = 64;
+// How far ahead of the current page a mapped scan asks the OS to read
+constexpr uint32_t MAPPED_SCAN_READAHEAD_PAGES = 64;
+
+// Table data file made of slotted pages. Page 0 is a meta page whose next_page heads a
+// list of data pages with reusable space; every other page holds records.
+// Deletes only tombstone a record's slot; vacuum() later frees the slots and their bytes.
+class HeapFile {
+public:
+    HeapFile(BufferPool& pool, const std::string& path);
+    ~HeapFile();
+
+    HeapFile(const HeapFile&) = delete;
+    HeapFile& operator=(const HeapFile&) = delete;
+
+    bool isOpen() const { return file_id >= 0; }
+    uint32_t pageCount() const;
+
+    bool insert(const std::string& bytes, RecordId& rid);
+    // Adds records at the end of the file, filling its last page and then new ones, with one
+    // page pinned at a time; space freed by deletes is not reused. rids receives one id per
+    // record written, in order, and is short of records.size() when false is returned.
+    bool append(const std::vector<std::string>& records, std::vector<RecordId>& rids);
+    bool read(const RecordId& rid, std::string& bytes);
+    // Rewrites a record in place when it fits in its page, otherwise moves it and reports the new id
+    bool update(const RecordId& rid, const std::string& bytes, RecordId& new_rid);
+    // Replaces bytes inside a record without changing its length, e.g. one fixed-width field
+    bool overwrite(const RecordId& rid, uint16_t offset, const std::string& bytes);
+    bool erase(const RecordId& rid);
+    // Tombstones a record: it disappears from reads and scans, its space waits for vacuum()
+    bool markDeleted(const RecordId& rid);
+
+    // Live records, kept up to date in the meta page
+    uint32_t recordCount();
+    // Tombstoned records not yet reclaimed
+    uint32_t deadRecords();
+    // Reclaims tombstones in up to max_pages pages, resuming where the previous call stopped.
+    // Record ids of live records do not change. Returns the number of records reclaimed.
+    uint32_t vacuum(uint32_t max_pages);
+
+    void flush();
+    void close();
+
+    // Maps the file for reading after writing back its cached pages. False if it has fewer
+    // than MAPPED_SCAN_MIN_PAGES pages or cannot be mapped; it is then read through the pool.
+    bool mapForScan(MappedFile& mapping);
+
+private:
+    friend class HeapScanner;
+
+    BufferPool& pool;
+    std::string path;
+    int file_id;
+    uint32_t vacuum_cursor = 1;
+
+    // insert() without counting the record
+    bool place(const std::string& bytes, RecordId& rid);
+    bool insertIntoPage(Page* page, const char* data, uint16_t length, uint16_t& slot);
+    bool placeInSlot(Page* page, uint16_t slot, const char* data, uint16_t length);
+    void addToFreeList(Page* meta, Page* page, uint32_t page_id);
+    uint32_t readCounter(size_t offset);
+    void adjustCounter(size_t offset, int delta);
+};
+
+// Forward scan over all live records, one pinned page at a time.
+// A MAPPED scan of a large file reads the pages straight from a memory mapping instead, so a
+// full-table read neither evicts the buffer pool nor copies pages into it. It writes back the
+// file's dirty pages first and falls back to the buffer pool if the file cannot be mapped.
+// The heap must not be modified while a mapped scan is open.
+class HeapScanner {
+public:
+    enum Mode { BUFFERED, MAPPED };
+
+    explicit HeapScanner(HeapFile& heap, Mode mode = BUFFERED);
+    // Scans only pages [first_page, end_page) through a mapping from HeapFile::mapForScan that
+    // the caller keeps open. Scanners over disjoint page ranges of one mapping (the morsels of
+    // a parallel scan) can run on different threads.
+    HeapScanner(HeapFile& heap, MappedFile& mapping, uint32_t first_page, uint32_t end_page);
+    ~HeapScanner();
+
+    HeapScanner(const HeapScanner&) = delete;
+    HeapScanner& operator=(const HeapScanner&) = delete;
+
+    // Points data at the record bytes inside the current page; valid until the next call
+    bool next(RecordId& rid, const char*& data, uint16_t& length);
+    bool isMapped() const { return mapping != nullptr; }
+
+private:
+    HeapFile& heap;
+    uint32_t page_id;
+    uint32_t end_page;
+    uint16_t slot;
+    const Page* page = nullptr;
+    MappedFile own_mapping;
+    MappedFile* mapping = nullptr; // own_mapping or the caller's; nullptr reads through the pool
+    uint32_t prefetched_to = 0; // Pages below this were already handed to willNeed
+
+    void release();
+};
+
+#endif
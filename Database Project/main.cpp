@@ -1161,9 +1161,16 @@ void executeQuery(DatabaseManager& db_manager, QueryParser& parser) {
             std::cout << "DROP TABLE table_name\n";
             std::cout << "SHOW TABLES\n";
             std::cout << "INSERT INTO table_name VALUES (value1, value2, ...)\n";
+            std::cout << "COPY table_name FROM 'file' [WITH (FORMAT CSV | BINARY, HEADER, DEFER_FOREIGN_KEYS)]\n";
             std::cout << "SELECT * FROM table_name [WHERE condition]\n";
+            std::cout << "EXPLAIN SELECT ...\n";
             std::cout << "UPDATE table_name SET column = value [WHERE condition]\n";
-            std::cout << "DELETE FROM table_name [WHERE condition]\n\n";
+            std::cout << "DELETE FROM table_name [WHERE condition]\n";
+            std::cout << "VACUUM [table_name]\n";
+            std::cout << "ANALYZE [table_name]\n";
+            std::cout << "PREPARE name AS statement (with ? in place of values)\n";
+            std::cout << "EXECUTE name [(value1, value2, ...)]\n";
+            std::cout << "DEALLOCATE name\n\n";
         } else if (!query.empty()) {
             if (parser.parse(query)) {
                 if (parser.execute()) {
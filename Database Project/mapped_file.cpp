@@ -0,0 +1,105 @@
+#include "mapped_file.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    file_handle = file;
+    mapping_handle = mapping;
+    base = static_cast<const char*>(view);
+    length = static_cast<uint64_t>(file_size.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps its own reference to the file
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    base = static_cast<const char*>(view);
+    length = static_cast<uint64_t>(info.st_size);
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+    if (!base) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(base);
+    CloseHandle(static_cast<HANDLE>(mapping_handle));
+    CloseHandle(static_cast<HANDLE>(file_handle));
+    mapping_handle = nullptr;
+    file_handle = nullptr;
+#else
+    munmap(const_cast<char*>(base), static_cast<size_t>(length));
+#endif
+    base = nullptr;
+    length = 0;
+}
+
+void MappedFile::adviseSequential() {
+#ifndef _WIN32
+    if (base) {
+        madvise(const_cast<char*>(base), static_cast<size_t>(length), MADV_SEQUENTIAL);
+    }
+#endif
+    // Windows: the file was opened with FILE_FLAG_SEQUENTIAL_SCAN instead
+}
+
+void MappedFile::willNeed(uint64_t offset, uint64_t len) {
+    if (!base || offset >= length) {
+        return;
+    }
+    len = len < length - offset ? len : length - offset;
+#ifdef _WIN32
+    // PrefetchVirtualMemory needs Windows 8 and the build targets Windows 7; page faults on
+    // a mapped view are already clustered by the cache manager
+    (void)len;
+#else
+    // madvise needs a page-aligned start address
+    uint64_t aligned = offset & ~static_cast<uint64_t>(sysconf(_SC_PAGESIZE) - 1);
+    madvise(const_cast<char*>(base + aligned), static_cast<size_t>(len + offset - aligned), MADV_WILLNEED);
+#endif
+}
@@ -0,0 +1,41 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file, used for large sequential scans that should
+// not go through (and evict) the buffer pool. Writes made through the file's streams are
+// visible in the mapping once they have been handed to the OS.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Returns false if the file is empty or cannot be mapped; callers then read it normally
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return base != nullptr; }
+
+    const char* data() const { return base; }
+    uint64_t size() const { return length; }
+
+    // Tells the kernel the mapping is read front to back (aggressive readahead, early drop)
+    void adviseSequential();
+    // Starts reading [offset, offset + len) in the background
+    void willNeed(uint64_t offset, uint64_t len);
+
+private:
+    const char* base = nullptr;
+    uint64_t length = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
+
+#endif
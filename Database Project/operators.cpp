@@ -0,0 +1,819 @@
+#include "operators.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+#include <type_traits>
+
+RowSet collectRows(RowOperator& root) {
+    RowSet result;
+    result.columns = root.columns();
+    RowBatch batch;
+    while (root.next(batch)) {
+        std::move(batch.begin(), batch.end(), std::back_inserter(result.rows));
+    }
+    return result;
+}
+
+TableScan::TableScan(std::recursive_mutex& db_mutex, HeapFile& heap, std::vector<std::string> columns, RowDecoder decode)
+    : lock(db_mutex), scanner(heap, HeapScanner::MAPPED), decode(std::move(decode)) {
+    output_columns = std::move(columns);
+}
+
+bool TableScan::next(RowBatch& batch) {
+    batch.clear();
+    RecordId rid;
+    const char* data;
+    uint16_t length;
+    while (batch.size() < ROW_BATCH_SIZE && scanner.next(rid, data, length)) {
+        batch.push_back(decode(data, length));
+    }
+    return !batch.empty();
+}
+
+ParallelTableScan::ParallelTableScan(std::recursive_mutex& db_mutex, HeapFile& heap, std::vector<std::string> columns,
+    RowDecoder decode, std::unique_ptr<Predicate> predicate, size_t threads)
+    : lock(db_mutex), heap(heap), decode(std::move(decode)), predicate(std::move(predicate)) {
+    output_columns = std::move(columns);
+    if (!heap.mapForScan(mapping)) {
+        serial = std::make_unique<HeapScanner>(heap);
+        return;
+    }
+    // Page 0 is the meta page
+    morsel_count = (heap.pageCount() - 1 + MORSEL_PAGES - 1) / MORSEL_PAGES;
+    window = static_cast<uint32_t>(std::max<size_t>(threads, 1)) * 2;
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+        workers.emplace_back(&ParallelTableScan::work, this);
+    }
+}
+
+ParallelTableScan::~ParallelTableScan() {
+    {
+        std::lock_guard<std::mutex> guard(morsel_mutex);
+        stopping = true;
+    }
+    morsel_changed.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ParallelTableScan::scanMorsel(uint32_t morsel, RowBatch& rows) {
+    uint32_t first_page = 1 + morsel * MORSEL_PAGES;
+    uint32_t end_page = std::min(heap.pageCount(), first_page + MORSEL_PAGES);
+    HeapScanner scanner(heap, mapping, first_page, end_page);
+    RecordId rid;
+    const char* data;
+    uint16_t length;
+    while (scanner.next(rid, data, length)) {
+        Row row = decode(data, length);
+        if (predicate->matches(row)) {
+            rows.push_back(std::move(row));
+        }
+    }
+}
+
+void ParallelTableScan::work() {
+    while (true) {
+        uint32_t morsel;
+        {
+            std::unique_lock<std::mutex> guard(morsel_mutex);
+            morsel_changed.wait(guard, [&] {
+                return stopping || next_morsel >= morsel_count || next_morsel < output_morsel + window;
+            });
+            if (stopping || next_morsel >= morsel_count) {
+                return;
+            }
+            morsel = next_morsel++;
+        }
+        RowBatch rows;
+        scanMorsel(morsel, rows);
+        {
+            std::lock_guard<std::mutex> guard(morsel_mutex);
+            finished[morsel] = std::move(rows);
+        }
+        morsel_changed.notify_all();
+    }
+}
+
+bool ParallelTableScan::next(RowBatch& batch) {
+    batch.clear();
+    if (serial) {
+        RecordId rid;
+        const char* data;
+        uint16_t length;
+        while (batch.size() < ROW_BATCH_SIZE && serial->next(rid, data, length)) {
+            Row row = decode(data, length);
+            if (predicate->matches(row)) {
+                batch.push_back(std::move(row));
+            }
+        }
+        return !batch.empty();
+    }
+
+    while (batch.size() < ROW_BATCH_SIZE) {
+        if (current_pos >= current.size()) {
+            if (output_morsel >= morsel_count) {
+                break;
+            }
+            // Wait for the next morsel in page order
+            std::unique_lock<std::mutex> guard(morsel_mutex);
+            morsel_changed.wait(guard, [&] { return finished.count(output_morsel) > 0; });
+            current = std::move(finished[output_morsel]);
+            finished.erase(output_morsel);
+            output_morsel++;
+            current_pos = 0;
+            guard.unlock();
+            morsel_changed.notify_all();
+            continue;
+        }
+        size_t take = std::min(ROW_BATCH_SIZE - batch.size(), current.size() - current_pos);
+        std::move(current.begin() + current_pos, current.begin() + current_pos + take, std::back_inserter(batch));
+        current_pos += take;
+    }
+    return !batch.empty();
+}
+
+IndexScan::IndexScan(std::recursive_mutex& db_mutex, HeapFile& heap, BPlusTree& index, int lo, int hi,
+    std::vector<std::string> columns, RowDecoder decode, KeyCheck holds_key, BPlusCursor::Direction direction)
+    : lock(db_mutex), heap(heap), cursor(index.range(lo, hi, direction)), decode(std::move(decode)),
+      holds_key(std::move(holds_key)) {
+    output_columns = std::move(columns);
+}
+
+bool IndexScan::next(RowBatch& batch) {
+    batch.clear();
+    int key, offset;
+    std::string bytes;
+    while (batch.size() < ROW_BATCH_SIZE && cursor.next(key, offset)) {
+        if (heap.read(unpackRecordId(offset), bytes) && holds_key(bytes.data(), bytes.size(), key)) {
+            batch.push_back(decode(bytes.data(), bytes.size()));
+        }
+    }
+    return !batch.empty();
+}
+
+Filter::Filter(std::unique_ptr<RowOperator> child, std::unique_ptr<Predicate> predicate)
+    : child(std::move(child)), predicate(std::move(predicate)) {
+    output_columns = this->child->columns();
+}
+
+bool Filter::next(RowBatch& batch) {
+    batch.clear();
+    // Keep pulling until something passes, so an empty batch always means the end
+    while (batch.empty() && child->next(input)) {
+        for (auto& row : input) {
+            if (predicate->matches(row)) {
+                batch.push_back(std::move(row));
+            }
+        }
+    }
+    return !batch.empty();
+}
+
+namespace {
+
+// Ordinal of a requested column: the full name first (e.g., "users.name"), then the base
+// name (e.g., "name"); -1 if neither is a column
+int resolveColumn(const std::vector<std::string>& columns, const std::string& name) {
+    auto find = [&](const std::string& wanted) {
+        auto it = std::find(columns.begin(), columns.end(), wanted);
+        return it == columns.end() ? -1 : static_cast<int>(it - columns.begin());
+    };
+    int ordinal = find(name);
+    size_t dot_pos = name.find('.');
+    if (ordinal < 0 && dot_pos != std::string::npos) {
+        ordinal = find(name.substr(dot_pos + 1));
+    }
+    return ordinal;
+}
+
+} // namespace
+
+Project::Project(std::unique_ptr<RowOperator> child, const std::vector<std::string>& names)
+    : child(std::move(child)) {
+    for (const auto& name : names) {
+        int ordinal = resolveColumn(this->child->columns(), name);
+        if (ordinal >= 0) {
+            output_columns.push_back(name);
+            ordinals.push_back(ordinal);
+        }
+    }
+}
+
+bool Project::next(RowBatch& batch) {
+    batch.clear();
+    if (ordinals.empty() || !child->next(input)) {
+        return false;
+    }
+    batch.reserve(input.size());
+    for (auto& row : input) {
+        Row projected;
+        projected.reserve(ordinals.size());
+        for (int ordinal : ordinals) {
+            projected.push_back(std::move(row[ordinal]));
+        }
+        batch.push_back(std::move(projected));
+    }
+    return true;
+}
+
+namespace {
+
+// Rough heap footprint of a row, for the hash join memory budget
+size_t rowBytes(const Row& row) {
+    size_t bytes = sizeof(Row) + row.size() * sizeof(FieldValue);
+    for (const auto& value : row) {
+        if (const auto* text = std::get_if<std::string>(&value)) {
+            bytes += text->capacity();
+        }
+    }
+    return bytes;
+}
+
+// Spreads keys over the partitions using different hash bits than the hash table buckets
+size_t partitionOf(const FieldValue& key) {
+    uint64_t hash = std::hash<FieldValue>{}(key);
+    return static_cast<size_t>(((hash * 0x9E3779B97F4A7C15ull) >> 32) % HASH_JOIN_PARTITIONS);
+}
+
+std::atomic<uint64_t> spill_counter{ 0 };
+
+} // namespace
+
+SpillFile::SpillFile() {
+    auto stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+    path = (std::filesystem::temp_directory_path() /
+        ("dbspill_" + std::to_string(stamp) + "_" + std::to_string(spill_counter++) + ".tmp")).string();
+    stream.open(path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+    if (!stream) {
+        std::cerr << "Error: Failed to create spill file: " << path << std::endl;
+    }
+}
+
+SpillFile::~SpillFile() {
+    stream.close();
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+}
+
+bool SpillFile::write(const Row& row) {
+    uint16_t count = static_cast<uint16_t>(row.size());
+    stream.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (const auto& value : row) {
+        uint8_t type = static_cast<uint8_t>(value.index());
+        stream.write(reinterpret_cast<const char*>(&type), sizeof(type));
+        std::visit([&](const auto& v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, std::string>) {
+                uint32_t length = static_cast<uint32_t>(v.size());
+                stream.write(reinterpret_cast<const char*>(&length), sizeof(length));
+                stream.write(v.data(), length);
+            } else {
+                stream.write(reinterpret_cast<const char*>(&v), sizeof(v));
+            }
+        }, value);
+    }
+    return static_cast<bool>(stream);
+}
+
+void SpillFile::rewind() {
+    stream.flush();
+    stream.clear();
+    stream.seekg(0);
+}
+
+bool SpillFile::read(Row& row) {
+    uint16_t count;
+    if (!stream.read(reinterpret_cast<char*>(&count), sizeof(count))) {
+        return false;
+    }
+    row.clear();
+    row.reserve(count);
+    for (uint16_t i = 0; i < count; i++) {
+        uint8_t type = 0;
+        stream.read(reinterpret_cast<char*>(&type), sizeof(type));
+        switch (type) {
+        case 0: { int v = 0; stream.read(reinterpret_cast<char*>(&v), sizeof(v)); row.push_back(v); break; }
+        case 1: { float v = 0; stream.read(reinterpret_cast<char*>(&v), sizeof(v)); row.push_back(v); break; }
+        case 2: {
+            uint32_t length = 0;
+            stream.read(reinterpret_cast<char*>(&length), sizeof(length));
+            std::string v(length, '\0');
+            stream.read(&v[0], length);
+            row.push_back(std::move(v));
+            break;
+        }
+        default: { bool v = false; stream.read(reinterpret_cast<char*>(&v), sizeof(v)); row.push_back(v); break; }
+        }
+    }
+    return static_cast<bool>(stream);
+}
+
+HashJoin::HashJoin(std::unique_ptr<RowOperator> left, std::unique_ptr<RowOperator> right,
+    int left_key, int right_key, bool build_left)
+    : build_left(build_left) {
+    output_columns = left->columns();
+    const auto& right_columns = right->columns();
+    output_columns.insert(output_columns.end(), right_columns.begin(), right_columns.end());
+
+    build_input = build_left ? std::move(left) : std::move(right);
+    probe_input = build_left ? std::move(right) : std::move(left);
+    build_key = build_left ? left_key : right_key;
+    probe_key = build_left ? right_key : left_key;
+}
+
+void HashJoin::build() {
+    built = true;
+    size_t memory = 0;
+    RowBatch batch;
+    while (build_input->next(batch)) {
+        if (!build_partitions.empty()) {
+            spill(batch);
+            continue;
+        }
+        for (auto& row : batch) {
+            memory += rowBytes(row);
+            FieldValue key = row[build_key];
+            table[std::move(key)].push_back(std::move(row));
+        }
+        if (memory <= HASH_JOIN_MEMORY_BUDGET) {
+            continue;
+        }
+
+        // Over budget: move what was loaded so far to disk and partition the rest as it arrives
+        for (size_t i = 0; i < HASH_JOIN_PARTITIONS; i++) {
+            build_partitions.push_back(std::make_unique<SpillFile>());
+            probe_partitions.push_back(std::make_unique<SpillFile>());
+        }
+        for (auto& [key, rows] : table) {
+            spill(rows);
+        }
+        table.clear();
+    }
+    // The build input is fully consumed; release its scan
+    build_input.reset();
+
+    if (build_partitions.empty()) {
+        return;
+    }
+    while (probe_input->next(batch)) {
+        for (const auto& row : batch) {
+            probe_partitions[partitionOf(row[probe_key])]->write(row);
+        }
+    }
+    probe_input.reset();
+    for (size_t i = 0; i < HASH_JOIN_PARTITIONS; i++) {
+        build_partitions[i]->rewind();
+        probe_partitions[i]->rewind();
+    }
+    partition = 0;
+    loadPartition();
+}
+
+void HashJoin::spill(RowBatch& pending) {
+    for (const auto& row : pending) {
+        build_partitions[partitionOf(row[build_key])]->write(row);
+    }
+}
+
+bool HashJoin::loadPartition() {
+    table.clear();
+    if (partition >= HASH_JOIN_PARTITIONS) {
+        return false;
+    }
+    Row row;
+    while (build_partitions[partition]->read(row)) {
+        FieldValue key = row[build_key];
+        table[std::move(key)].push_back(std::move(row));
+    }
+    // Its rows are in memory now
+    build_partitions[partition].reset();
+    return true;
+}
+
+bool HashJoin::nextProbeBatch() {
+    if (probe_partitions.empty()) {
+        return probe_input->next(input);
+    }
+    input.clear();
+    while (partition < HASH_JOIN_PARTITIONS) {
+        Row row;
+        while (input.size() < ROW_BATCH_SIZE && probe_partitions[partition]->read(row)) {
+            input.push_back(std::move(row));
+        }
+        if (!input.empty()) {
+            return true;
+        }
+        // This partition pair is done
+        probe_partitions[partition].reset();
+        partition++;
+        loadPartition();
+    }
+    return false;
+}
+
+bool HashJoin::next(RowBatch& batch) {
+    if (!built) {
+        build();
+    }
+    batch.clear();
+    while (batch.size() < ROW_BATCH_SIZE) {
+        if (input_pos >= input.size()) {
+            if (!nextProbeBatch()) {
+                break;
+            }
+            input_pos = 0;
+            match_pos = 0;
+        }
+
+        const Row& probe = input[input_pos];
+        auto it = table.find(probe[probe_key]);
+        if (it == table.end() || match_pos >= it->second.size()) {
+            input_pos++;
+            match_pos = 0;
+            continue;
+        }
+
+        const Row& match = it->second[match_pos++];
+        const Row& left_row = build_left ? match : probe;
+        const Row& right_row = build_left ? probe : match;
+        Row combined;
+        combined.reserve(output_columns.size());
+        combined.insert(combined.end(), left_row.begin(), left_row.end());
+        combined.insert(combined.end(), right_row.begin(), right_row.end());
+        batch.push_back(std::move(combined));
+    }
+    return !batch.empty();
+}
+
+IndexNestedLoopJoin::IndexNestedLoopJoin(std::recursive_mutex& db_mutex, std::unique_ptr<RowOperator> outer,
+    int outer_key, HeapFile& inner_heap, BPlusTree& inner_index, std::vector<std::string> inner_columns,
+    RowDecoder decode, KeyCheck holds_key, bool outer_left)
+    : lock(db_mutex), outer(std::move(outer)), outer_key(outer_key), inner_heap(inner_heap),
+      inner_index(inner_index), decode(std::move(decode)), holds_key(std::move(holds_key)), outer_left(outer_left) {
+    output_columns = outer_left ? this->outer->columns() : inner_columns;
+    const auto& rest = outer_left ? inner_columns : this->outer->columns();
+    output_columns.insert(output_columns.end(), rest.begin(), rest.end());
+}
+
+bool IndexNestedLoopJoin::next(RowBatch& batch) {
+    batch.clear();
+    std::vector<std::pair<int, size_t>> probes;
+    std::string bytes;
+    while (batch.empty() && outer->next(input)) {
+        // Probing in key order walks the index leaves and heap pages mostly forward
+        probes.clear();
+        for (size_t i = 0; i < input.size(); i++) {
+            if (const int* key = std::get_if<int>(&input[i][outer_key])) {
+                probes.emplace_back(*key, i);
+            }
+        }
+        std::sort(probes.begin(), probes.end());
+
+        std::vector<Row> matches;
+        for (size_t p = 0; p < probes.size(); p++) {
+            // Repeated foreign keys reuse the previous lookup
+            if (p == 0 || probes[p].first != probes[p - 1].first) {
+                matches.clear();
+                for (int offset : inner_index.search(probes[p].first)) {
+                    if (inner_heap.read(unpackRecordId(offset), bytes) &&
+                        holds_key(bytes.data(), bytes.size(), probes[p].first)) {
+                        matches.push_back(decode(bytes.data(), bytes.size()));
+                    }
+                }
+            }
+            const Row& outer_row = input[probes[p].second];
+            for (const Row& match : matches) {
+                const Row& left_row = outer_left ? outer_row : match;
+                const Row& right_row = outer_left ? match : outer_row;
+                Row combined;
+                combined.reserve(output_columns.size());
+                combined.insert(combined.end(), left_row.begin(), left_row.end());
+                combined.insert(combined.end(), right_row.begin(), right_row.end());
+                batch.push_back(std::move(combined));
+            }
+        }
+    }
+    return !batch.empty();
+}
+
+std::string Aggregate::name() const {
+    static const char* const names[] = { "COUNT", "SUM", "AVG", "MIN", "MAX" };
+    return std::string(names[function]) + "(" + column + ")";
+}
+
+bool parseAggregate(const std::string& text, Aggregate& aggregate) {
+    size_t open = text.find('(');
+    if (open == std::string::npos || text.size() < open + 3 || text.back() != ')') {
+        return false;
+    }
+    std::string function = text.substr(0, open);
+    std::transform(function.begin(), function.end(), function.begin(), ::toupper);
+    if (function == "COUNT") aggregate.function = Aggregate::COUNT;
+    else if (function == "SUM") aggregate.function = Aggregate::SUM;
+    else if (function == "AVG") aggregate.function = Aggregate::AVG;
+    else if (function == "MIN") aggregate.function = Aggregate::MIN;
+    else if (function == "MAX") aggregate.function = Aggregate::MAX;
+    else return false;
+    aggregate.column = text.substr(open + 1, text.size() - open - 2);
+    return true;
+}
+
+void AggregateState::add(Aggregate::Function function, const FieldValue* value) {
+    count++;
+    if (!value) {
+        return; // COUNT(*)
+    }
+    switch (function) {
+    case Aggregate::SUM:
+    case Aggregate::AVG:
+        if (const int* v = std::get_if<int>(value)) {
+            int_sum += *v;
+        } else if (const float* v = std::get_if<float>(value)) {
+            float_sum += *v;
+            saw_float = true;
+        }
+        break;
+    case Aggregate::MIN:
+        if (count == 1 || *value < extreme) extreme = *value;
+        break;
+    case Aggregate::MAX:
+        if (count == 1 || extreme < *value) extreme = *value;
+        break;
+    default:
+        break;
+    }
+}
+
+void AggregateState::merge(Aggregate::Function function, const AggregateState& other) {
+    if (other.count == 0) {
+        return;
+    }
+    bool first = count == 0;
+    count += other.count;
+    int_sum += other.int_sum;
+    float_sum += other.float_sum;
+    saw_float = saw_float || other.saw_float;
+    if ((function == Aggregate::MIN && (first || other.extreme < extreme)) ||
+        (function == Aggregate::MAX && (first || extreme < other.extreme))) {
+        extreme = other.extreme;
+    }
+}
+
+FieldValue AggregateState::result(Aggregate::Function function) const {
+    switch (function) {
+    case Aggregate::COUNT:
+        return static_cast<int>(count);
+    case Aggregate::SUM:
+        // INT sums that no longer fit an INT are returned as FLOAT
+        if (saw_float || int_sum > INT32_MAX || int_sum < INT32_MIN) return static_cast<float>(float_sum + int_sum);
+        return static_cast<int>(int_sum);
+    case Aggregate::AVG:
+        return count == 0 ? 0.0f : static_cast<float>((float_sum + int_sum) / count);
+    default:
+        return count == 0 ? FieldValue(0) : extreme;
+    }
+}
+
+size_t RowHash::operator()(const Row& row) const {
+    size_t hash = 0;
+    for (const auto& value : row) {
+        hash = hash * 31 + std::hash<FieldValue>{}(value);
+    }
+    return hash;
+}
+
+HashAggregate::HashAggregate(std::unique_ptr<RowOperator> child, const std::vector<std::string>& group_by,
+    std::vector<Aggregate> aggregates, size_t threads)
+    : child(std::move(child)), aggregates(std::move(aggregates)), threads(std::max<size_t>(threads, 1)) {
+    const std::vector<std::string>& child_columns = this->child->columns();
+    for (const auto& name : group_by) {
+        int ordinal = resolveColumn(child_columns, name);
+        if (ordinal < 0) {
+            std::cerr << "Error: Unknown GROUP BY column '" << name << "'" << std::endl;
+            continue;
+        }
+        output_columns.push_back(name);
+        group_ordinals.push_back(ordinal);
+    }
+    for (const auto& aggregate : this->aggregates) {
+        int ordinal = -1;
+        if (aggregate.column != "*") {
+            ordinal = resolveColumn(child_columns, aggregate.column);
+            if (ordinal < 0) {
+                std::cerr << "Error: Unknown aggregate column '" << aggregate.column << "'" << std::endl;
+            }
+        }
+        output_columns.push_back(aggregate.name());
+        aggregate_ordinals.push_back(ordinal);
+    }
+}
+
+void HashAggregate::accumulate(GroupTable& table, const RowBatch& batch) const {
+    Row key;
+    for (const auto& row : batch) {
+        key.clear();
+        for (int ordinal : group_ordinals) {
+            key.push_back(row[ordinal]);
+        }
+        auto it = table.find(key);
+        if (it == table.end()) {
+            it = table.emplace(key, std::vector<AggregateState>(aggregates.size())).first;
+        }
+        for (size_t i = 0; i < aggregates.size(); i++) {
+            it->second[i].add(aggregates[i].function, aggregate_ordinals[i] < 0 ? nullptr : &row[aggregate_ordinals[i]]);
+        }
+    }
+}
+
+void HashAggregate::consume() {
+    consumed = true;
+    std::vector<GroupTable> tables(1);
+    RowBatch batch;
+    bool more = child->next(batch);
+    if (more) {
+        accumulate(tables[0], batch);
+        more = child->next(batch);
+    }
+
+    // More than one batch: the rest is aggregated by worker threads, one partial table each
+    if (more && threads > 1) {
+        tables.resize(threads);
+        std::mutex queue_mutex;
+        std::condition_variable queue_changed;
+        std::deque<RowBatch> queue;
+        bool done = false;
+
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < threads; i++) {
+            workers.emplace_back([&, i] {
+                RowBatch work;
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(queue_mutex);
+                        queue_changed.wait(lock, [&] { return !queue.empty() || done; });
+                        if (queue.empty()) {
+                            return;
+                        }
+                        work = std::move(queue.front());
+                        queue.pop_front();
+                    }
+                    queue_changed.notify_all();
+                    accumulate(tables[i], work);
+                }
+            });
+        }
+        do {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            // Bounded queue, so the scan does not run ahead of the workers
+            queue_changed.wait(lock, [&] { return queue.size() < threads * 2; });
+            queue.push_back(std::move(batch));
+            lock.unlock();
+            queue_changed.notify_all();
+            more = child->next(batch);
+        } while (more);
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            done = true;
+        }
+        queue_changed.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        for (size_t i = 1; i < tables.size(); i++) {
+            for (auto& [key, states] : tables[i]) {
+                auto it = tables[0].find(key);
+                if (it == tables[0].end()) {
+                    tables[0].emplace(key, std::move(states));
+                    continue;
+                }
+                for (size_t a = 0; a < aggregates.size(); a++) {
+                    it->second[a].merge(aggregates[a].function, states[a]);
+                }
+            }
+            tables[i].clear();
+        }
+    }
+    for (; more; more = child->next(batch)) {
+        accumulate(tables[0], batch);
+    }
+    // All input is in the table; release the scan
+    child.reset();
+
+    // Aggregates over no rows still produce their single row
+    if (tables[0].empty() && group_ordinals.empty()) {
+        tables[0].emplace(Row(), std::vector<AggregateState>(aggregates.size()));
+    }
+    results.reserve(tables[0].size());
+    for (auto& [key, states] : tables[0]) {
+        Row row = key;
+        for (size_t i = 0; i < aggregates.size(); i++) {
+            row.push_back(states[i].result(aggregates[i].function));
+        }
+        results.push_back(std::move(row));
+    }
+}
+
+bool HashAggregate::next(RowBatch& batch) {
+    if (!consumed) {
+        consume();
+    }
+    batch.clear();
+    size_t end = std::min(results.size(), result_pos + ROW_BATCH_SIZE);
+    for (; result_pos < end; result_pos++) {
+        batch.push_back(std::move(results[result_pos]));
+    }
+    return !batch.empty();
+}
+
+Sort::Sort(std::unique_ptr<RowOperator> child, const std::vector<SortKey>& sort_keys, size_t limit)
+    : child(std::move(child)), limit(limit) {
+    output_columns = this->child->columns();
+    for (const auto& key : sort_keys) {
+        int ordinal = resolveColumn(output_columns, key.column);
+        if (ordinal < 0) {
+            std::cerr << "Error: Unknown ORDER BY column '" << key.column << "'" << std::endl;
+            continue;
+        }
+        keys.emplace_back(ordinal, key.descending);
+    }
+}
+
+bool Sort::before(const Entry& a, const Entry& b) const {
+    for (const auto& [ordinal, descending] : keys) {
+        const FieldValue& x = a.row[ordinal];
+        const FieldValue& y = b.row[ordinal];
+        if (x < y) return !descending;
+        if (y < x) return descending;
+    }
+    return a.position < b.position;
+}
+
+void Sort::sortInput() {
+    sorted = true;
+    auto compare = [this](const Entry& a, const Entry& b) { return before(a, b); };
+    RowBatch batch;
+    size_t position = 0;
+    while (limit > 0 && child->next(batch)) {
+        for (auto& row : batch) {
+            Entry entry{ std::move(row), position++ };
+            if (entries.size() < limit) {
+                entries.push_back(std::move(entry));
+                if (limit != SIZE_MAX && entries.size() == limit) {
+                    std::make_heap(entries.begin(), entries.end(), compare);
+                }
+            } else if (before(entry, entries.front())) {
+                // Replaces the last of the best rows so far
+                std::pop_heap(entries.begin(), entries.end(), compare);
+                entries.back() = std::move(entry);
+                std::push_heap(entries.begin(), entries.end(), compare);
+            }
+        }
+    }
+    child.reset();
+    if (entries.size() == limit) {
+        std::sort_heap(entries.begin(), entries.end(), compare);
+    } else {
+        std::sort(entries.begin(), entries.end(), compare);
+    }
+}
+
+bool Sort::next(RowBatch& batch) {
+    if (!sorted) {
+        sortInput();
+    }
+    batch.clear();
+    size_t end = std::min(entries.size(), result_pos + ROW_BATCH_SIZE);
+    for (; result_pos < end; result_pos++) {
+        batch.push_back(std::move(entries[result_pos].row));
+    }
+    return !batch.empty();
+}
+
+Limit::Limit(std::unique_ptr<RowOperator> child, size_t limit, size_t offset)
+    : child(std::move(child)), remaining(limit), to_skip(offset) {
+    output_columns = this->child->columns();
+}
+
+bool Limit::next(RowBatch& batch) {
+    batch.clear();
+    while (remaining > 0 && batch.empty()) {
+        if (!child->next(batch)) {
+            return false;
+        }
+        size_t skipped = std::min(to_skip, batch.size());
+        batch.erase(batch.begin(), batch.begin() + skipped);
+        to_skip -= skipped;
+        if (batch.size() > remaining) {
+            batch.resize(remaining);
+        }
+        remaining -= batch.size();
+    }
+    return !batch.empty();
+}
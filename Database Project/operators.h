@@ -0,0 +1,343 @@
+#ifndef OPERATORS_H
+#define OPERATORS_H
+
+#include "database_manager.h"
+#include "predicate.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Rows handed from one operator to the next in a single call
+constexpr size_t ROW_BATCH_SIZE = 1024;
+
+using RowBatch = std::vector<Row>;
+// Decodes one stored record into a schema-ordered row
+using RowDecoder = std::function<Row(const char* data, size_t length)>;
+// True when a stored record holds the given primary key. Index entries are checked with it
+// before their record is used, so an entry that outlived its key cannot yield another record.
+using KeyCheck = std::function<bool(const char* data, size_t length, int key)>;
+
+// Pull-based query operator. Each next() call produces at most ROW_BATCH_SIZE rows, so a
+// pipeline holds a batch per operator rather than whole tables (a hash join's build side
+// excepted), and its first rows are available before the underlying scan has finished.
+class RowOperator {
+public:
+    virtual ~RowOperator() = default;
+
+    // Names of the columns of the produced rows
+    const std::vector<std::string>& columns() const { return output_columns; }
+
+    // Replaces batch with the next rows; returns false, with batch empty, once exhausted
+    virtual bool next(RowBatch& batch) = 0;
+
+protected:
+    std::vector<std::string> output_columns;
+};
+
+// Drains an operator into a RowSet
+RowSet collectRows(RowOperator& root);
+
+// Every live record of a heap file. The database lock is held until the scan is destroyed,
+// so the file cannot change (or be vacuumed) underneath it.
+class TableScan : public RowOperator {
+public:
+    TableScan(std::recursive_mutex& db_mutex, HeapFile& heap, std::vector<std::string> columns, RowDecoder decode);
+    bool next(RowBatch& batch) override;
+
+private:
+    std::unique_lock<std::recursive_mutex> lock;
+    HeapScanner scanner;
+    RowDecoder decode;
+};
+
+// Pages per unit of work of a parallel scan
+constexpr uint32_t MORSEL_PAGES = 64;
+// Smallest table worth scanning in parallel, and the most worker threads one scan uses
+constexpr uint32_t PARALLEL_SCAN_MIN_PAGES = 512;
+constexpr size_t PARALLEL_SCAN_MAX_THREADS = 8;
+
+// Full scan that splits the mapped heap file into morsels of MORSEL_PAGES pages. Worker
+// threads each take the next morsel and decode and filter its records, so the work runs on
+// several cores; the calling thread hands the results on in page order, the same order as a
+// TableScan. Workers stay at most a few morsels ahead of the consumer. If the file cannot be
+// mapped it is scanned on the calling thread. Holds the database lock like TableScan; the
+// decoder and predicate must be safe to call from several threads at once.
+class ParallelTableScan : public RowOperator {
+public:
+    ParallelTableScan(std::recursive_mutex& db_mutex, HeapFile& heap, std::vector<std::string> columns,
+        RowDecoder decode, std::unique_ptr<Predicate> predicate, size_t threads);
+    ~ParallelTableScan();
+    bool next(RowBatch& batch) override;
+
+private:
+    std::unique_lock<std::recursive_mutex> lock;
+    HeapFile& heap;
+    RowDecoder decode;
+    std::unique_ptr<Predicate> predicate;
+    MappedFile mapping;
+    std::unique_ptr<HeapScanner> serial; // Used when the file could not be mapped
+
+    std::vector<std::thread> workers;
+    std::mutex morsel_mutex;
+    std::condition_variable morsel_changed;
+    uint32_t morsel_count = 0;
+    uint32_t next_morsel = 0;   // Next morsel for a worker to take
+    uint32_t output_morsel = 0; // Morsel whose rows are being handed on
+    uint32_t window = 0;        // How many morsels the workers may run ahead of output_morsel
+    std::map<uint32_t, RowBatch> finished;
+    bool stopping = false;
+
+    RowBatch current;
+    size_t current_pos = 0;
+
+    void work();
+    void scanMorsel(uint32_t morsel, RowBatch& rows);
+};
+
+// Records whose primary key falls in [lo, hi], in ascending (FORWARD) or descending key
+// order, read through the B+ tree
+class IndexScan : public RowOperator {
+public:
+    IndexScan(std::recursive_mutex& db_mutex, HeapFile& heap, BPlusTree& index, int lo, int hi,
+        std::vector<std::string> columns, RowDecoder decode, KeyCheck holds_key,
+        BPlusCursor::Direction direction = BPlusCursor::FORWARD);
+    bool next(RowBatch& batch) override;
+
+private:
+    std::unique_lock<std::recursive_mutex> lock;
+    HeapFile& heap;
+    BPlusCursor cursor;
+    RowDecoder decode;
+    KeyCheck holds_key;
+};
+
+// Rows of the child for which the predicate holds
+class Filter : public RowOperator {
+public:
+    Filter(std::unique_ptr<RowOperator> child, std::unique_ptr<Predicate> predicate);
+    bool next(RowBatch& batch) override;
+
+private:
+    std::unique_ptr<RowOperator> child;
+    std::unique_ptr<Predicate> predicate;
+    RowBatch input;
+};
+
+// Selected columns of the child, named as requested. A name that is not a child column is
+// also tried without its "table." prefix; names that match nothing are left out, and when
+// none match no rows are produced.
+class Project : public RowOperator {
+public:
+    Project(std::unique_ptr<RowOperator> child, const std::vector<std::string>& names);
+    bool next(RowBatch& batch) override;
+
+private:
+    std::unique_ptr<RowOperator> child;
+    std::vector<int> ordinals;
+    RowBatch input;
+};
+
+// Rows written to a temporary file and read back in order; the file is removed on destruction
+class SpillFile {
+public:
+    SpillFile();
+    ~SpillFile();
+
+    SpillFile(const SpillFile&) = delete;
+    SpillFile& operator=(const SpillFile&) = delete;
+
+    bool write(const Row& row);
+    // Switches from writing to reading from the start
+    void rewind();
+    bool read(Row& row);
+
+private:
+    std::string path;
+    std::fstream stream;
+};
+
+// In-memory limit for a hash join's build side before it is partitioned to disk
+constexpr size_t HASH_JOIN_MEMORY_BUDGET = 64 * 1024 * 1024;
+constexpr size_t HASH_JOIN_PARTITIONS = 16;
+
+// Equi-join: one input (the build side, normally the smaller) is loaded into a hash table
+// keyed on its join column, then the other input streams through it. Output rows are always
+// the left columns followed by the right columns, in probe input order while the build side
+// fits in memory.
+//
+// If the build side outgrows HASH_JOIN_MEMORY_BUDGET, both inputs are partitioned by key
+// hash into temporary files (grace hash join) and joined one partition pair at a time, so
+// rows come out grouped by partition instead.
+class HashJoin : public RowOperator {
+public:
+    HashJoin(std::unique_ptr<RowOperator> left, std::unique_ptr<RowOperator> right,
+        int left_key, int right_key, bool build_left = false);
+    bool next(RowBatch& batch) override;
+
+private:
+    std::unique_ptr<RowOperator> build_input;
+    std::unique_ptr<RowOperator> probe_input;
+    int build_key;
+    int probe_key;
+    bool build_left;
+    bool built = false;
+    std::unordered_map<FieldValue, std::vector<Row>> table;
+
+    // Grace mode: one build and one probe file per partition
+    std::vector<std::unique_ptr<SpillFile>> build_partitions;
+    std::vector<std::unique_ptr<SpillFile>> probe_partitions;
+    size_t partition = 0;
+
+    // Probe rows being joined, and the position within the current row's matches
+    RowBatch input;
+    size_t input_pos = 0;
+    size_t match_pos = 0;
+
+    void build();
+    void spill(RowBatch& pending);
+    bool loadPartition();
+    bool nextProbeBatch();
+};
+
+// Equi-join against a table whose join column is its indexed primary key: each batch of
+// outer rows is sorted by key and looked up in the B+ tree, so the inner table is only read
+// where it matches instead of being scanned in full. Output rows are the left columns
+// followed by the right columns, whichever side is the outer one.
+class IndexNestedLoopJoin : public RowOperator {
+public:
+    IndexNestedLoopJoin(std::recursive_mutex& db_mutex, std::unique_ptr<RowOperator> outer, int outer_key,
+        HeapFile& inner_heap, BPlusTree& inner_index, std::vector<std::string> inner_columns,
+        RowDecoder decode, KeyCheck holds_key, bool outer_left);
+    bool next(RowBatch& batch) override;
+
+private:
+    std::unique_lock<std::recursive_mutex> lock;
+    std::unique_ptr<RowOperator> outer;
+    int outer_key;
+    HeapFile& inner_heap;
+    BPlusTree& inner_index;
+    RowDecoder decode;
+    KeyCheck holds_key;
+    bool outer_left;
+    RowBatch input;
+};
+
+// An aggregate function over one column (or over rows, for COUNT(*))
+struct Aggregate {
+    enum Function { COUNT, SUM, AVG, MIN, MAX };
+
+    Function function;
+    std::string column;
+
+    // Output column name, e.g. "SUM(amount)"
+    std::string name() const;
+};
+
+// Reads "FUNC(column)" as written in a select list; false if text is not an aggregate
+bool parseAggregate(const std::string& text, Aggregate& aggregate);
+
+// Upper bound on the worker threads of one aggregation
+constexpr size_t AGGREGATE_MAX_THREADS = 8;
+
+// Per-group accumulator; which fields are used depends on the function
+struct AggregateState {
+    int64_t count = 0;
+    int64_t int_sum = 0;
+    double float_sum = 0;
+    bool saw_float = false;
+    FieldValue extreme; // MIN / MAX so far
+
+    void add(Aggregate::Function function, const FieldValue* value);
+    void merge(Aggregate::Function function, const AggregateState& other);
+    FieldValue result(Aggregate::Function function) const;
+};
+
+struct RowHash {
+    size_t operator()(const Row& row) const;
+};
+
+// GROUP BY: one output row per distinct combination of the group columns, holding those
+// columns followed by one column per aggregate. SUM keeps the type of its column (an INT sum
+// out of INT range becomes FLOAT), AVG is a FLOAT, and over no rows every aggregate is 0.
+// Without group columns there is exactly one output row. Groups come out in no particular
+// order.
+//
+// The child is drained on the calling thread. With threads > 1 and more than one batch of
+// input, the batches are handed to worker threads that each aggregate into a table of their
+// own, and the partial tables are merged at the end.
+class HashAggregate : public RowOperator {
+public:
+    HashAggregate(std::unique_ptr<RowOperator> child, const std::vector<std::string>& group_by,
+        std::vector<Aggregate> aggregates, size_t threads = 1);
+    bool next(RowBatch& batch) override;
+
+private:
+    using GroupTable = std::unordered_map<Row, std::vector<AggregateState>, RowHash>;
+
+    std::unique_ptr<RowOperator> child;
+    std::vector<int> group_ordinals;
+    std::vector<Aggregate> aggregates;
+    std::vector<int> aggregate_ordinals; // -1 for COUNT(*)
+    size_t threads;
+    bool consumed = false;
+    RowBatch results;
+    size_t result_pos = 0;
+
+    void consume();
+    void accumulate(GroupTable& table, const RowBatch& batch) const;
+};
+
+struct SortKey {
+    std::string column;
+    bool descending = false;
+};
+
+// ORDER BY: the child's rows sorted on the keys, ties kept in input order. With a limit only
+// the first limit rows are produced, and the child is read through a bounded heap (top-K), so
+// memory stays at limit rows however large the input is.
+class Sort : public RowOperator {
+public:
+    Sort(std::unique_ptr<RowOperator> child, const std::vector<SortKey>& keys, size_t limit = SIZE_MAX);
+    bool next(RowBatch& batch) override;
+
+private:
+    // A row with its input position, which breaks ties
+    struct Entry {
+        Row row;
+        size_t position;
+    };
+
+    std::unique_ptr<RowOperator> child;
+    std::vector<std::pair<int, bool>> keys; // ordinal, descending
+    size_t limit;
+    bool sorted = false;
+    std::vector<Entry> entries;
+    size_t result_pos = 0;
+
+    bool before(const Entry& a, const Entry& b) const;
+    void sortInput();
+};
+
+// Skips the first offset rows of the child, then passes on at most limit rows and stops
+// pulling from the child once they have been produced
+class Limit : public RowOperator {
+public:
+    Limit(std::unique_ptr<RowOperator> child, size_t limit, size_t offset = 0);
+    bool next(RowBatch& batch) override;
+
+private:
+    std::unique_ptr<RowOperator> child;
+    size_t remaining;
+    size_t to_skip;
+};
+
+#endif
@@ -0,0 +1,887 @@
+#include "optimizer.h"
+#include "predicate.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+LogicalNode::LogicalNode(Kind kind, std::unique_ptr<LogicalNode> input) : kind(kind) {
+    if (input) {
+        inputs.push_back(std::move(input));
+    }
+}
+
+namespace {
+
+using OperatorList = std::vector<std::unique_ptr<RowOperator>>;
+
+// Ordinal of the INT primary key, -1 if the table has none
+int keyOrdinal(const TableSchema& schema) {
+    for (size_t i = 0; i < schema.columns.size(); i++) {
+        if (schema.columns[i].is_primary_key && schema.columns[i].type == Column::INT) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+int ordinalOf(const RowOperator& input, const std::string& name) {
+    const std::vector<std::string>& columns = input.columns();
+    return static_cast<int>(std::find(columns.begin(), columns.end(), name) - columns.begin());
+}
+
+size_t workerThreads(size_t max_threads) {
+    return std::min<size_t>(std::thread::hardware_concurrency(), max_threads);
+}
+
+std::string formatValue(const FieldValue& value) {
+    std::ostringstream text;
+    std::visit([&](const auto& v) {
+        using T = std::decay_t<decltype(v)>;
+        if constexpr (std::is_same_v<T, std::string>) {
+            text << "'" << v << "'";
+        } else if constexpr (std::is_same_v<T, bool>) {
+            text << (v ? "true" : "false");
+        } else {
+            text << v;
+        }
+    }, value);
+    return text.str();
+}
+
+// The conditions as they would be written in a WHERE clause
+std::string formatConditions(const ConditionList& conditions, const std::vector<std::string>& operators) {
+    std::string text;
+    size_t op_index = 0;
+    for (size_t i = 0; i < conditions.size(); i++) {
+        if (i > 0 && op_index < operators.size()) {
+            text += " " + operators[op_index++] + " ";
+        }
+        if (op_index < operators.size() && operators[op_index] == "NOT") {
+            text += "NOT ";
+            op_index++;
+        }
+        const auto& [column, op, value] = conditions[i];
+        text += column + " " + op + " " + formatValue(value);
+    }
+    return text;
+}
+
+std::string joinNames(const std::vector<std::string>& names) {
+    std::string text;
+    for (const auto& name : names) {
+        text += (text.empty() ? "" : ", ") + name;
+    }
+    return text;
+}
+
+// The conditions with the values the WHERE clause has now; sources holds the position of each
+// condition in the WHERE clause
+ConditionList bindConditions(ConditionList conditions, const std::vector<size_t>& sources, const ConditionList& where) {
+    for (size_t i = 0; i < conditions.size() && i < sources.size(); i++) {
+        if (sources[i] < where.size()) {
+            std::get<2>(conditions[i]) = std::get<2>(where[sources[i]]);
+        }
+    }
+    return conditions;
+}
+
+// Conditions of the FILTER node of a plan, if it has one
+const ConditionList& whereConditions(const LogicalNode& root) {
+    static const ConditionList none;
+    const LogicalNode* node = &root;
+    while (node->kind != LogicalNode::FILTER && node->inputs.size() == 1) {
+        node = node->inputs[0].get();
+    }
+    return node->kind == LogicalNode::FILTER ? node->conditions : none;
+}
+
+// Tables read by a plan
+void scannedTables(const LogicalNode& node, std::vector<std::string>& tables) {
+    if (node.kind == LogicalNode::SCAN) {
+        tables.push_back(node.table);
+    }
+    for (const auto& input : node.inputs) {
+        scannedTables(*input, tables);
+    }
+}
+
+// Rows of the input that pass the conditions, checked one by one
+PhysicalPlan filterPlan(PhysicalPlan input, const ConditionList& conditions, const std::vector<std::string>& operators,
+    const std::vector<size_t>& sources, double rows) {
+    PhysicalPlan plan;
+    plan.description = "Filter " + formatConditions(conditions, operators);
+    plan.rows = rows;
+    plan.cost = input.cost + input.rows * COST_ROW;
+    plan.sorted_on = input.sorted_on;
+    plan.sorted_descending = input.sorted_descending;
+    plan.make = [conditions, operators, sources](OperatorList& inputs, const ConditionList& where) -> std::unique_ptr<RowOperator> {
+        std::unique_ptr<Predicate> predicate = compilePredicate(inputs[0]->columns(),
+            bindConditions(conditions, sources, where), operators);
+        return std::make_unique<Filter>(std::move(inputs[0]), std::move(predicate));
+    };
+    plan.inputs.push_back(std::move(input));
+    return plan;
+}
+
+} // namespace
+
+Optimizer::Optimizer(DatabaseManager& db) : db(db) {}
+
+std::unique_ptr<RowOperator> Optimizer::open(const LogicalNode& root, CachedPlan* cached) {
+    std::lock_guard<std::recursive_mutex> lock(db.db_mutex);
+    const ConditionList& where = whereConditions(root);
+    if (cached && cachedPlanValid(*cached)) {
+        return instantiate(cached->plan, where);
+    }
+
+    PhysicalPlan best;
+    if (!plan(root, best)) {
+        return nullptr;
+    }
+    if (cached) {
+        cached->valid = true;
+        cached->plan = best;
+        cached->schema_version = db.schema_version;
+        cached->statistics_version = db.statistics_version;
+        cached->table_rows.clear();
+        std::vector<std::string> tables;
+        scannedTables(root, tables);
+        for (const auto& table : tables) {
+            auto heap = db.data_files.find(table);
+            cached->table_rows.emplace_back(table, heap != db.data_files.end() ? heap->second->recordCount() : 0);
+        }
+    }
+    return instantiate(best, where);
+}
+
+bool Optimizer::cachedPlanValid(const CachedPlan& cached) const {
+    if (!cached.valid || cached.schema_version != db.schema_version || cached.statistics_version != db.statistics_version) {
+        return false;
+    }
+    for (const auto& [table, planned_rows] : cached.table_rows) {
+        auto heap = db.data_files.find(table);
+        if (heap == db.data_files.end()) {
+            return false;
+        }
+        double rows = heap->second->recordCount();
+        if (rows > std::max<double>(planned_rows, 1) * CACHED_PLAN_ROW_DRIFT || rows * CACHED_PLAN_ROW_DRIFT < planned_rows) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<std::string> Optimizer::explain(const LogicalNode& root) {
+    std::lock_guard<std::recursive_mutex> lock(db.db_mutex);
+    std::vector<std::string> lines;
+    PhysicalPlan best;
+    if (plan(root, best)) {
+        describe(best, 0, lines);
+    }
+    return lines;
+}
+
+KeyCheck Optimizer::keyCheck(const TableSchema& schema, int key) const {
+    std::vector<bool> wanted(schema.columns.size(), false);
+    wanted[key] = true;
+    DatabaseManager* manager = &db;
+    return [manager, schema, wanted](const char* data, size_t length, int expected) {
+        Row row = manager->loadRow(data, length, schema, wanted);
+        const int* stored = row.empty() ? nullptr : std::get_if<int>(&row[0]);
+        return stored && *stored == expected;
+    };
+}
+
+std::unique_ptr<RowOperator> Optimizer::instantiate(const PhysicalPlan& plan, const ConditionList& where) {
+    OperatorList inputs;
+    for (const auto& input : plan.inputs) {
+        std::unique_ptr<RowOperator> op = instantiate(input, where);
+        if (!op) {
+            return nullptr;
+        }
+        inputs.push_back(std::move(op));
+    }
+    return plan.make(inputs, where);
+}
+
+void Optimizer::describe(const PhysicalPlan& plan, size_t depth, std::vector<std::string>& lines) const {
+    std::ostringstream line;
+    line << std::string(depth * 2, ' ') << plan.description << std::fixed << std::setprecision(0)
+         << " (rows=" << plan.rows << std::setprecision(1) << ", cost=" << plan.cost << ")";
+    lines.push_back(line.str());
+    for (const auto& input : plan.inputs) {
+        describe(input, depth + 1, lines);
+    }
+}
+
+bool Optimizer::openScanInput(const std::string& table, const std::string& prefix, ScanInput& input) {
+    auto it = std::find_if(db.catalog.tables.begin(), db.catalog.tables.end(),
+        [&](const TableSchema& schema) { return schema.name == table; });
+    if (it == db.catalog.tables.end()) {
+        std::cerr << "Table '" << table << "' not found" << std::endl;
+        return false;
+    }
+    input.schema = *it;
+    input.prefix = prefix;
+    if (!db.openDataFile(input.schema)) {
+        std::cerr << "Failed to open data file: " << input.schema.data_file_path << std::endl;
+        return false;
+    }
+    input.statistics = db.tableStatistics(input.schema);
+    return true;
+}
+
+bool Optimizer::plan(const LogicalNode& root, PhysicalPlan& best) {
+    // Pick the plan apart from the top down
+    const LogicalNode* project = nullptr;
+    const LogicalNode* limit = nullptr;
+    const LogicalNode* sort = nullptr;
+    const LogicalNode* aggregate = nullptr;
+    const LogicalNode* filter = nullptr;
+    const LogicalNode* node = &root;
+    while (node->kind != LogicalNode::SCAN && node->kind != LogicalNode::JOIN && node->inputs.size() == 1) {
+        switch (node->kind) {
+        case LogicalNode::PROJECT: project = node; break;
+        case LogicalNode::LIMIT: limit = node; break;
+        case LogicalNode::SORT: sort = node; break;
+        case LogicalNode::AGGREGATE: aggregate = node; break;
+        default: filter = node; break;
+        }
+        node = node->inputs[0].get();
+    }
+    bool scan = node->kind == LogicalNode::SCAN;
+    bool join = node->kind == LogicalNode::JOIN && node->inputs.size() == 2 &&
+        node->inputs[0]->kind == LogicalNode::SCAN && node->inputs[1]->kind == LogicalNode::SCAN;
+    if (!scan && !join) {
+        std::cerr << "Error: Query plan does not read a table or a join of two tables" << std::endl;
+        return false;
+    }
+
+    // Only the columns the query refers to are decoded by the scans
+    std::vector<std::string> required = aggregate ? aggregate->columns : std::vector<std::string>();
+    std::vector<std::string> referenced = project ? project->columns : std::vector<std::string>{ "*" };
+    if (sort) {
+        for (const auto& key : sort->sort_keys) {
+            referenced.push_back(key.column);
+        }
+    }
+    for (const auto& name : referenced) {
+        Aggregate function;
+        if (!parseAggregate(name, function)) {
+            required.push_back(name);
+        } else if (function.column != "*") {
+            required.push_back(function.column);
+        }
+    }
+    if (aggregate) {
+        for (const auto& function : aggregate->aggregates) {
+            if (function.column != "*") {
+                required.push_back(function.column);
+            }
+        }
+    }
+
+    ConditionList conditions = filter ? filter->conditions : ConditionList();
+    std::vector<std::string> operators = filter ? filter->operators : std::vector<std::string>();
+
+    // A single ORDER BY column without aggregation may be read in order from an index
+    std::string wanted_order;
+    bool descending = false;
+    if (sort && !aggregate && sort->sort_keys.size() == 1) {
+        wanted_order = sort->sort_keys[0].column;
+        descending = sort->sort_keys[0].descending;
+    }
+
+    std::vector<ScanInput> inputs;
+    std::vector<PhysicalPlan> candidates;
+    if (scan) {
+        inputs.emplace_back();
+        if (!openScanInput(node->table, "", inputs[0])) {
+            return false;
+        }
+        inputs[0].conditions = conditions;
+        inputs[0].operators = operators;
+        for (size_t i = 0; i < conditions.size(); i++) {
+            inputs[0].sources.push_back(i);
+        }
+        inputs[0].required_columns = required;
+        candidates = scanPlans(inputs[0], wanted_order, descending);
+    } else if (!joinPlans(*node, conditions, operators, required, inputs, candidates)) {
+        return false;
+    }
+
+    // Groups: the product of the grouped columns' distinct values, at most one per row
+    double groups = 1;
+    if (aggregate && !aggregate->columns.empty()) {
+        double input_rows = candidates.empty() ? 0 : candidates[0].rows;
+        for (const auto& column : aggregate->columns) {
+            double distinct = input_rows;
+            for (const auto& input : inputs) {
+                distinct = std::min(distinct, distinctValues(input, column, input_rows));
+            }
+            groups *= std::max(distinct, 1.0);
+        }
+        groups = std::min(groups, std::max(input_rows, 1.0));
+    }
+
+    // The rest of the pipeline is the same for every candidate; the cheapest whole plan wins
+    bool found = false;
+    for (auto& candidate : candidates) {
+        PhysicalPlan whole = finish(std::move(candidate), aggregate, groups, sort, limit, project);
+        if (!found || whole.cost < best.cost) {
+            best = std::move(whole);
+            found = true;
+        }
+    }
+    return found;
+}
+
+PhysicalPlan Optimizer::finish(PhysicalPlan plan, const LogicalNode* aggregate, double groups, const LogicalNode* sort,
+    const LogicalNode* limit, const LogicalNode* project) const {
+    if (aggregate) {
+        size_t threads = workerThreads(AGGREGATE_MAX_THREADS);
+        std::vector<std::string> names;
+        for (const auto& function : aggregate->aggregates) {
+            names.push_back(function.name());
+        }
+        PhysicalPlan node;
+        node.description = "HashAggregate " + joinNames(names);
+        if (!aggregate->columns.empty()) {
+            node.description += (names.empty() ? "by " : " by ") + joinNames(aggregate->columns);
+        }
+        node.rows = groups;
+        node.cost = plan.cost + plan.rows * COST_HASH_ROW / std::max<size_t>(threads, 1);
+        std::vector<std::string> group_by = aggregate->columns;
+        std::vector<Aggregate> aggregates = aggregate->aggregates;
+        node.make = [group_by, aggregates, threads](OperatorList& inputs, const ConditionList&) -> std::unique_ptr<RowOperator> {
+            return std::make_unique<HashAggregate>(std::move(inputs[0]), group_by, aggregates, threads);
+        };
+        node.inputs.push_back(std::move(plan));
+        plan = std::move(node);
+    }
+
+    size_t wanted = SIZE_MAX; // Rows the LIMIT reads, offset included
+    if (limit && limit->limit != SIZE_MAX) {
+        wanted = limit->limit + limit->offset;
+    }
+    bool ordered = sort && sort->sort_keys.size() == 1 && !plan.sorted_on.empty() &&
+        plan.sorted_on == sort->sort_keys[0].column && plan.sorted_descending == sort->sort_keys[0].descending;
+    bool blocking = aggregate != nullptr;
+    if (sort && !ordered) {
+        // With a LIMIT, only the first rows of the order are kept (top-K)
+        double kept = std::min(plan.rows, static_cast<double>(wanted));
+        std::vector<std::string> keys;
+        for (const auto& key : sort->sort_keys) {
+            keys.push_back(key.column + (key.descending ? " DESC" : ""));
+        }
+        PhysicalPlan node;
+        node.description = "Sort " + joinNames(keys);
+        if (wanted != SIZE_MAX) {
+            node.description += " keeping " + std::to_string(wanted);
+        }
+        node.rows = kept;
+        node.cost = plan.cost + plan.rows * std::log2(std::max(kept, 2.0)) * COST_COMPARE;
+        std::vector<SortKey> sort_keys = sort->sort_keys;
+        node.make = [sort_keys, wanted](OperatorList& inputs, const ConditionList&) -> std::unique_ptr<RowOperator> {
+            return std::make_unique<Sort>(std::move(inputs[0]), sort_keys, wanted);
+        };
+        node.inputs.push_back(std::move(plan));
+        plan = std::move(node);
+        blocking = true;
+    }
+
+    if (limit) {
+        // Without a blocking operator below, reading stops once the limit is reached
+        double fraction = 1;
+        if (!blocking && wanted != SIZE_MAX && plan.rows > 0) {
+            fraction = std::min(1.0, static_cast<double>(wanted) / plan.rows);
+        }
+        PhysicalPlan node;
+        node.description = "Limit " + (limit->limit == SIZE_MAX ? std::string("all") : std::to_string(limit->limit));
+        if (limit->offset > 0) {
+            node.description += " offset " + std::to_string(limit->offset);
+        }
+        node.rows = std::min(std::max(plan.rows - limit->offset, 0.0), static_cast<double>(limit->limit));
+        node.cost = plan.cost * fraction;
+        size_t count = limit->limit;
+        size_t offset = limit->offset;
+        node.make = [count, offset](OperatorList& inputs, const ConditionList&) -> std::unique_ptr<RowOperator> {
+            return std::make_unique<Limit>(std::move(inputs[0]), count, offset);
+        };
+        node.inputs.push_back(std::move(plan));
+        plan = std::move(node);
+    }
+
+    if (project) {
+        PhysicalPlan node;
+        node.description = "Project " + joinNames(project->columns);
+        node.rows = plan.rows;
+        node.cost = plan.cost;
+        std::vector<std::string> columns = project->columns;
+        node.make = [columns](OperatorList& inputs, const ConditionList&) -> std::unique_ptr<RowOperator> {
+            return std::make_unique<Project>(std::move(inputs[0]), columns);
+        };
+        node.inputs.push_back(std::move(plan));
+        plan = std::move(node);
+    }
+    return plan;
+}
+
+std::vector<PhysicalPlan> Optimizer::scanPlans(const ScanInput& input, const std::string& wanted_order, bool descending) {
+    std::vector<PhysicalPlan> plans;
+    const TableSchema& schema = input.schema;
+    const TableStatistics& statistics = input.statistics;
+    HeapFile* heap = db.openDataFile(schema);
+    if (!heap) {
+        return plans;
+    }
+
+    // Only the columns the query refers to are decoded, its WHERE columns included
+    std::vector<std::string> referenced = input.required_columns;
+    for (const auto& condition : input.conditions) {
+        referenced.push_back(std::get<0>(condition));
+    }
+    std::vector<bool> wanted = db.referencedColumns(schema, referenced, input.prefix);
+    std::vector<std::string> columns;
+    for (size_t i = 0; i < schema.columns.size(); i++) {
+        if (wanted[i]) {
+            columns.push_back(input.prefix + schema.columns[i].name);
+        }
+    }
+    DatabaseManager* manager = &db;
+    RowDecoder decode = [manager, schema, wanted](const char* data, size_t length) {
+        return manager->loadRow(data, length, schema, wanted);
+    };
+
+    double rows = static_cast<double>(statistics.rows);
+    double pages = std::max<double>(statistics.pages, 1);
+    double output_rows = rows * selectivity({ &input }, input.conditions, input.operators);
+    std::string filter_text = input.conditions.empty() ? "" : " filter " + formatConditions(input.conditions, input.operators);
+    ConditionList conditions = input.conditions;
+    std::vector<std::string> operators = input.operators;
+    std::vector<size_t> sources = input.sources;
+
+    // Every row, in file order
+    PhysicalPlan full_scan;
+    full_scan.description = "TableScan " + schema.name;
+    full_scan.rows = rows;
+    full_scan.cost = pages * COST_SEQUENTIAL_PAGE + rows * COST_ROW;
+    full_scan.make = [manager, heap, columns, decode](OperatorList&, const ConditionList&) -> std::unique_ptr<RowOperator> {
+        return std::make_unique<TableScan>(manager->db_mutex, *heap, columns, decode);
+    };
+    plans.push_back(input.conditions.empty() ? full_scan : filterPlan(full_scan, conditions, operators, sources, output_rows));
+
+    // Large files are decoded and filtered on several cores
+    size_t threads = workerThreads(PARALLEL_SCAN_MAX_THREADS);
+    if (threads > 1 && statistics.pages >= PARALLEL_SCAN_MIN_PAGES) {
+        PhysicalPlan parallel_scan;
+        parallel_scan.description = "ParallelTableScan " + schema.name + " on " + std::to_string(threads) + " threads" + filter_text;
+        parallel_scan.rows = output_rows;
+        parallel_scan.cost = full_scan.cost / threads + threads * COST_THREAD;
+        parallel_scan.make = [manager, heap, columns, decode, conditions, operators, sources, threads](OperatorList&,
+            const ConditionList& where) -> std::unique_ptr<RowOperator> {
+            return std::make_unique<ParallelTableScan>(manager->db_mutex, *heap, columns, decode,
+                compilePredicate(columns, bindConditions(conditions, sources, where), operators), threads);
+        };
+        plans.push_back(std::move(parallel_scan));
+    }
+
+    // A slice of the primary key index, or all of it for the key order
+    int key = keyOrdinal(schema);
+    auto index = db.indexes.find(schema.name);
+    if (key < 0 || index == db.indexes.end() || !index->second) {
+        return plans;
+    }
+    const std::string& key_name = schema.columns[key].name;
+    bool key_order = !wanted_order.empty() &&
+        (wanted_order == input.prefix + key_name || wanted_order == key_name || wanted_order == schema.name + "." + key_name);
+
+    // Key bounds are recognised by the bare column name
+    ConditionList bare_conditions = input.conditions;
+    for (auto& condition : bare_conditions) {
+        std::string& column = std::get<0>(condition);
+        if (!input.prefix.empty() && column.compare(0, input.prefix.size(), input.prefix) == 0) {
+            column = column.substr(input.prefix.size());
+        }
+    }
+    AccessPath path = db.chooseAccessPath(schema, bare_conditions, input.operators);
+    bool bounded = path.kind != AccessPath::FULL_SCAN;
+    if (!bounded && !key_order) {
+        return plans;
+    }
+    int lo = bounded ? path.lo : INT_MIN;
+    int hi = bounded ? path.hi : INT_MAX;
+    ConditionList residual = bounded ? path.residual_conditions : input.conditions;
+    std::vector<std::string> residual_operators = bounded ? path.residual_operators : input.operators;
+    std::vector<size_t> residual_sources;
+    for (size_t position : path.residual_positions) {
+        residual_sources.push_back(input.sources[position]);
+    }
+    for (auto& condition : residual) {
+        if (bounded) {
+            std::get<0>(condition) = input.prefix + std::get<0>(condition);
+        }
+    }
+
+    // Share of the rows in the key range; a single key is unique
+    const ColumnStatistics& key_statistics = statistics.columns[key];
+    double fraction = 1;
+    if (lo > hi) {
+        fraction = 0;
+    } else if (lo == hi) {
+        fraction = rows > 0 ? 1 / rows : 0;
+    } else if (key_statistics.has_range) {
+        double low = std::max<double>(lo, key_statistics.min);
+        double high = std::min<double>(hi, key_statistics.max);
+        fraction = std::clamp((high - low + 1) / (key_statistics.max - key_statistics.min + 1), 0.0, 1.0);
+    } else if (bounded) {
+        fraction = DEFAULT_RANGE_SELECTIVITY;
+    }
+    double matched = rows * fraction;
+    // Records of neighbouring keys share pages as far as the file follows the key order
+    double clustering = statistics.key_clustering;
+    double fetch_cost = clustering * pages * fraction * COST_SEQUENTIAL_PAGE + (1 - clustering) * matched * COST_RANDOM_PAGE;
+
+    BPlusTree* tree = index->second;
+    BPlusCursor::Direction direction = key_order && descending ? BPlusCursor::BACKWARD : BPlusCursor::FORWARD;
+    PhysicalPlan index_scan;
+    index_scan.description = "IndexScan " + schema.name + " " + key_name;
+    if (bounded) {
+        index_scan.description += " in [" + std::to_string(lo) + ", " + std::to_string(hi) + "]";
+    }
+    if (direction == BPlusCursor::BACKWARD) {
+        index_scan.description += " descending";
+    }
+    index_scan.rows = matched;
+    index_scan.cost = tree->height() * COST_RANDOM_PAGE + fetch_cost + matched * COST_ROW;
+    if (key_order) {
+        index_scan.sorted_on = wanted_order;
+        index_scan.sorted_descending = descending;
+    }
+    KeyCheck holds_key = keyCheck(schema, key);
+    // The key bounds are worked out again from the values the plan runs with
+    index_scan.make = [manager, heap, tree, schema, bare_conditions, operators, sources, bounded, columns, decode,
+        holds_key, direction](OperatorList&, const ConditionList& where) -> std::unique_ptr<RowOperator> {
+        int lo = INT_MIN;
+        int hi = INT_MAX;
+        if (bounded) {
+            AccessPath path = manager->chooseAccessPath(schema, bindConditions(bare_conditions, sources, where), operators);
+            lo = path.lo;
+            hi = path.hi;
+        }
+        return std::make_unique<IndexScan>(manager->db_mutex, *heap, *tree, lo, hi, columns, decode, holds_key, direction);
+    };
+    plans.push_back(residual.empty() ? index_scan : filterPlan(index_scan, residual, residual_operators, residual_sources, output_rows));
+    return plans;
+}
+
+bool Optimizer::joinPlans(const LogicalNode& join, const ConditionList& conditions, const std::vector<std::string>& operators,
+    const std::vector<std::string>& required, std::vector<ScanInput>& inputs, std::vector<PhysicalPlan>& plans) {
+    const std::string& left_table = join.inputs[0]->table;
+    const std::string& right_table = join.inputs[1]->table;
+    inputs.resize(2);
+    ScanInput& left = inputs[0];
+    ScanInput& right = inputs[1];
+    if (!openScanInput(left_table, left_table + ".", left) || !openScanInput(right_table, right_table + ".", right)) {
+        return false;
+    }
+
+    // Join columns are "table.column", the first input's on the left
+    auto hasColumn = [](const ScanInput& input, const std::string& name) {
+        return std::any_of(input.schema.columns.begin(), input.schema.columns.end(),
+            [&](const Column& column) { return input.prefix + column.name == name; });
+    };
+    if (!hasColumn(left, join.left_column) || !hasColumn(right, join.right_column)) {
+        std::cerr << "Error: Invalid join condition columns: " << join.left_column << " = " << join.right_column << std::endl;
+        return false;
+    }
+
+    // Conditions of an AND-only WHERE clause that name one table are checked by its scan
+    bool conjunction = std::all_of(operators.begin(), operators.end(), [](const std::string& op) { return op == "AND"; });
+    ConditionList remaining;
+    std::vector<size_t> remaining_sources;
+    for (size_t i = 0; i < conditions.size(); i++) {
+        const std::string& column = std::get<0>(conditions[i]);
+        if (conjunction && left_table != right_table && hasColumn(left, column)) {
+            left.conditions.push_back(conditions[i]);
+            left.sources.push_back(i);
+        } else if (conjunction && left_table != right_table && hasColumn(right, column)) {
+            right.conditions.push_back(conditions[i]);
+            right.sources.push_back(i);
+        } else {
+            remaining.push_back(conditions[i]);
+            remaining_sources.push_back(i);
+        }
+    }
+    std::vector<std::string> remaining_operators = operators;
+    if (conjunction) {
+        left.operators.assign(left.conditions.empty() ? 0 : left.conditions.size() - 1, "AND");
+        right.operators.assign(right.conditions.empty() ? 0 : right.conditions.size() - 1, "AND");
+        remaining_operators.assign(remaining.empty() ? 0 : remaining.size() - 1, "AND");
+    }
+
+    // Each side decodes its join column and the columns the query refers to
+    std::vector<std::string> referenced = required;
+    referenced.push_back(join.left_column);
+    referenced.push_back(join.right_column);
+    for (const auto& condition : remaining) {
+        referenced.push_back(std::get<0>(condition));
+    }
+    left.required_columns = referenced;
+    right.required_columns = referenced;
+
+    // Each input is read the cheapest way
+    auto cheapest = [](std::vector<PhysicalPlan> candidates) {
+        return std::move(*std::min_element(candidates.begin(), candidates.end(),
+            [](const PhysicalPlan& a, const PhysicalPlan& b) { return a.cost < b.cost; }));
+    };
+    std::vector<PhysicalPlan> left_plans = scanPlans(left, "", false);
+    std::vector<PhysicalPlan> right_plans = scanPlans(right, "", false);
+    if (left_plans.empty() || right_plans.empty()) {
+        return false;
+    }
+    PhysicalPlan left_scan = cheapest(std::move(left_plans));
+    PhysicalPlan right_scan = cheapest(std::move(right_plans));
+
+    // Each row of one side matches the rows of the other with the same value, over the larger
+    // of the two sets of distinct values
+    auto joinedRows = [&](double left_rows, double right_rows) {
+        double distinct = std::max({ distinctValues(left, join.left_column, left_rows),
+            distinctValues(right, join.right_column, right_rows), 1.0 });
+        return left_rows * right_rows / distinct;
+    };
+    double joined = joinedRows(left_scan.rows, right_scan.rows);
+    std::string on = join.left_column + " = " + join.right_column;
+    std::string left_column = join.left_column;
+    std::string right_column = join.right_column;
+
+    // Hash joins, building on either side
+    for (bool build_left : { false, true }) {
+        const ScanInput& build = build_left ? left : right;
+        double build_rows = build_left ? left_scan.rows : right_scan.rows;
+        // A row in memory: one FieldValue per decoded column plus the text of its strings
+        std::vector<bool> decoded = db.referencedColumns(build.schema, referenced, build.prefix);
+        double row_bytes = 0;
+        for (size_t i = 0; i < build.schema.columns.size(); i++) {
+            const Column& column = build.schema.columns[i];
+            if (decoded[i]) {
+                bool text = column.type == Column::STRING || column.type == Column::CHAR;
+                row_bytes += sizeof(FieldValue) + (text ? column.length / 2.0 : 0);
+            }
+        }
+        bool partitioned = build_rows * row_bytes > HASH_JOIN_MEMORY_BUDGET;
+
+        PhysicalPlan plan;
+        plan.description = "HashJoin " + on + " building on " + build.schema.name + (partitioned ? " partitioned" : "");
+        plan.rows = joined;
+        plan.cost = left_scan.cost + right_scan.cost + (left_scan.rows + right_scan.rows) * COST_HASH_ROW +
+            joined * COST_ROW + (partitioned ? (left_scan.rows + right_scan.rows) * COST_SPILL_ROW : 0);
+        plan.inputs.push_back(left_scan);
+        plan.inputs.push_back(right_scan);
+        plan.make = [left_column, right_column, build_left](OperatorList& inputs, const ConditionList&) -> std::unique_ptr<RowOperator> {
+            int left_key = ordinalOf(*inputs[0], left_column);
+            int right_key = ordinalOf(*inputs[1], right_column);
+            return std::make_unique<HashJoin>(std::move(inputs[0]), std::move(inputs[1]), left_key, right_key, build_left);
+        };
+        plans.push_back(std::move(plan));
+    }
+
+    // Index lookups from either side into the other's primary key. The inner side is not
+    // scanned, so its conditions are checked on the joined rows.
+    for (bool outer_left : { true, false }) {
+        const ScanInput& inner = outer_left ? right : left;
+        const PhysicalPlan& outer_scan = outer_left ? left_scan : right_scan;
+        const std::string& outer_column = outer_left ? left_column : right_column;
+        const std::string& inner_column = outer_left ? right_column : left_column;
+        int key = keyOrdinal(inner.schema);
+        auto index = db.indexes.find(inner.schema.name);
+        if (key < 0 || inner.prefix + inner.schema.columns[key].name != inner_column ||
+            index == db.indexes.end() || !index->second) {
+            continue;
+        }
+        HeapFile* inner_heap = db.openDataFile(inner.schema);
+        if (!inner_heap) {
+            continue;
+        }
+        double inner_rows = static_cast<double>(inner.statistics.rows);
+        double matched = outer_left ? joinedRows(outer_scan.rows, inner_rows) : joinedRows(inner_rows, outer_scan.rows);
+
+        std::vector<std::string> inner_referenced = referenced;
+        for (const auto& condition : inner.conditions) {
+            inner_referenced.push_back(std::get<0>(condition));
+        }
+        std::vector<bool> wanted = db.referencedColumns(inner.schema, inner_referenced, inner.prefix);
+        std::vector<std::string> inner_columns;
+        for (size_t i = 0; i < inner.schema.columns.size(); i++) {
+            if (wanted[i]) {
+                inner_columns.push_back(inner.prefix + inner.schema.columns[i].name);
+            }
+        }
+        DatabaseManager* manager = &db;
+        TableSchema inner_schema = inner.schema;
+        RowDecoder decode = [manager, inner_schema, wanted](const char* data, size_t length) {
+            return manager->loadRow(data, length, inner_schema, wanted);
+        };
+        KeyCheck holds_key = keyCheck(inner_schema, key);
+        BPlusTree* tree = index->second;
+
+        PhysicalPlan plan;
+        plan.description = "IndexNestedLoopJoin " + on + " looking up " + inner.schema.name + "." + inner.schema.columns[key].name;
+        plan.rows = matched;
+        plan.cost = outer_scan.cost + outer_scan.rows * COST_INDEX_LOOKUP + matched * COST_ROW;
+        plan.inputs.push_back(outer_scan);
+        plan.make = [manager, outer_column, inner_heap, tree, inner_columns, decode, holds_key, outer_left](OperatorList& inputs, const ConditionList&) -> std::unique_ptr<RowOperator> {
+            int outer_key = ordinalOf(*inputs[0], outer_column);
+            return std::make_unique<IndexNestedLoopJoin>(manager->db_mutex, std::move(inputs[0]), outer_key,
+                *inner_heap, *tree, inner_columns, decode, holds_key, outer_left);
+        };
+        if (!inner.conditions.empty()) {
+            double rows = matched * selectivity({ &inner }, inner.conditions, inner.operators);
+            plan = filterPlan(std::move(plan), inner.conditions, inner.operators, inner.sources, rows);
+        }
+        plans.push_back(std::move(plan));
+    }
+
+    // Whatever the scans do not check is tested on the joined rows
+    if (!remaining.empty()) {
+        for (auto& plan : plans) {
+            double rows = plan.rows * selectivity({ &left, &right }, remaining, remaining_operators);
+            plan = filterPlan(std::move(plan), remaining, remaining_operators, remaining_sources, rows);
+        }
+    }
+    return true;
+}
+
+double Optimizer::selectivity(const std::vector<const ScanInput*>& inputs, const ConditionList& conditions,
+    const std::vector<std::string>& operators) const {
+    if (conditions.empty()) {
+        return 1;
+    }
+    double result = 1;
+    size_t op_index = 0;
+    for (size_t i = 0; i < conditions.size(); i++) {
+        bool apply_not = op_index < operators.size() && operators[op_index] == "NOT";
+        if (apply_not) {
+            op_index++;
+        }
+        double fraction = conditionSelectivity(inputs, conditions[i]);
+        if (apply_not) {
+            fraction = 1 - fraction;
+        }
+        if (i == 0) {
+            result = fraction;
+            continue;
+        }
+        // A malformed operator list matches nothing
+        if (op_index >= operators.size()) {
+            return 0;
+        }
+        const std::string& op = operators[op_index++];
+        if (op == "AND") {
+            result *= fraction;
+        } else if (op == "OR") {
+            result = result + fraction - result * fraction;
+        } else {
+            return 0;
+        }
+    }
+    return result;
+}
+
+double Optimizer::conditionSelectivity(const std::vector<const ScanInput*>& inputs,
+    const std::tuple<std::string, std::string, FieldValue>& condition) const {
+    const auto& [name, op, value] = condition;
+    const ScanInput* input = nullptr;
+    size_t ordinal = 0;
+    for (const ScanInput* candidate : inputs) {
+        for (size_t i = 0; i < candidate->schema.columns.size() && !input; i++) {
+            if (candidate->prefix + candidate->schema.columns[i].name == name) {
+                input = candidate;
+                ordinal = i;
+            }
+        }
+    }
+    // Conditions on unknown columns, or comparing values of another type, are false
+    if (!input) {
+        return 0;
+    }
+    const Column& column = input->schema.columns[ordinal];
+    bool same_type = (column.type == Column::INT && std::holds_alternative<int>(value)) ||
+        (column.type == Column::FLOAT && std::holds_alternative<float>(value)) ||
+        ((column.type == Column::STRING || column.type == Column::CHAR) && std::holds_alternative<std::string>(value)) ||
+        (column.type == Column::BOOL && std::holds_alternative<bool>(value));
+    if (!same_type) {
+        return op == "!=" ? 1 : 0;
+    }
+
+    const TableStatistics& statistics = input->statistics;
+    ColumnStatistics column_statistics;
+    if (ordinal < statistics.columns.size()) {
+        column_statistics = statistics.columns[ordinal];
+    }
+    double distinct = static_cast<double>(column_statistics.distinct);
+    if (distinct == 0 && column.type == Column::BOOL) {
+        distinct = 2;
+    }
+    bool numeric = std::holds_alternative<int>(value) || std::holds_alternative<float>(value);
+    double number = std::holds_alternative<int>(value) ? std::get<int>(value)
+        : std::holds_alternative<float>(value) ? std::get<float>(value) : 0;
+    bool in_range = !numeric || !column_statistics.has_range ||
+        (number >= column_statistics.min && number <= column_statistics.max);
+
+    double equal = distinct > 0 ? 1 / distinct : DEFAULT_EQUALITY_SELECTIVITY;
+    if (!in_range) {
+        equal = 0;
+    }
+    if (op == "=") {
+        return equal;
+    }
+    if (op == "!=") {
+        return 1 - equal;
+    }
+    if (op == "<" || op == "<=" || op == ">" || op == ">=") {
+        if (!numeric) {
+            return 0;
+        }
+        if (!column_statistics.has_range || column_statistics.max <= column_statistics.min) {
+            return DEFAULT_RANGE_SELECTIVITY;
+        }
+        // Values are taken to be spread evenly over their range
+        double below = std::clamp((number - column_statistics.min) / (column_statistics.max - column_statistics.min), 0.0, 1.0);
+        return op[0] == '<' ? below : 1 - below;
+    }
+    if (op == "LIKE") {
+        return std::holds_alternative<std::string>(value) ? DEFAULT_LIKE_SELECTIVITY : 0;
+    }
+    return 0;
+}
+
+double Optimizer::distinctValues(const ScanInput& input, const std::string& column, double rows) const {
+    for (size_t i = 0; i < input.schema.columns.size(); i++) {
+        const Column& schema_column = input.schema.columns[i];
+        if (input.prefix + schema_column.name != column) {
+            continue;
+        }
+        double distinct = 0;
+        if (i < input.statistics.columns.size()) {
+            distinct = static_cast<double>(input.statistics.columns[i].distinct);
+        }
+        if (distinct == 0 && schema_column.is_foreign_key) {
+            // A foreign key takes at most as many values as the referenced table has rows
+            auto referenced = std::find_if(db.catalog.tables.begin(), db.catalog.tables.end(),
+                [&](const TableSchema& schema) { return schema.name == schema_column.references_table; });
+            if (referenced != db.catalog.tables.end()) {
+                distinct = static_cast<double>(db.tableStatistics(*referenced).rows);
+            }
+        }
+        if (distinct == 0) {
+            distinct = static_cast<double>(input.statistics.rows);
+        }
+        return std::max(std::min(distinct, rows), 1.0);
+    }
+    return std::max(rows, 1.0);
+}
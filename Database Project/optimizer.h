@@ -0,0 +1,147 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "database_manager.h"
+#include "operators.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+using ConditionList = std::vector<std::tuple<std::string, std::string, FieldValue>>;
+
+// A node of the logical plan of a SELECT: what is computed, not how. Plans have the shape
+// Project <- Limit <- Sort <- Aggregate <- Filter <- Scan or Join of two Scans, from the top,
+// with the nodes a statement does not need left out.
+struct LogicalNode {
+    enum Kind { SCAN, JOIN, FILTER, AGGREGATE, SORT, LIMIT, PROJECT };
+
+    Kind kind;
+    std::vector<std::unique_ptr<LogicalNode>> inputs;
+    std::string table;                 // SCAN
+    std::string left_column;           // JOIN: "table.column" of the first input
+    std::string right_column;          // JOIN: "table.column" of the second input
+    ConditionList conditions;          // FILTER
+    std::vector<std::string> operators;
+    std::vector<std::string> columns;  // AGGREGATE: the GROUP BY columns; PROJECT
+    std::vector<Aggregate> aggregates; // AGGREGATE
+    std::vector<SortKey> sort_keys;    // SORT
+    size_t limit = SIZE_MAX;           // LIMIT
+    size_t offset = 0;
+
+    explicit LogicalNode(Kind kind, std::unique_ptr<LogicalNode> input = nullptr);
+};
+
+// Relative costs plans are weighed with, in units of one page read in file order
+constexpr double COST_SEQUENTIAL_PAGE = 1.0;
+constexpr double COST_RANDOM_PAGE = 4.0;   // A page read out of file order
+constexpr double COST_INDEX_LOOKUP = 4.0;  // One key looked up in a B+ tree and its record read
+constexpr double COST_ROW = 0.01;          // Decoding and testing one row
+constexpr double COST_HASH_ROW = 0.02;     // Adding a row to a hash table, or probing one with it
+constexpr double COST_SPILL_ROW = 0.1;     // Writing a row to a temporary file and reading it back
+constexpr double COST_COMPARE = 0.002;     // One comparison of a sort
+constexpr double COST_THREAD = 25.0;       // Starting a worker thread
+// Selectivities assumed where the statistics do not tell
+constexpr double DEFAULT_EQUALITY_SELECTIVITY = 0.1;
+constexpr double DEFAULT_RANGE_SELECTIVITY = 1.0 / 3;
+constexpr double DEFAULT_LIKE_SELECTIVITY = 0.1;
+
+// An operator of a chosen physical plan, with what the optimizer expects of it
+struct PhysicalPlan {
+    std::string description; // e.g. "IndexScan users id in [1, 10]"
+    double rows = 0;         // Estimated output rows
+    double cost = 0;         // Estimated cost of the whole subtree
+    std::vector<PhysicalPlan> inputs;
+    // Creates the operator, given the operators created for the inputs and the WHERE conditions
+    // of the statement, whose values may differ from those the plan was chosen for
+    std::function<std::unique_ptr<RowOperator>(std::vector<std::unique_ptr<RowOperator>>& inputs,
+        const ConditionList& where)> make;
+    // Column and direction the output is sorted on; empty if unordered
+    std::string sorted_on;
+    bool sorted_descending = false;
+};
+
+// A cached plan is chosen again once a table it reads holds this many times more, or fewer,
+// rows than when it was chosen
+constexpr double CACHED_PLAN_ROW_DRIFT = 2.0;
+
+// The plan of a prepared SELECT, chosen at its first execution and reused by the next ones,
+// which only bind their own WHERE values into it (index key bounds included). It is chosen
+// again after tables are created or dropped, after ANALYZE, or once the row counts it was
+// costed with have drifted. Only used under the database lock.
+struct CachedPlan {
+    bool valid = false;
+    PhysicalPlan plan;
+    uint64_t schema_version = 0;
+    uint64_t statistics_version = 0;
+    std::vector<std::pair<std::string, uint64_t>> table_rows; // Each table read and its rows then
+};
+
+// Turns logical plans into pipelines of operators (operators.h), choosing by estimated cost:
+// - WHERE conditions on one table of a join are checked by that table's scan.
+// - Each table is read with a full scan, on several threads if it is large, or through the
+//   primary key index when the conditions bound the key. An ORDER BY on the key may also be
+//   read from the index in order instead of sorting.
+// - A join is a hash join building on either input, or index lookups from either input into
+//   the other's primary key.
+// Row counts are estimated from the live row and page counts, the statistics gathered by
+// ANALYZE and the key range of the index; fixed selectivities stand in for missing statistics.
+class Optimizer {
+public:
+    explicit Optimizer(DatabaseManager& db);
+
+    // nullptr if a table or column does not exist. The scans hold the database lock until
+    // they are destroyed. With cached, its plan is run if still valid, and otherwise replaced
+    // by the one chosen now.
+    std::unique_ptr<RowOperator> open(const LogicalNode& plan, CachedPlan* cached = nullptr);
+    // The plan open() would run, one line per operator with its estimated rows and cost;
+    // empty if it could not be planned
+    std::vector<std::string> explain(const LogicalNode& plan);
+
+private:
+    // A table read for the plan: its WHERE conditions and the columns it must produce
+    struct ScanInput {
+        TableSchema schema;
+        TableStatistics statistics;
+        std::string prefix; // Prepended to the output column names, e.g. "users." in a join
+        ConditionList conditions;
+        std::vector<std::string> operators;
+        std::vector<size_t> sources; // Position of each condition in the WHERE clause
+        std::vector<std::string> required_columns;
+    };
+
+    DatabaseManager& db;
+
+    bool plan(const LogicalNode& root, PhysicalPlan& best);
+    // Ways to read one table; with wanted_order (a column name) also those producing that order
+    std::vector<PhysicalPlan> scanPlans(const ScanInput& input, const std::string& wanted_order, bool descending);
+    // inputs receives the two tables with the WHERE conditions each scan checks
+    bool joinPlans(const LogicalNode& join, const ConditionList& conditions, const std::vector<std::string>& operators,
+        const std::vector<std::string>& required, std::vector<ScanInput>& inputs, std::vector<PhysicalPlan>& plans);
+    // Puts the operators above the scan or join on a candidate: aggregation into groups rows,
+    // then sorting (unless the candidate is already in order), LIMIT and the select list
+    PhysicalPlan finish(PhysicalPlan plan, const LogicalNode* aggregate, double groups, const LogicalNode* sort,
+        const LogicalNode* limit, const LogicalNode* project) const;
+    bool openScanInput(const std::string& table, const std::string& prefix, ScanInput& input);
+    bool cachedPlanValid(const CachedPlan& cached) const;
+    std::unique_ptr<RowOperator> instantiate(const PhysicalPlan& plan, const ConditionList& where);
+    // Compares the primary key at ordinal key of a stored record, decoding nothing after it
+    KeyCheck keyCheck(const TableSchema& schema, int key) const;
+    void describe(const PhysicalPlan& plan, size_t depth, std::vector<std::string>& lines) const;
+
+    // Fraction of rows of the given inputs passing the conditions, combined left to right with
+    // the operators as compilePredicate does
+    double selectivity(const std::vector<const ScanInput*>& inputs, const ConditionList& conditions,
+        const std::vector<std::string>& operators) const;
+    double conditionSelectivity(const std::vector<const ScanInput*>& inputs,
+        const std::tuple<std::string, std::string, FieldValue>& condition) const;
+    // Estimated distinct values of a column in the rows left after an input's conditions
+    double distinctValues(const ScanInput& input, const std::string& column, double rows) const;
+};
+
+#endif
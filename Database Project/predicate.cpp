@@ -0,0 +1,144 @@
+#include "predicate.h"
+#include <algorithm>
+#include <iostream>
+#include <type_traits>
+
+namespace {
+
+enum class CompareOp { EQ, NE, LT, LE, GT, GE, LIKE };
+
+class ConstantPredicate : public Predicate {
+public:
+    explicit ConstantPredicate(bool value) : value(value) {}
+    bool matches(const Row&) const override { return value; }
+
+private:
+    bool value;
+};
+
+// One column compared with a literal of type T; the operator is fixed at compile time
+template <typename T, CompareOp OP>
+class Comparison : public Predicate {
+public:
+    Comparison(int ordinal, T value) : ordinal(ordinal), value(std::move(value)) {}
+
+    bool matches(const Row& row) const override {
+        const T* field = std::get_if<T>(&row[ordinal]);
+        if (!field) {
+            return OP == CompareOp::NE;
+        }
+        if constexpr (OP == CompareOp::EQ) return *field == value;
+        if constexpr (OP == CompareOp::NE) return *field != value;
+        if constexpr (OP == CompareOp::LT) return *field < value;
+        if constexpr (OP == CompareOp::LE) return *field <= value;
+        if constexpr (OP == CompareOp::GT) return *field > value;
+        if constexpr (OP == CompareOp::GE) return *field >= value;
+        if constexpr (OP == CompareOp::LIKE) return field->find(value) != std::string::npos;
+    }
+
+private:
+    int ordinal;
+    T value;
+};
+
+class NotPredicate : public Predicate {
+public:
+    explicit NotPredicate(std::unique_ptr<Predicate> child) : child(std::move(child)) {}
+    bool matches(const Row& row) const override { return !child->matches(row); }
+
+private:
+    std::unique_ptr<Predicate> child;
+};
+
+template <bool IS_AND>
+class JunctionPredicate : public Predicate {
+public:
+    JunctionPredicate(std::unique_ptr<Predicate> left, std::unique_ptr<Predicate> right)
+        : left(std::move(left)), right(std::move(right)) {}
+
+    bool matches(const Row& row) const override {
+        return IS_AND ? (left->matches(row) && right->matches(row)) : (left->matches(row) || right->matches(row));
+    }
+
+private:
+    std::unique_ptr<Predicate> left;
+    std::unique_ptr<Predicate> right;
+};
+
+template <typename T>
+std::unique_ptr<Predicate> makeComparison(int ordinal, const std::string& op, T value) {
+    if (op == "=") return std::make_unique<Comparison<T, CompareOp::EQ>>(ordinal, std::move(value));
+    if (op == "!=") return std::make_unique<Comparison<T, CompareOp::NE>>(ordinal, std::move(value));
+    // Ordering is only defined for numbers, LIKE only for strings
+    if constexpr (std::is_same_v<T, int> || std::is_same_v<T, float>) {
+        if (op == "<") return std::make_unique<Comparison<T, CompareOp::LT>>(ordinal, value);
+        if (op == "<=") return std::make_unique<Comparison<T, CompareOp::LE>>(ordinal, value);
+        if (op == ">") return std::make_unique<Comparison<T, CompareOp::GT>>(ordinal, value);
+        if (op == ">=") return std::make_unique<Comparison<T, CompareOp::GE>>(ordinal, value);
+    }
+    if constexpr (std::is_same_v<T, std::string>) {
+        if (op == "LIKE") return std::make_unique<Comparison<T, CompareOp::LIKE>>(ordinal, std::move(value));
+    }
+    return std::make_unique<ConstantPredicate>(false);
+}
+
+std::unique_ptr<Predicate> compileCondition(
+    const std::vector<std::string>& columns,
+    const std::tuple<std::string, std::string, FieldValue>& condition) {
+    const auto& [column, op, value] = condition;
+    auto it = std::find(columns.begin(), columns.end(), column);
+    if (it == columns.end()) {
+        return std::make_unique<ConstantPredicate>(false);
+    }
+    int ordinal = static_cast<int>(it - columns.begin());
+    return std::visit([&](const auto& literal) { return makeComparison(ordinal, op, literal); }, value);
+}
+
+} // namespace
+
+std::unique_ptr<Predicate> compilePredicate(
+    const std::vector<std::string>& columns,
+    const std::vector<std::tuple<std::string, std::string, FieldValue>>& conditions,
+    const std::vector<std::string>& operators) {
+
+    if (conditions.empty()) {
+        return std::make_unique<ConstantPredicate>(true); // No conditions means all records match
+    }
+
+    std::unique_ptr<Predicate> result;
+    size_t op_index = 0;
+
+    for (size_t i = 0; i < conditions.size(); ++i) {
+        // Check for NOT operator
+        bool apply_not = false;
+        if (op_index < operators.size() && operators[op_index] == "NOT") {
+            apply_not = true;
+            op_index++;
+        }
+
+        std::unique_ptr<Predicate> condition = compileCondition(columns, conditions[i]);
+        if (apply_not) {
+            condition = std::make_unique<NotPredicate>(std::move(condition));
+        }
+
+        // Combine with previous result
+        if (i == 0) {
+            result = std::move(condition);
+            continue;
+        }
+        if (op_index >= operators.size()) {
+            std::cerr << "Error: Missing operator for condition " << i + 1 << std::endl;
+            return std::make_unique<ConstantPredicate>(false);
+        }
+        const std::string& op = operators[op_index++];
+        if (op == "AND") {
+            result = std::make_unique<JunctionPredicate<true>>(std::move(result), std::move(condition));
+        } else if (op == "OR") {
+            result = std::make_unique<JunctionPredicate<false>>(std::move(result), std::move(condition));
+        } else {
+            std::cerr << "Error: Invalid operator '" << op << "'" << std::endl;
+            return std::make_unique<ConstantPredicate>(false);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,31 @@
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include "database_manager.h"
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// A WHERE clause compiled for one column list. Column names are resolved to ordinals and
+// operator strings to typed comparison nodes once, so testing a row is a walk over a small
+// tree with no lookups, string compares or logging.
+class Predicate {
+public:
+    virtual ~Predicate() = default;
+    virtual bool matches(const Row& row) const = 0;
+};
+
+// Conditions are combined strictly left to right with the AND / OR in operators; a NOT in
+// front of a condition negates it. Semantics per condition:
+//   =, !=      values of different types are never equal
+//   <, <=, >, >=   INT or FLOAT operands of the same type, otherwise false
+//   LIKE       substring match on strings
+// A condition on a column missing from columns is false. A malformed operator list yields a
+// predicate that matches nothing.
+std::unique_ptr<Predicate> compilePredicate(
+    const std::vector<std::string>& columns,
+    const std::vector<std::tuple<std::string, std::string, FieldValue>>& conditions,
+    const std::vector<std::string>& operators);
+
+#endif
@@ -1,341 +1,284 @@
 #include "query_parser.h"
+#include "operators.h"
+#include "optimizer.h"
 #include <algorithm>
+#include <charconv>
 #include <sstream>
 #include <cctype>
 #include <stdexcept>
 #include <iostream>
+#include <thread>
 
-QueryParser::QueryParser(DatabaseManager& db_manager) : db_manager(db_manager) {}
+QueryParser::QueryParser(DatabaseManager& db_manager, PreparedStatements* prepared)
+    : db_manager(db_manager), prepared(prepared ? *prepared : own_prepared) {}
 
 bool QueryParser::parse(const std::string& query_string) {
-    // Clear any existing commands
-    commands.clear();
-    
-    // Split the query into individual commands by semicolon
-    std::string current_command;
-    bool in_quotes = false;
-    
-    // Clean up the query string
-    std::string cleaned_query = query_string;
-    // Replace all types of newlines and whitespace sequences with a single space
-    for (size_t i = 0; i < cleaned_query.length(); ) {
-        if (cleaned_query[i] == '\r' || cleaned_query[i] == '\n' || cleaned_query[i] == '\t') {
-            cleaned_query[i] = ' ';
-            i++;
-        } else if (cleaned_query[i] == ' ' && i + 1 < cleaned_query.length() && cleaned_query[i + 1] == ' ') {
-            cleaned_query.erase(i, 1);
-        } else {
-            i++;
+    statements.clear();
+    current_query = Query();
+
+    for (const Tokens& tokens : lex(query_string)) {
+        // Every statement is parsed into a fresh Query, so nothing carries over from the last
+        current_query = Query();
+        if (!parseStatement(tokens)) {
+            return false;
         }
+        if (!current_query.placeholders.empty()) {
+            current_query.error_message = "'?' parameters are only allowed in a PREPARE statement";
+            return false;
+        }
+        statements.push_back(std::move(current_query));
     }
-    
-    // Trim leading/trailing spaces
-    while (!cleaned_query.empty() && cleaned_query[0] == ' ') {
-        cleaned_query.erase(0, 1);
-    }
-    while (!cleaned_query.empty() && cleaned_query.back() == ' ') {
-        cleaned_query.pop_back();
+
+    current_query = Query();
+    return true;
+}
+
+bool QueryParser::bind(const std::string& name, std::vector<FieldValue> parameters) {
+    statements.clear();
+    current_query = Query();
+    std::lock_guard<std::mutex> lock(prepared.mutex);
+    if (prepared.statements.find(name) == prepared.statements.end()) {
+        current_query.error_message = "Prepared statement '" + name + "' does not exist";
+        return false;
     }
-    
-    for (char c : cleaned_query) {
-        if (c == '\'') {
-            in_quotes = !in_quotes;
-            current_command += c;
-        } else if (c == ';' && !in_quotes) {
-            if (!current_command.empty()) {
-                commands.push_back(current_command);
-                current_command.clear();
-            }
+    Query statement;
+    statement.type = QueryType::EXECUTE;
+    statement.statement_name = name;
+    statement.parameters = std::move(parameters);
+    statements.push_back(std::move(statement));
+    return true;
+}
+
+bool QueryParser::parseStatement(const Tokens& tokens) {
+    // Convert first token to uppercase for case-insensitive comparison
+    std::string command(tokens[0]);
+    std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+    std::string object = tokens.size() > 1 ? std::string(tokens[1]) : "";
+    std::transform(object.begin(), object.end(), object.begin(), ::toupper);
+
+    if (command == "CREATE") {
+        if (tokens.size() < 2) {
+            current_query.error_message = "Invalid CREATE syntax: missing object type";
+            return false;
+        }
+        if (object == "DATABASE") {
+            current_query.type = QueryType::CREATE_DATABASE;
+            return parseCreateDatabase(tokens);
+        } else if (object == "TABLE") {
+            current_query.type = QueryType::CREATE_TABLE;
+            return parseCreateTable(tokens);
         } else {
-            current_command += c;
+            current_query.error_message = "Invalid CREATE syntax: unknown object '" + object + "'";
+            return false;
         }
-    }
-    
-    // Add the last command if there is one
-    if (!current_command.empty()) {
-        commands.push_back(current_command);
-    }
-    
-    // Process each command
-    bool all_success = true;
-    current_query.error_message.clear(); // Clear at start of parse
-    for (const auto& cmd : commands) {
-        std::vector<std::string> tokens = tokenize(cmd);
-        if (tokens.empty()) continue;
-
-        // Convert first token to uppercase for case-insensitive comparison
-        std::string command = tokens[0];
-        std::transform(command.begin(), command.end(), command.begin(), ::toupper);
-
-        if (command == "CREATE") {
-            if (tokens.size() < 2) {
-                current_query.error_message = "Invalid CREATE syntax: missing object type";
-                return false;
-            }
-            std::string object = tokens[1];
-            std::transform(object.begin(), object.end(), object.begin(), ::toupper);
-            
-            if (object == "DATABASE") {
-                current_query.type = QueryType::CREATE_DATABASE;
-                all_success &= parseCreateDatabase(tokens);
-            } else if (object == "TABLE") {
-                current_query.type = QueryType::CREATE_TABLE;
-                all_success &= parseCreateTable(tokens);
-            } else {
-                current_query.error_message = "Invalid CREATE syntax: unknown object '" + object + "'";
-                return false;
-            }
-        } else if (command == "DROP") {
-            if (tokens.size() < 2) {
-                current_query.error_message = "Invalid DROP syntax: missing object type";
-                return false;
-            }
-            std::string object = tokens[1];
-            std::transform(object.begin(), object.end(), object.begin(), ::toupper);
-            
-            if (object == "DATABASE") {
-                current_query.type = QueryType::DROP_DATABASE;
-                all_success &= parseDropDatabase(tokens);
-            } else if (object == "TABLE") {
-                current_query.type = QueryType::DROP_TABLE;
-                all_success &= parseDropTable(tokens);
-            } else {
-                current_query.error_message = "Invalid DROP syntax: unknown object '" + object + "'";
-                return false;
-            }
-        } else if (command == "USE") {
-            current_query.type = QueryType::USE_DATABASE;
-            all_success &= parseUseDatabase(tokens);
-        } else if (command == "SHOW") {
-            if (tokens.size() < 2) {
-                current_query.error_message = "Invalid SHOW syntax: missing object type";
-                return false;
-            }
-            std::string object = tokens[1];
-            std::transform(object.begin(), object.end(), object.begin(), ::toupper);
-            
-            if (object == "DATABASES") {
-                current_query.type = QueryType::SHOW_DATABASES;
-                all_success &= true;
-            } else if (object == "TABLES") {
-                current_query.type = QueryType::SHOW_TABLES;
-                all_success &= true;
-            } else {
-                current_query.error_message = "Invalid SHOW syntax: unknown object '" + object + "'";
-                return false;
-            }
-        } else if (command == "INSERT") {
-            current_query.type = QueryType::INSERT;
-            all_success &= parseInsert(tokens);
-        } else if (command == "SELECT") {
-            current_query.type = QueryType::SELECT;
-            all_success &= parseSelect(tokens);
-        } else if (command == "UPDATE") {
-            current_query.type = QueryType::UPDATE;
-            all_success &= parseUpdate(tokens);
-        } else if (command == "DELETE") {
-            current_query.type = QueryType::DELETE_OP;
-            all_success &= parseDelete(tokens);
+    } else if (command == "DROP") {
+        if (tokens.size() < 2) {
+            current_query.error_message = "Invalid DROP syntax: missing object type";
+            return false;
+        }
+        if (object == "DATABASE") {
+            current_query.type = QueryType::DROP_DATABASE;
+            return parseDropDatabase(tokens);
+        } else if (object == "TABLE") {
+            current_query.type = QueryType::DROP_TABLE;
+            return parseDropTable(tokens);
+        } else {
+            current_query.error_message = "Invalid DROP syntax: unknown object '" + object + "'";
+            return false;
+        }
+    } else if (command == "USE") {
+        current_query.type = QueryType::USE_DATABASE;
+        return parseUseDatabase(tokens);
+    } else if (command == "SHOW") {
+        if (tokens.size() < 2) {
+            current_query.error_message = "Invalid SHOW syntax: missing object type";
+            return false;
+        }
+        if (object == "DATABASES") {
+            current_query.type = QueryType::SHOW_DATABASES;
+            return true;
+        } else if (object == "TABLES") {
+            current_query.type = QueryType::SHOW_TABLES;
+            return true;
         } else {
-            current_query.error_message = "Unknown command: '" + command + "'";
+            current_query.error_message = "Invalid SHOW syntax: unknown object '" + object + "'";
+            return false;
+        }
+    } else if (command == "INSERT") {
+        current_query.type = QueryType::INSERT;
+        return parseInsert(tokens);
+    } else if (command == "SELECT") {
+        current_query.type = QueryType::SELECT;
+        return parseSelect(tokens);
+    } else if (command == "UPDATE") {
+        current_query.type = QueryType::UPDATE;
+        return parseUpdate(tokens);
+    } else if (command == "DELETE") {
+        current_query.type = QueryType::DELETE_OP;
+        return parseDelete(tokens);
+    } else if (command == "VACUUM") {
+        current_query.type = QueryType::VACUUM;
+        return parseVacuum(tokens);
+    } else if (command == "PREPARE") {
+        current_query.type = QueryType::PREPARE;
+        return parsePrepare(tokens);
+    } else if (command == "EXECUTE") {
+        current_query.type = QueryType::EXECUTE;
+        return parseExecute(tokens);
+    } else if (command == "DEALLOCATE") {
+        current_query.type = QueryType::DEALLOCATE;
+        return parseDeallocate(tokens);
+    } else if (command == "COPY") {
+        current_query.type = QueryType::COPY;
+        return parseCopy(tokens);
+    } else if (command == "ANALYZE") {
+        current_query.type = QueryType::ANALYZE;
+        return parseAnalyze(tokens);
+    } else if (command == "EXPLAIN") {
+        // EXPLAIN SELECT ...: parsed as the SELECT, which is then planned but not run
+        Tokens body(tokens.begin() + 1, tokens.end());
+        if (body.empty()) {
+            current_query.error_message = "Invalid EXPLAIN syntax: expected 'EXPLAIN SELECT ...'";
+            return false;
+        }
+        if (!parseStatement(body)) {
+            return false;
+        }
+        if (current_query.type != QueryType::SELECT) {
+            current_query.error_message = "EXPLAIN only supports SELECT statements";
             return false;
         }
+        current_query.explain = true;
+        return true;
+    } else {
+        current_query.error_message = "Unknown command: '" + command + "'";
+        return false;
     }
-    
-    return all_success;
 }
 
-bool QueryParser::execute() {
+bool QueryParser::execute(bool stream_results) {
     bool success = true;
-    std::vector<Record> results;
+    RowSet results;
     int records_found = 0;
+    std::unique_ptr<RowOperator> cursor;
+    std::string empty_message;
 
-    for (const auto& cmd : commands) {
-        std::vector<std::string> tokens = tokenize(cmd);
-        if (tokens.empty()) continue;
+    // Each statement is run once
+    std::vector<Query> pending = std::move(statements);
+    statements.clear();
 
-        // Convert first token to uppercase for case-insensitive comparison
-        std::string command = tokens[0];
-        std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+    for (Query& statement : pending) {
+        // The statement becomes current_query, keeping an error message already set
+        statement.error_message = std::move(current_query.error_message);
+        current_query = std::move(statement);
+        // EXECUTE runs its prepared statement in its place
+        if (current_query.type == QueryType::EXECUTE && !bindPrepared()) {
+            return false;
+        }
 
-        // Clear results for this command, but preserve error_message if already set
-        results.clear();
+        // Clear results for this command
+        results = RowSet();
         records_found = 0;
+        cursor.reset();
+        empty_message.clear();
 
-        if (command == "CREATE") {
-            if (tokens.size() < 2) {
-                current_query.error_message = "Invalid CREATE command syntax";
-                return false;
-            }
-            std::string object = tokens[1];
-            std::transform(object.begin(), object.end(), object.begin(), ::toupper);
-            
-            if (object == "DATABASE") {
-                current_query.type = QueryType::CREATE_DATABASE;
-                if (!parseCreateDatabase(tokens)) {
-                    current_query.error_message = "Failed to parse CREATE DATABASE command";
-                    return false;
-                }
-                success &= db_manager.createDatabase(current_query.database_name);
-                if (!success) {
-                    current_query.error_message = "Failed to create database '" + current_query.database_name + "'";
-                }
-            } else if (object == "TABLE") {
-                current_query.type = QueryType::CREATE_TABLE;
-                if (!parseCreateTable(tokens)) {
-                    current_query.error_message = "Failed to parse CREATE TABLE command";
-                    return false;
-                }
-                success &= db_manager.createTable(
-                    current_query.table_name,
-                    current_query.columns,
-                    current_query.primary_key,
-                    current_query.foreign_keys
-                );
-                if (!success) {
-                    current_query.error_message = "Failed to create table '" + current_query.table_name + "'";
-                }
+        if (current_query.type == QueryType::CREATE_DATABASE) {
+            success &= db_manager.createDatabase(current_query.database_name);
+            if (!success) {
+                current_query.error_message = "Failed to create database '" + current_query.database_name + "'";
             }
-        } else if (command == "DROP") {
-            if (tokens.size() < 2) {
-                current_query.error_message = "Invalid DROP command syntax";
-                return false;
+        } else if (current_query.type == QueryType::CREATE_TABLE) {
+            success &= db_manager.createTable(
+                current_query.table_name,
+                current_query.columns,
+                current_query.primary_key,
+                current_query.foreign_keys
+            );
+            if (!success) {
+                current_query.error_message = "Failed to create table '" + current_query.table_name + "'";
             }
-            std::string object = tokens[1];
-            std::transform(object.begin(), object.end(), object.begin(), ::toupper);
-            
-            if (object == "DATABASE") {
-                current_query.type = QueryType::DROP_DATABASE;
-                if (!parseDropDatabase(tokens)) {
-                    current_query.error_message = "Failed to parse DROP DATABASE command";
-                    return false;
-                }
-                success &= db_manager.dropDatabase(current_query.database_name);
-                if (!success) {
-                    current_query.error_message = "Failed to drop database '" + current_query.database_name + "'";
-                }
-            } else if (object == "TABLE") {
-                current_query.type = QueryType::DROP_TABLE;
-                if (!parseDropTable(tokens)) {
-                    current_query.error_message = "Failed to parse DROP TABLE command";
-                    return false;
-                }
-                success &= db_manager.dropTable(current_query.table_name);
-                if (!success) {
-                    current_query.error_message = "Failed to drop table '" + current_query.table_name + "'";
-                }
+        } else if (current_query.type == QueryType::DROP_DATABASE) {
+            success &= db_manager.dropDatabase(current_query.database_name);
+            if (!success) {
+                current_query.error_message = "Failed to drop database '" + current_query.database_name + "'";
             }
-        } else if (command == "USE") {
-            current_query.type = QueryType::USE_DATABASE;
-            if (!parseUseDatabase(tokens)) {
-                current_query.error_message = "Failed to parse USE DATABASE command";
-                return false;
+        } else if (current_query.type == QueryType::DROP_TABLE) {
+            success &= db_manager.dropTable(current_query.table_name);
+            if (!success) {
+                current_query.error_message = "Failed to drop table '" + current_query.table_name + "'";
             }
+        } else if (current_query.type == QueryType::USE_DATABASE) {
             success &= db_manager.useDatabase(current_query.database_name);
             if (!success) {
                 current_query.error_message = "Failed to use database '" + current_query.database_name + "'";
             }
-        } else if (command == "SHOW") {
-            if (tokens.size() < 2) {
-                current_query.error_message = "Invalid SHOW command syntax";
-                return false;
-            }
-            std::string object = tokens[1];
-            std::transform(object.begin(), object.end(), object.begin(), ::toupper);
-            
-            if (object == "DATABASES") {
-                current_query.type = QueryType::SHOW_DATABASES;
-                auto databases = db_manager.listDatabases();
-                for (const auto& db : databases) {
-                    Record record;
-                    record["database"] = db;
-                    results.push_back(record);
-                }
-                records_found = databases.size();
-            } else if (object == "TABLES") {
-                current_query.type = QueryType::SHOW_TABLES;
-                auto tables = db_manager.listTables();
-                for (const auto& table : tables) {
-                    Record record;
-                    record["table"] = table;
-                    results.push_back(record);
-                }
-                records_found = tables.size();
-            }
-        } else if (command == "INSERT") {
-            current_query.type = QueryType::INSERT;
-            if (!parseInsert(tokens)) {
-                current_query.error_message = "Failed to parse INSERT command";
-                return false;
+        } else if (current_query.type == QueryType::SHOW_DATABASES) {
+            auto databases = db_manager.listDatabases();
+            results.columns = { "database" };
+            for (const auto& db : databases) {
+                results.rows.push_back(Row{ db });
             }
-            Record record;
-            for (const auto& [key, value] : current_query.values) {
-                record[key] = value;
+            records_found = databases.size();
+        } else if (current_query.type == QueryType::SHOW_TABLES) {
+            auto tables = db_manager.listTables();
+            results.columns = { "table" };
+            for (const auto& table : tables) {
+                results.rows.push_back(Row{ table });
             }
-            success &= db_manager.insertRecord(current_query.table_name, record);
+            records_found = tables.size();
+        } else if (current_query.type == QueryType::INSERT) {
+            success &= db_manager.insertRows(current_query.table_name, current_query.rows) >= 0;
             if (!success) {
                 current_query.error_message = "Failed to insert record into table '" + current_query.table_name + "'";
             }
-        } else if (command == "SELECT") {
-    current_query.type = QueryType::SELECT;
+        } else if (current_query.type == QueryType::SELECT) {
     TableSchema schema1 = db_manager.getTableSchema(current_query.table_name);
     if (schema1.name.empty()) {
         current_query.error_message = "Table '" + current_query.table_name + "' does not exist";
         return false;
     }
-    if (!current_query.join_table_name.empty()) {
-        TableSchema schema2 = db_manager.getTableSchema(current_query.join_table_name);
-        if (schema2.name.empty()) {
-            current_query.error_message = "Join table '" + current_query.join_table_name + "' does not exist";
-            return false;
-        }
-        // Handle JOIN query
-        std::vector<std::tuple<std::string, std::string, FieldValue>> join_conditions;
-        for (const auto& cond : current_query.conditions) {
-            join_conditions.push_back(std::make_tuple(cond.column, cond.op, cond.value));
-        }
-        results = db_manager.joinTables(
-            current_query.table_name,
-            current_query.join_table_name,
-            current_query.join_condition,
-            join_conditions,
-            current_query.condition_operators
-        );
-        // Filter results to include only requested columns
-        results = filterRecordsByColumns(results, current_query.select_columns);
-        if (results.empty() && !join_conditions.empty()) {
-            current_query.error_message = "No records match the JOIN conditions";
+    if (!current_query.join_table_name.empty() && db_manager.getTableSchema(current_query.join_table_name).name.empty()) {
+        current_query.error_message = "Join table '" + current_query.join_table_name + "' does not exist";
+        return false;
+    }
+    // The optimizer picks the access paths and the join by estimated cost
+    Optimizer optimizer(db_manager);
+    std::unique_ptr<LogicalNode> logical_plan = buildLogicalPlan();
+    // EXPLAIN returns the chosen plan instead of running it
+    if (current_query.explain) {
+        results.columns = { "plan" };
+        for (const auto& line : optimizer.explain(*logical_plan)) {
+            results.rows.push_back(Row{ line });
         }
-    } else if (current_query.conditions.empty()) {
-        results = db_manager.getAllRecords(current_query.table_name);
-        // Filter results to include only requested columns
-        results = filterRecordsByColumns(results, current_query.select_columns);
         if (results.empty()) {
-            current_query.error_message = "No records found in table '" + current_query.table_name + "'";
+            current_query.error_message = "Failed to plan the query";
+        }
+        records_found = results.size();
+        continue;
+    }
+    std::unique_ptr<RowOperator> plan = optimizer.open(*logical_plan, current_query.cached_plan.get());
+    if (!current_query.join_table_name.empty()) {
+        if (!current_query.conditions.empty()) {
+            empty_message = "No records match the JOIN conditions";
         }
+    } else if (current_query.conditions.empty()) {
+        empty_message = "No records found in table '" + current_query.table_name + "'";
     } else {
-        std::vector<std::tuple<std::string, std::string, FieldValue>> conditions;
-        for (const auto& cond : current_query.conditions) {
-            conditions.push_back(std::make_tuple(cond.column, cond.op, cond.value));
-        }
-        results = db_manager.searchRecordsWithFilter(
-            current_query.table_name,
-            conditions,
-            current_query.condition_operators
-        );
-        // Filter results to include only requested columns
-        results = filterRecordsByColumns(results, current_query.select_columns);
-        if (results.empty()) {
-            current_query.error_message = "No records match the WHERE conditions in table '" + current_query.table_name + "'";
+        empty_message = "No records match the WHERE conditions in table '" + current_query.table_name + "'";
+    }
+    if (plan && stream_results) {
+        // Rows are counted by whoever reads the cursor
+        cursor = std::move(plan);
+    } else {
+        if (plan) {
+            results = collectRows(*plan);
+        }
+        if (results.empty() && !empty_message.empty()) {
+            current_query.error_message = empty_message;
         }
+        records_found = results.size();
     }
-    records_found = results.size();
-} else if (command == "UPDATE") {
-            current_query.type = QueryType::UPDATE;
-            if (!parseUpdate(tokens)) {
-                current_query.error_message = "Failed to parse UPDATE command";
-                return false;
-            }
+} else if (current_query.type == QueryType::UPDATE) {
             std::vector<std::tuple<std::string, std::string, FieldValue>> conditions;
             for (const auto& cond : current_query.conditions) {
                 conditions.push_back(std::make_tuple(cond.column, cond.op, cond.value));
@@ -349,12 +292,7 @@ bool QueryParser::execute() {
             if (!success) {
                 current_query.error_message = "Failed to update records in table '" + current_query.table_name + "'";
             }
-        } else if (command == "DELETE") {
-            current_query.type = QueryType::DELETE_OP;
-            if (!parseDelete(tokens)) {
-                current_query.error_message = "Failed to parse DELETE command";
-                return false;
-            }
+        } else if (current_query.type == QueryType::DELETE_OP) {
             std::vector<std::tuple<std::string, std::string, FieldValue>> conditions;
             for (const auto& cond : current_query.conditions) {
                 conditions.push_back(std::make_tuple(cond.column, cond.op, cond.value));
@@ -369,18 +307,51 @@ bool QueryParser::execute() {
             if (!success) {
                 current_query.error_message = "Failed to delete records from table '" + current_query.table_name + "'";
             }
+        } else if (current_query.type == QueryType::VACUUM) {
+            int reclaimed = db_manager.vacuum(current_query.table_name);
+            success &= (reclaimed >= 0);
+            records_found = reclaimed;
+            if (!success) {
+                current_query.error_message = "Failed to vacuum '" + current_query.table_name + "'";
+            }
+        } else if (current_query.type == QueryType::ANALYZE) {
+            int analyzed = db_manager.analyze(current_query.table_name);
+            success &= (analyzed >= 0);
+            records_found = std::max(analyzed, 0);
+            if (!success) {
+                current_query.error_message = "Failed to analyze '" + current_query.table_name + "'";
+            }
+        } else if (current_query.type == QueryType::COPY) {
+            int loaded = db_manager.copyFrom(current_query.table_name, current_query.file_path, current_query.copy_options);
+            success &= (loaded >= 0);
+            records_found = std::max(loaded, 0);
+            if (!success) {
+                current_query.error_message = "Failed to copy '" + current_query.file_path + "' into table '" + current_query.table_name + "'";
+            }
+        } else if (current_query.type == QueryType::PREPARE) {
+            std::lock_guard<std::mutex> lock(prepared.mutex);
+            prepared.statements[current_query.statement_name] = std::move(*current_query.prepared);
+            current_query.prepared.reset();
+        } else if (current_query.type == QueryType::DEALLOCATE) {
+            std::lock_guard<std::mutex> lock(prepared.mutex);
+            if (prepared.statements.erase(current_query.statement_name) == 0) {
+                success = false;
+                current_query.error_message = "Prepared statement '" + current_query.statement_name + "' does not exist";
+            }
         }
     }
 
     // Store the results and records found
-    current_query.results = results;
+    current_query.results = std::move(results);
     current_query.records_found = records_found;
+    current_query.cursor = std::move(cursor);
+    current_query.empty_message = std::move(empty_message);
     
     return success;
 }
 
 // Parsing methods
-bool QueryParser::parseCreateDatabase(const std::vector<std::string>& tokens) {
+bool QueryParser::parseCreateDatabase(const Tokens& tokens) {
     if (tokens.size() != 3) {
         current_query.error_message = "Invalid CREATE DATABASE syntax: expected 'CREATE DATABASE name'";
         return false;
@@ -389,7 +360,7 @@ bool QueryParser::parseCreateDatabase(const std::vector<std::string>& tokens) {
     return true;
 }
 
-bool QueryParser::parseDropDatabase(const std::vector<std::string>& tokens) {
+bool QueryParser::parseDropDatabase(const Tokens& tokens) {
     if (tokens.size() != 3) {
         current_query.error_message = "Invalid DROP DATABASE syntax: expected 'DROP DATABASE name'";
         return false;
@@ -398,7 +369,7 @@ bool QueryParser::parseDropDatabase(const std::vector<std::string>& tokens) {
     return true;
 }
 
-bool QueryParser::parseUseDatabase(const std::vector<std::string>& tokens) {
+bool QueryParser::parseUseDatabase(const Tokens& tokens) {
     if (tokens.size() != 2) {
         current_query.error_message = "Invalid USE DATABASE syntax: expected 'USE name'";
         return false;
@@ -407,7 +378,7 @@ bool QueryParser::parseUseDatabase(const std::vector<std::string>& tokens) {
     return true;
 }
 
-bool QueryParser::parseCreateTable(const std::vector<std::string>& tokens) {
+bool QueryParser::parseCreateTable(const Tokens& tokens) {
     if (tokens.size() < 4) {
         current_query.error_message = "Invalid CREATE TABLE syntax: expected 'CREATE TABLE name (...)'";
         return false;
@@ -438,7 +409,7 @@ bool QueryParser::parseCreateTable(const std::vector<std::string>& tokens) {
     bool is_primary_key = false;
     
     while (i < tokens.size() && tokens[i] != ")") {
-        std::string token = tokens[i];
+        std::string token(tokens[i]);
         if (token.empty()) {
             i++;
             continue;
@@ -466,8 +437,8 @@ bool QueryParser::parseCreateTable(const std::vector<std::string>& tokens) {
         if (token_upper == "FOREIGN" && i + 6 < tokens.size() && 
             tokens[i + 1] == "KEY" && tokens[i + 2] == "(" && tokens[i + 4] == ")" && 
             tokens[i + 5] == "REFERENCES") {
-            std::string local_column = tokens[i + 3];
-            std::string ref_table = tokens[i + 6];
+            std::string local_column(tokens[i + 3]);
+            std::string ref_table(tokens[i + 6]);
             std::string ref_column;
             
             if (i + 9 < tokens.size() && tokens[i + 7] == "(" && tokens[i + 9] == ")") {
@@ -498,7 +469,7 @@ bool QueryParser::parseCreateTable(const std::vector<std::string>& tokens) {
             if ((current_col_type == "STRING" || current_col_type == "CHAR") && 
                 i + 3 < tokens.size() && tokens[i + 1] == "(" && tokens[i + 3] == ")") {
                 try {
-                    current_col_length = std::stoi(tokens[i + 2]);
+                    current_col_length = std::stoi(std::string(tokens[i + 2]));
                     i += 4; // Skip type ( length )
                 } catch (...) {
                     current_query.error_message = "Invalid length for " + current_col_type;
@@ -510,7 +481,7 @@ bool QueryParser::parseCreateTable(const std::vector<std::string>& tokens) {
             
             // Look ahead for PRIMARY KEY or comma
             if (i < tokens.size()) {
-                std::string next_token = tokens[i];
+                std::string next_token(tokens[i]);
                 std::transform(next_token.begin(), next_token.end(), next_token.begin(), ::toupper);
                 
                 if (next_token == "PRIMARY" && i + 1 < tokens.size() && tokens[i + 1] == "KEY") {
@@ -572,7 +543,7 @@ bool QueryParser::parseCreateTable(const std::vector<std::string>& tokens) {
     return true;
 }
 
-bool QueryParser::parseDropTable(const std::vector<std::string>& tokens) {
+bool QueryParser::parseDropTable(const Tokens& tokens) {
     if (tokens.size() != 3) {
         current_query.error_message = "Invalid DROP TABLE syntax: expected 'DROP TABLE name'";
         return false;
@@ -581,136 +552,234 @@ bool QueryParser::parseDropTable(const std::vector<std::string>& tokens) {
     return true;
 }
 
-bool QueryParser::parseInsert(const std::vector<std::string>& tokens) {
+bool QueryParser::parseVacuum(const Tokens& tokens) {
+    if (tokens.size() > 2) {
+        current_query.error_message = "Invalid VACUUM syntax: expected 'VACUUM [table]'";
+        return false;
+    }
+    current_query.table_name = tokens.size() == 2 ? tokens[1] : "";
+    return true;
+}
+
+bool QueryParser::parseAnalyze(const Tokens& tokens) {
+    if (tokens.size() > 2) {
+        current_query.error_message = "Invalid ANALYZE syntax: expected 'ANALYZE [table]'";
+        return false;
+    }
+    current_query.table_name = tokens.size() == 2 ? tokens[1] : "";
+    return true;
+}
+
+std::unique_ptr<LogicalNode> QueryParser::buildLogicalPlan() const {
+    const Query& query = current_query;
+    auto plan = std::make_unique<LogicalNode>(LogicalNode::SCAN);
+    plan->table = query.table_name;
+    if (!query.join_table_name.empty()) {
+        // The join condition compares two "table.column" names, e.g. users.id = orders.user_id
+        auto join = std::make_unique<LogicalNode>(LogicalNode::JOIN);
+        join->left_column = query.join_condition.column;
+        if (std::holds_alternative<std::string>(query.join_condition.value)) {
+            join->right_column = std::get<std::string>(query.join_condition.value);
+        }
+        join->inputs.push_back(std::move(plan));
+        join->inputs.push_back(std::make_unique<LogicalNode>(LogicalNode::SCAN));
+        join->inputs.back()->table = query.join_table_name;
+        plan = std::move(join);
+    }
+    if (!query.conditions.empty()) {
+        plan = std::make_unique<LogicalNode>(LogicalNode::FILTER, std::move(plan));
+        for (const auto& cond : query.conditions) {
+            plan->conditions.emplace_back(cond.column, cond.op, cond.value);
+        }
+        plan->operators = query.condition_operators;
+    }
+
+    // Aggregate queries return one row per group instead of the rows themselves
+    std::vector<Aggregate> aggregates;
+    std::vector<std::string> aggregate_names = query.select_columns;
+    for (const auto& [column, descending] : query.order_by) {
+        aggregate_names.push_back(column);
+    }
+    for (const auto& name : aggregate_names) {
+        Aggregate aggregate;
+        if (parseAggregate(name, aggregate) && std::none_of(aggregates.begin(), aggregates.end(),
+            [&](const Aggregate& other) { return other.name() == aggregate.name(); })) {
+            aggregates.push_back(aggregate);
+        }
+    }
+    if (!aggregates.empty() || !query.group_by.empty()) {
+        plan = std::make_unique<LogicalNode>(LogicalNode::AGGREGATE, std::move(plan));
+        plan->columns = query.group_by;
+        plan->aggregates = aggregates;
+    }
+    if (!query.order_by.empty()) {
+        plan = std::make_unique<LogicalNode>(LogicalNode::SORT, std::move(plan));
+        for (const auto& [column, descending] : query.order_by) {
+            plan->sort_keys.push_back({ column, descending });
+        }
+    }
+    if (query.limit >= 0 || query.offset > 0) {
+        plan = std::make_unique<LogicalNode>(LogicalNode::LIMIT, std::move(plan));
+        plan->limit = query.limit < 0 ? SIZE_MAX : static_cast<size_t>(query.limit);
+        plan->offset = query.offset;
+    }
+    // Only the requested columns are passed on
+    if (!(query.select_columns.size() == 1 && query.select_columns[0] == "*")) {
+        plan = std::make_unique<LogicalNode>(LogicalNode::PROJECT, std::move(plan));
+        plan->columns = query.select_columns;
+    }
+    return plan;
+}
+
+bool QueryParser::parseInsert(const Tokens& tokens) {
     if (tokens.size() < 6) {
-        current_query.error_message = "Invalid INSERT syntax: expected 'INSERT INTO table VALUES (...)'";
+        current_query.error_message = "Invalid INSERT syntax: expected 'INSERT INTO table VALUES (...), ...'";
         return false;
     }
 
     current_query.type = QueryType::INSERT;
     current_query.table_name = tokens[2];
 
-    // Parse values
-    std::map<std::string, FieldValue> values;
-    int value_index = 0;
-
-    // Get table schema to map values to column names
+    // Get table schema to put values in column order
     TableSchema schema = db_manager.getTableSchema(current_query.table_name);
     if (schema.name.empty()) {
         current_query.error_message = "Table '" + current_query.table_name + "' does not exist";
         return false;
     }
 
-    // Start parsing after VALUES keyword
+    // Start parsing after VALUES keyword; every parenthesized tuple is one row
     size_t i = 4; // Should point to '(' after VALUES
-    if (tokens[i] != "(") {
-        current_query.error_message = "Expected '(' after VALUES";
-        return false;
-    }
-    i++; // Skip '('
+    while (true) {
+        if (i >= tokens.size() || tokens[i] != "(") {
+            current_query.error_message = "Expected '(' after VALUES";
+            return false;
+        }
+        i++; // Skip '('
 
-    std::vector<std::string> value_tokens;
-    bool in_quotes = false;
-    std::string current_token;
+        std::vector<std::string> value_tokens;
+        bool in_quotes = false;
+        std::string current_token;
 
-    // Collect value tokens, preserving quoted strings
-    while (i < tokens.size() && tokens[i] != ")") {
-        std::string token = tokens[i];
+        // Collect value tokens, preserving quoted strings
+        while (i < tokens.size() && tokens[i] != ")") {
+            std::string_view token = tokens[i];
 
-        if (token == "," && !in_quotes) {
-            if (!current_token.empty()) {
-                value_tokens.push_back(current_token);
-                current_token.clear();
+            if (token == "," && !in_quotes) {
+                if (!current_token.empty()) {
+                    value_tokens.push_back(current_token);
+                    current_token.clear();
+                }
+                i++;
+                continue;
             }
-            i++;
-            continue;
-        }
 
-        if (token == "'" && !in_quotes) {
-            in_quotes = true;
-            current_token += token;
-            i++;
-            continue;
-        }
+            if (token == "'" && !in_quotes) {
+                in_quotes = true;
+                current_token += token;
+                i++;
+                continue;
+            }
+
+            if (token == "'" && in_quotes) {
+                in_quotes = false;
+                current_token += token;
+                i++;
+                continue;
+            }
 
-        if (token == "'" && in_quotes) {
-            in_quotes = false;
             current_token += token;
+            if (!in_quotes && i + 1 < tokens.size() && tokens[i + 1] != "," && tokens[i + 1] != ")") {
+                current_token += " ";
+            }
             i++;
-            continue;
         }
 
-        current_token += token;
-        if (!in_quotes && i + 1 < tokens.size() && tokens[i + 1] != "," && tokens[i + 1] != ")") {
-            current_token += " ";
+        if (!current_token.empty()) {
+            value_tokens.push_back(current_token);
         }
-        i++;
-    }
 
-    if (!current_token.empty()) {
-        value_tokens.push_back(current_token);
-    }
-
-    if (i >= tokens.size() || tokens[i] != ")") {
-        current_query.error_message = "Expected ')' after values";
-        return false;
-    }
+        if (i >= tokens.size() || tokens[i] != ")") {
+            current_query.error_message = "Expected ')' after values";
+            return false;
+        }
+        i++; // Skip ')'
 
-    // Parse each value token
-    for (const auto& token : value_tokens) {
-        if (value_index >= schema.columns.size()) {
+        if (value_tokens.size() > schema.columns.size()) {
             current_query.error_message = "Too many values for table '" + current_query.table_name + "'";
             return false;
         }
+        if (value_tokens.size() != schema.columns.size()) {
+            current_query.error_message = "Incorrect number of values for table '" + current_query.table_name + "'";
+            return false;
+        }
 
-        const std::string& column_name = schema.columns[value_index].name;
-        Column::Type column_type = schema.columns[value_index].type;
-
-        try {
-            switch (column_type) {
-            case Column::INT: {
-                int int_val = std::stoi(token);
-                values[column_name] = int_val;
-                break;
-            }
-            case Column::FLOAT: {
-                float float_val = std::stof(token);
-                values[column_name] = float_val;
-                break;
+        // Parse each value token
+        Row row;
+        row.reserve(schema.columns.size());
+        for (const auto& token : value_tokens) {
+            size_t value_index = row.size();
+            const std::string& column_name = schema.columns[value_index].name;
+            Column::Type column_type = schema.columns[value_index].type;
+            if (token == "?") {
+                Placeholder placeholder;
+                placeholder.column = column_name;
+                placeholder.type = column_type;
+                placeholder.row = static_cast<int>(current_query.rows.size());
+                placeholder.ordinal = static_cast<int>(value_index);
+                current_query.placeholders.push_back(placeholder);
+                row.push_back(FieldValue());
+                continue;
             }
-            case Column::STRING:
-            case Column::CHAR: {
-                std::string str_val = token;
-                if (str_val.front() == '\'' && str_val.back() == '\'') {
-                    str_val = str_val.substr(1, str_val.length() - 2);
+
+            try {
+                switch (column_type) {
+                case Column::INT: {
+                    int int_val = std::stoi(token);
+                    row.push_back(int_val);
+                    break;
+                }
+                case Column::FLOAT: {
+                    float float_val = std::stof(token);
+                    row.push_back(float_val);
+                    break;
+                }
+                case Column::STRING:
+                case Column::CHAR: {
+                    if (token.size() >= 2 && token.front() == '\'' && token.back() == '\'') {
+                        row.push_back(token.substr(1, token.length() - 2));
+                    } else {
+                        row.push_back(token);
+                    }
+                    break;
+                }
+                case Column::BOOL: {
+                    bool bool_val = (token == "true" || token == "TRUE" || token == "1");
+                    row.push_back(bool_val);
+                    break;
+                }
+                default:
+                    throw std::invalid_argument(token);
                 }
-                values[column_name] = str_val;
-                break;
-            }
-            case Column::BOOL: {
-                bool bool_val = (token == "true" || token == "TRUE" || token == "1");
-                values[column_name] = bool_val;
-                break;
             }
+            catch (...) {
+                current_query.error_message = "Invalid value '" + token + "' for column '" + column_name + "'";
+                return false;
             }
-            value_index++;
         }
-        catch (...) {
-            current_query.error_message = "Invalid value '" + token + "' for column '" + column_name + "'";
+        current_query.rows.push_back(std::move(row));
+
+        if (i == tokens.size()) {
+            return true;
+        }
+        if (tokens[i] != ",") {
+            current_query.error_message = "Expected ',' between rows of VALUES";
             return false;
         }
+        i++; // Skip ','
     }
-
-    if (value_index != schema.columns.size()) {
-        current_query.error_message = "Incorrect number of values for table '" + current_query.table_name + "'";
-        return false;
-    }
-
-    current_query.values = values;
-    return true;
 }
 
-bool QueryParser::parseSelect(const std::vector<std::string>& tokens) {
+bool QueryParser::parseSelect(const Tokens& tokens) {
     if (tokens.size() < 4) {
         current_query.error_message = "Invalid SELECT syntax: expected 'SELECT ... FROM table'";
         return false;
@@ -723,8 +792,14 @@ bool QueryParser::parseSelect(const std::vector<std::string>& tokens) {
     }
     std::vector<std::string> columns;
     for (size_t i = 1; i < from_pos; i++) {
-        std::string col = tokens[i];
+        std::string col(tokens[i]);
         col.erase(std::remove(col.begin(), col.end(), ','), col.end());
+        // Aggregates arrive as FUNC ( column ) tokens
+        if (i + 3 < from_pos && tokens[i + 1] == "(" && tokens[i + 3] == ")") {
+            std::transform(col.begin(), col.end(), col.begin(), ::toupper);
+            col += "(" + std::string(tokens[i + 2]) + ")";
+            i += 3;
+        }
         if (!col.empty()) {
             columns.push_back(col);
         }
@@ -753,8 +828,8 @@ bool QueryParser::parseSelect(const std::vector<std::string>& tokens) {
             current_query.error_message = "Invalid ON condition: expected 'table1.col = table2.col'";
             return false;
         }
-        std::string left_col = tokens[on_pos + 1]; // table1.col1
-        std::string right_col = tokens[on_pos + 3]; // table2.col2
+        std::string left_col(tokens[on_pos + 1]); // table1.col1
+        std::string right_col(tokens[on_pos + 3]); // table2.col2
         if (left_col.find('.') == std::string::npos || right_col.find('.') == std::string::npos) {
             current_query.error_message = "ON condition must specify table.column";
             return false;
@@ -777,45 +852,210 @@ bool QueryParser::parseSelect(const std::vector<std::string>& tokens) {
             return false;
         }
     }
-    if (columns[0] != "*") {
-        for (const auto& col : columns) {
-            bool found = false;
-            for (const auto& schema_col : schema1.columns) {
-                if (schema_col.name == col || (current_query.table_name + "." + schema_col.name) == col) {
-                    found = true;
-                    break;
+    TableSchema schema2;
+    if (!current_query.join_table_name.empty()) {
+        schema2 = db_manager.getTableSchema(current_query.join_table_name);
+    }
+    auto findColumn = [&](const std::string& col) -> const Column* {
+        for (const auto& schema_col : schema1.columns) {
+            if (schema_col.name == col || (current_query.table_name + "." + schema_col.name) == col) {
+                return &schema_col;
+            }
+        }
+        for (const auto& schema_col : schema2.columns) {
+            if (schema_col.name == col || (current_query.join_table_name + "." + schema_col.name) == col) {
+                return &schema_col;
+            }
+        }
+        return nullptr;
+    };
+    auto missingColumn = [&](const std::string& col) {
+        current_query.error_message = "Column '" + col + "' does not exist in table '" +
+                                     current_query.table_name + "' or '" + current_query.join_table_name + "'";
+        return false;
+    };
+
+    // The clauses after FROM end where the next one starts
+    size_t where_pos = std::find(tokens.begin(), tokens.end(), "WHERE") - tokens.begin();
+    size_t group_pos = std::find(tokens.begin(), tokens.end(), "GROUP") - tokens.begin();
+    size_t order_pos = std::find(tokens.begin(), tokens.end(), "ORDER") - tokens.begin();
+    size_t limit_pos = std::find(tokens.begin(), tokens.end(), "LIMIT") - tokens.begin();
+    auto clauseEnd = [&](size_t pos) {
+        size_t end = tokens.size();
+        for (size_t next : { where_pos, group_pos, order_pos, limit_pos }) {
+            if (next > pos && next < end) {
+                end = next;
+            }
+        }
+        return end;
+    };
+
+    current_query.group_by.clear();
+    if (group_pos < tokens.size()) {
+        size_t group_end = clauseEnd(group_pos);
+        if (group_pos + 2 >= group_end || tokens[group_pos + 1] != "BY") {
+            current_query.error_message = "Invalid GROUP BY clause: expected 'GROUP BY column, ...'";
+            return false;
+        }
+        for (size_t i = group_pos + 2; i < group_end; i++) {
+            if (tokens[i] == ",") continue;
+            std::string col(tokens[i]);
+            if (!findColumn(col)) {
+                return missingColumn(col);
+            }
+            current_query.group_by.push_back(col);
+        }
+    }
+
+    current_query.order_by.clear();
+    if (order_pos < tokens.size()) {
+        size_t order_end = clauseEnd(order_pos);
+        if (order_pos + 2 >= order_end || tokens[order_pos + 1] != "BY") {
+            current_query.error_message = "Invalid ORDER BY clause: expected 'ORDER BY column [ASC|DESC], ...'";
+            return false;
+        }
+        for (size_t i = order_pos + 2; i < order_end; i++) {
+            if (tokens[i] == ",") continue;
+            std::string col(tokens[i]);
+            if (i + 3 < order_end && tokens[i + 1] == "(" && tokens[i + 3] == ")") {
+                std::transform(col.begin(), col.end(), col.begin(), ::toupper);
+                col += "(" + std::string(tokens[i + 2]) + ")";
+                i += 3;
+            }
+            bool descending = false;
+            if (i + 1 < order_end) {
+                std::string direction(tokens[i + 1]);
+                std::transform(direction.begin(), direction.end(), direction.begin(), ::toupper);
+                if (direction == "ASC" || direction == "DESC") {
+                    descending = direction == "DESC";
+                    i++;
                 }
             }
-            if (!found && !current_query.join_table_name.empty()) {
-                TableSchema schema2 = db_manager.getTableSchema(current_query.join_table_name);
-                for (const auto& schema_col : schema2.columns) {
-                    if (schema_col.name == col || (current_query.join_table_name + "." + schema_col.name) == col) {
-                        found = true;
-                        break;
-                    }
+            current_query.order_by.emplace_back(col, descending);
+        }
+    }
+
+    current_query.limit = -1;
+    current_query.offset = 0;
+    if (limit_pos < tokens.size()) {
+        size_t limit_end = clauseEnd(limit_pos);
+        auto count = [&](size_t pos) {
+            FieldValue value = pos < limit_end ? parseValue(tokens[pos]) : FieldValue(-1);
+            return std::holds_alternative<int>(value) ? std::get<int>(value) : -1;
+        };
+        current_query.limit = count(limit_pos + 1);
+        bool has_offset = limit_pos + 2 < limit_end;
+        if (has_offset) {
+            std::string keyword(tokens[limit_pos + 2]);
+            std::transform(keyword.begin(), keyword.end(), keyword.begin(), ::toupper);
+            current_query.offset = keyword == "OFFSET" ? count(limit_pos + 3) : -1;
+        }
+        if (current_query.limit < 0 || current_query.offset < 0 || limit_pos + (has_offset ? 4 : 2) != limit_end) {
+            current_query.error_message = "Invalid LIMIT clause: expected 'LIMIT count [OFFSET count]'";
+            return false;
+        }
+    }
+
+    bool aggregating = !current_query.group_by.empty();
+    for (const auto& col : columns) {
+        Aggregate aggregate;
+        aggregating = aggregating || parseAggregate(col, aggregate);
+    }
+    if (aggregating && columns[0] == "*") {
+        current_query.error_message = "SELECT * cannot be combined with GROUP BY or aggregates";
+        return false;
+    }
+    auto checkAggregate = [&](const std::string& col, const Aggregate& aggregate) {
+        if (aggregate.column == "*") {
+            if (aggregate.function != Aggregate::COUNT) {
+                current_query.error_message = "Only COUNT accepts '*': " + col;
+                return false;
+            }
+            return true;
+        }
+        const Column* column = findColumn(aggregate.column);
+        if (!column) {
+            return missingColumn(aggregate.column);
+        }
+        if ((aggregate.function == Aggregate::SUM || aggregate.function == Aggregate::AVG) &&
+            column->type != Column::INT && column->type != Column::FLOAT) {
+            current_query.error_message = col + " requires an INT or FLOAT column";
+            return false;
+        }
+        return true;
+    };
+    // Plain columns of an aggregate query must be grouped on; they are referred to by the name
+    // they were grouped under
+    auto groupedName = [&](std::string& col) {
+        auto base = [](const std::string& name) { return name.substr(name.find('.') + 1); };
+        auto grouped = std::find_if(current_query.group_by.begin(), current_query.group_by.end(),
+            [&](const std::string& name) { return name == col || base(name) == base(col); });
+        if (grouped == current_query.group_by.end()) {
+            current_query.error_message = "Column '" + col + "' must appear in GROUP BY or an aggregate";
+            return false;
+        }
+        col = *grouped;
+        return true;
+    };
+
+    if (columns[0] != "*") {
+        for (auto& col : columns) {
+            Aggregate aggregate;
+            if (parseAggregate(col, aggregate)) {
+                if (!checkAggregate(col, aggregate)) {
+                    return false;
                 }
+                continue;
             }
-            if (!found) {
-                current_query.error_message = "Column '" + col + "' does not exist in table '" +
-                                             current_query.table_name + "' or '" + current_query.join_table_name + "'";
+            if (!findColumn(col)) {
+                return missingColumn(col);
+            }
+            if (aggregating && !groupedName(col)) {
                 return false;
             }
         }
     }
     current_query.select_columns = columns;
-    size_t where_pos = std::find(tokens.begin(), tokens.end(), "WHERE") - tokens.begin();
+
+    for (auto& [col, descending] : current_query.order_by) {
+        Aggregate aggregate;
+        if (parseAggregate(col, aggregate)) {
+            if (!aggregating) {
+                current_query.error_message = "ORDER BY " + col + " requires an aggregate query";
+                return false;
+            }
+            if (!checkAggregate(col, aggregate)) {
+                return false;
+            }
+            continue;
+        }
+        if (!findColumn(col)) {
+            return missingColumn(col);
+        }
+        if (aggregating) {
+            if (!groupedName(col)) {
+                return false;
+            }
+        } else if (!current_query.join_table_name.empty() && col.find('.') == std::string::npos) {
+            // Join rows only carry qualified column names
+            bool in_first = std::any_of(schema1.columns.begin(), schema1.columns.end(),
+                [&](const Column& column) { return column.name == col; });
+            col = (in_first ? current_query.table_name : current_query.join_table_name) + "." + col;
+        }
+    }
+    current_query.conditions.clear();
+    current_query.condition_operators.clear();
     if (where_pos < tokens.size()) {
-        current_query.conditions.clear();
-        current_query.condition_operators.clear();
-        for (size_t i = where_pos + 1; i < tokens.size(); ) {
-            std::string token = tokens[i];
+        size_t where_end = clauseEnd(where_pos);
+        for (size_t i = where_pos + 1; i < where_end; ) {
+            std::string token(tokens[i]);
             std::transform(token.begin(), token.end(), token.begin(), ::toupper);
             if (token == "AND" || token == "OR" || token == "NOT") {
                 current_query.condition_operators.push_back(token);
                 i++;
                 continue;
             }
-            if (i + 2 >= tokens.size()) {
+            if (i + 2 >= where_end) {
                 current_query.error_message = "Incomplete WHERE condition";
                 return false;
             }
@@ -823,6 +1063,11 @@ bool QueryParser::parseSelect(const std::vector<std::string>& tokens) {
             cond.column = tokens[i];
             cond.op = tokens[i + 1];
             cond.value = parseValue(tokens[i + 2]);
+            if (tokens[i + 2] == "?") {
+                Placeholder placeholder;
+                placeholder.condition = static_cast<int>(current_query.conditions.size());
+                current_query.placeholders.push_back(placeholder);
+            }
             current_query.conditions.push_back(cond);
             i += 3;
         }
@@ -840,7 +1085,7 @@ bool QueryParser::parseSelect(const std::vector<std::string>& tokens) {
     return true;
 }
 
-bool QueryParser::parseUpdate(const std::vector<std::string>& tokens) {
+bool QueryParser::parseUpdate(const Tokens& tokens) {
     if (tokens.size() < 6) {
         current_query.error_message = "Invalid UPDATE syntax: expected 'UPDATE table SET ...'";
         return false;
@@ -862,7 +1107,13 @@ bool QueryParser::parseUpdate(const std::vector<std::string>& tokens) {
         if (tokens[i] == "WHERE") break;
         if (i + 2 >= tokens.size() || tokens[i + 1] != "=") continue;
         
-        values[tokens[i]] = parseValue(tokens[i + 2]);
+        std::string column(tokens[i]);
+        values[column] = parseValue(tokens[i + 2]);
+        if (tokens[i + 2] == "?") {
+            Placeholder placeholder;
+            placeholder.column = column;
+            current_query.placeholders.push_back(placeholder);
+        }
         i += 2;
     }
     current_query.values = values;
@@ -874,7 +1125,7 @@ bool QueryParser::parseUpdate(const std::vector<std::string>& tokens) {
         current_query.condition_operators.clear();
         
         for (size_t i = where_pos + 1; i < tokens.size(); ) {
-            std::string token = tokens[i];
+            std::string token(tokens[i]);
             std::transform(token.begin(), token.end(), token.begin(), ::toupper);
             
             if (token == "AND" || token == "OR" || token == "NOT") {
@@ -892,6 +1143,11 @@ bool QueryParser::parseUpdate(const std::vector<std::string>& tokens) {
             cond.column = tokens[i];
             cond.op = tokens[i + 1];
             cond.value = parseValue(tokens[i + 2]);
+            if (tokens[i + 2] == "?") {
+                Placeholder placeholder;
+                placeholder.condition = static_cast<int>(current_query.conditions.size());
+                current_query.placeholders.push_back(placeholder);
+            }
             current_query.conditions.push_back(cond);
             i += 3;
         }
@@ -912,7 +1168,7 @@ bool QueryParser::parseUpdate(const std::vector<std::string>& tokens) {
     return true;
 }
 
-bool QueryParser::parseDelete(const std::vector<std::string>& tokens) {
+bool QueryParser::parseDelete(const Tokens& tokens) {
     if (tokens.size() < 3) {
         current_query.error_message = "Invalid DELETE syntax: expected 'DELETE FROM table'";
         return false;
@@ -928,7 +1184,7 @@ bool QueryParser::parseDelete(const std::vector<std::string>& tokens) {
         current_query.condition_operators.clear();
         
         for (size_t i = where_pos + 1; i < tokens.size(); ) {
-            std::string token = tokens[i];
+            std::string token(tokens[i]);
             std::transform(token.begin(), token.end(), token.begin(), ::toupper);
             
             if (token == "AND" || token == "OR" || token == "NOT") {
@@ -946,6 +1202,11 @@ bool QueryParser::parseDelete(const std::vector<std::string>& tokens) {
             cond.column = tokens[i];
             cond.op = tokens[i + 1];
             cond.value = parseValue(tokens[i + 2]);
+            if (tokens[i + 2] == "?") {
+                Placeholder placeholder;
+                placeholder.condition = static_cast<int>(current_query.conditions.size());
+                current_query.placeholders.push_back(placeholder);
+            }
             current_query.conditions.push_back(cond);
             i += 3;
         }
@@ -966,84 +1227,276 @@ bool QueryParser::parseDelete(const std::vector<std::string>& tokens) {
     return true;
 }
 
-// Helper methods
-std::vector<std::string> QueryParser::tokenize(const std::string& query) {
-    std::vector<std::string> tokens;
-    std::string current_token;
-    bool in_quotes = false;
-    
-    // Clean up the query string first
-    std::string cleaned_query = query;
-    // Replace all types of newlines and whitespace sequences with a single space
-    for (size_t i = 0; i < cleaned_query.length(); ) {
-        if (cleaned_query[i] == '\r' || cleaned_query[i] == '\n' || cleaned_query[i] == '\t') {
-            cleaned_query[i] = ' ';
-            i++;
-        } else if (cleaned_query[i] == ' ' && i + 1 < cleaned_query.length() && cleaned_query[i + 1] == ' ') {
-            cleaned_query.erase(i, 1);
+bool QueryParser::parsePrepare(const Tokens& tokens) {
+    std::string keyword = tokens.size() > 3 ? std::string(tokens[2]) : "";
+    std::transform(keyword.begin(), keyword.end(), keyword.begin(), ::toupper);
+    if (keyword != "AS") {
+        current_query.error_message = "Invalid PREPARE syntax: expected 'PREPARE name AS statement'";
+        return false;
+    }
+    std::string name(tokens[1]);
+
+    // The statement is kept as text too, with its tokens one space apart, which lexes the same
+    Tokens body(tokens.begin() + 3, tokens.end());
+    auto statement = std::make_shared<PreparedStatement>();
+    for (std::string_view token : body) {
+        if (!statement->text.empty()) {
+            statement->text += ' ';
+        }
+        statement->text += token;
+    }
+    statement->schema_version = db_manager.getSchemaVersion();
+
+    current_query = Query();
+    if (!parseStatement(body)) {
+        return false;
+    }
+    if (current_query.type == QueryType::PREPARE || current_query.type == QueryType::EXECUTE ||
+        current_query.type == QueryType::DEALLOCATE) {
+        current_query.error_message = "PREPARE cannot hold a PREPARE, EXECUTE or DEALLOCATE statement";
+        return false;
+    }
+    if (current_query.type == QueryType::SELECT && !current_query.explain) {
+        current_query.cached_plan = std::make_shared<CachedPlan>();
+    }
+    statement->query = std::move(current_query);
+
+    current_query = Query();
+    current_query.type = QueryType::PREPARE;
+    current_query.statement_name = name;
+    current_query.prepared = std::move(statement);
+    return true;
+}
+
+bool QueryParser::parseExecute(const Tokens& tokens) {
+    bool has_values = tokens.size() > 2;
+    if (tokens.size() < 2 || (has_values && (tokens[2] != "(" || tokens.back() != ")"))) {
+        current_query.error_message = "Invalid EXECUTE syntax: expected 'EXECUTE name [(value, ...)]'";
+        return false;
+    }
+    current_query.statement_name = tokens[1];
+    for (size_t i = 3; has_values && i + 1 < tokens.size(); i++) {
+        if (tokens[i] != ",") {
+            current_query.parameters.push_back(parseValue(tokens[i]));
+        }
+    }
+    return true;
+}
+
+bool QueryParser::parseDeallocate(const Tokens& tokens) {
+    std::string keyword = tokens.size() == 3 ? std::string(tokens[1]) : "";
+    std::transform(keyword.begin(), keyword.end(), keyword.begin(), ::toupper);
+    if (tokens.size() != 2 && keyword != "PREPARE") {
+        current_query.error_message = "Invalid DEALLOCATE syntax: expected 'DEALLOCATE [PREPARE] name'";
+        return false;
+    }
+    current_query.statement_name = tokens.back();
+    return true;
+}
+
+bool QueryParser::parseCopy(const Tokens& tokens) {
+    std::string keyword = tokens.size() > 3 ? std::string(tokens[2]) : "";
+    std::transform(keyword.begin(), keyword.end(), keyword.begin(), ::toupper);
+    std::string_view path = tokens.size() > 3 ? tokens[3] : "";
+    if (keyword != "FROM" || path.size() < 2 || path.front() != '\'' || path.back() != '\'') {
+        current_query.error_message = "Invalid COPY syntax: expected 'COPY table FROM 'file' [WITH (FORMAT CSV | BINARY, HEADER, DEFER_FOREIGN_KEYS)]'";
+        return false;
+    }
+    current_query.table_name = tokens[1];
+    current_query.file_path = path.substr(1, path.size() - 2);
+    if (db_manager.getTableSchema(current_query.table_name).name.empty()) {
+        current_query.error_message = "Table '" + current_query.table_name + "' does not exist";
+        return false;
+    }
+
+    // Options, optionally after WITH and in parentheses
+    for (size_t i = 4; i < tokens.size(); i++) {
+        std::string option(tokens[i]);
+        std::transform(option.begin(), option.end(), option.begin(), ::toupper);
+        if (option == "(" || option == ")" || option == "," || (option == "WITH" && i == 4)) {
+            continue;
+        }
+        if (option == "HEADER") {
+            current_query.copy_options.header = true;
+        } else if (option == "DEFER_FOREIGN_KEYS") {
+            current_query.copy_options.defer_foreign_keys = true;
+        } else if (option == "FORMAT" && i + 1 < tokens.size()) {
+            std::string format(tokens[++i]);
+            std::transform(format.begin(), format.end(), format.begin(), ::toupper);
+            if (format == "CSV") {
+                current_query.copy_options.format = CopyOptions::CSV;
+            } else if (format == "BINARY") {
+                current_query.copy_options.format = CopyOptions::BINARY;
+            } else {
+                current_query.error_message = "Unknown COPY format '" + format + "': expected CSV or BINARY";
+                return false;
+            }
         } else {
-            i++;
+            current_query.error_message = "Unknown COPY option '" + option + "'";
+            return false;
         }
     }
-    
-    // Trim leading/trailing spaces
-    while (!cleaned_query.empty() && cleaned_query[0] == ' ') {
-        cleaned_query.erase(0, 1);
+    return true;
+}
+
+namespace {
+
+// Converts a parameter to the type of the column it is bound to, as parseInsert converts
+// literals; false if it cannot be
+bool convertParameter(FieldValue& value, Column::Type type) {
+    switch (type) {
+    case Column::INT:
+        return std::holds_alternative<int>(value);
+    case Column::FLOAT:
+        if (std::holds_alternative<int>(value)) {
+            value = static_cast<float>(std::get<int>(value));
+        }
+        return std::holds_alternative<float>(value);
+    case Column::STRING:
+    case Column::CHAR:
+        return std::holds_alternative<std::string>(value);
+    case Column::BOOL:
+        if (std::holds_alternative<int>(value)) {
+            value = std::get<int>(value) != 0;
+        }
+        return std::holds_alternative<bool>(value);
+    default:
+        return true;
     }
-    while (!cleaned_query.empty() && cleaned_query.back() == ' ') {
-        cleaned_query.pop_back();
+}
+
+} // namespace
+
+bool QueryParser::bindPrepared() {
+    std::string name = current_query.statement_name;
+    // Work on a copy, so the set is not locked while the database is
+    PreparedStatement statement;
+    {
+        std::lock_guard<std::mutex> lock(prepared.mutex);
+        auto it = prepared.statements.find(name);
+        if (it == prepared.statements.end()) {
+            current_query.error_message = "Prepared statement '" + name + "' does not exist";
+            return false;
+        }
+        statement = it->second;
     }
-    
-    // Enhanced tokenization to handle delimiters
-    for (size_t i = 0; i < cleaned_query.length(); ) {
-        char c = cleaned_query[i];
-        
+    std::vector<FieldValue> parameters = std::move(current_query.parameters);
+    std::string error_message = std::move(current_query.error_message);
+
+    // Tables were created or dropped since the statement was checked; check it again
+    uint64_t schema_version = db_manager.getSchemaVersion();
+    if (statement.schema_version != schema_version) {
+        std::vector<Tokens> lexed = lex(statement.text);
+        current_query = Query();
+        if (lexed.size() != 1 || !parseStatement(lexed[0])) {
+            current_query.error_message = "Prepared statement '" + name + "' is no longer valid: " +
+                                         current_query.error_message;
+            return false;
+        }
+        if (current_query.type == QueryType::SELECT && !current_query.explain) {
+            current_query.cached_plan = std::make_shared<CachedPlan>();
+        }
+        statement.query = std::move(current_query);
+        statement.schema_version = schema_version;
+
+        // Keep the checked statement, unless it has been replaced meanwhile
+        std::lock_guard<std::mutex> lock(prepared.mutex);
+        auto it = prepared.statements.find(name);
+        if (it != prepared.statements.end() && it->second.text == statement.text) {
+            it->second = statement;
+        }
+    }
+
+    const std::vector<Placeholder>& placeholders = statement.query.placeholders;
+    if (parameters.size() != placeholders.size()) {
+        current_query.error_message = "Prepared statement '" + name + "' takes " +
+                                     std::to_string(placeholders.size()) + " parameters, not " +
+                                     std::to_string(parameters.size());
+        return false;
+    }
+    for (size_t i = 0; i < parameters.size(); i++) {
+        if (!convertParameter(parameters[i], placeholders[i].type)) {
+            current_query.error_message = "Parameter " + std::to_string(i + 1) + " of '" + name +
+                                         "' does not fit column '" + placeholders[i].column + "'";
+            return false;
+        }
+    }
+
+    current_query = std::move(statement.query);
+    current_query.error_message = std::move(error_message);
+    for (size_t i = 0; i < parameters.size(); i++) {
+        const Placeholder& placeholder = current_query.placeholders[i];
+        if (placeholder.condition >= 0) {
+            current_query.conditions[placeholder.condition].value = std::move(parameters[i]);
+        } else if (placeholder.row >= 0) {
+            current_query.rows[placeholder.row][placeholder.ordinal] = std::move(parameters[i]);
+        } else {
+            current_query.values[placeholder.column] = std::move(parameters[i]);
+        }
+    }
+    return true;
+}
+
+// Helper methods
+std::vector<QueryParser::Tokens> QueryParser::lex(std::string_view text) {
+    std::vector<Tokens> statements(1);
+    size_t token_start = std::string_view::npos;
+    bool in_quotes = false;
+
+    auto endToken = [&](size_t end) {
+        if (token_start != std::string_view::npos) {
+            statements.back().push_back(text.substr(token_start, end - token_start));
+            token_start = std::string_view::npos;
+        }
+    };
+
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
         if (c == '\'') {
             in_quotes = !in_quotes;
-            current_token += c;
-            i++;
-        } else if (!in_quotes && (c == '(' || c == ')' || c == ',' || c == ';')) {
-            if (!current_token.empty()) {
-                tokens.push_back(current_token);
-                current_token.clear();
+            if (token_start == std::string_view::npos) {
+                token_start = i;
             }
-            tokens.push_back(std::string(1, c));
-            i++;
-        } else if (!in_quotes && isspace(c)) {
-            if (!current_token.empty()) {
-                tokens.push_back(current_token);
-                current_token.clear();
+        } else if (in_quotes) {
+            continue;
+        } else if (c == ';') {
+            endToken(i);
+            if (!statements.back().empty()) {
+                statements.emplace_back();
             }
-            i++;
-        } else {
-            current_token += c;
-            i++;
+        } else if (c == '(' || c == ')' || c == ',') {
+            endToken(i);
+            statements.back().push_back(text.substr(i, 1));
+        } else if (isspace(static_cast<unsigned char>(c))) {
+            endToken(i);
+        } else if (token_start == std::string_view::npos) {
+            token_start = i;
         }
     }
-    
-    if (!current_token.empty()) {
-        tokens.push_back(current_token);
-    }
-    
-    // Debug: Print tokens
-    std::cout << "Tokenized query: ";
-    for (const auto& token : tokens) {
-        std::cout << "'" << token << "' ";
+    endToken(text.size());
+
+    if (statements.back().empty()) {
+        statements.pop_back();
     }
-    std::cout << std::endl;
-    
-    return tokens;
+    return statements;
 }
 
-FieldValue QueryParser::parseValue(const std::string& value_str) {
-    // Try to parse as int
-    try {
-        return std::stoi(value_str);
-    } catch (...) {}
-    
+FieldValue QueryParser::parseValue(std::string_view value_str) {
+    // Try to parse as int; "9.25" must not stop at "9"
+    int int_val = 0;
+    auto [int_end, int_error] = std::from_chars(value_str.data(), value_str.data() + value_str.size(), int_val);
+    if (int_error == std::errc() && int_end == value_str.data() + value_str.size()) {
+        return int_val;
+    }
+
     // Try to parse as float
     try {
-        return std::stof(value_str);
+        std::string number(value_str);
+        size_t used = 0;
+        float float_val = std::stof(number, &used);
+        if (used == number.size()) {
+            return float_val;
+        }
     } catch (...) {}
     
     // Check for boolean
@@ -1051,11 +1504,10 @@ FieldValue QueryParser::parseValue(const std::string& value_str) {
     if (value_str == "false" || value_str == "FALSE") return false;
     
     // Treat as string (remove quotes if present)
-    std::string str = value_str;
-    if (str.front() == '\'' && str.back() == '\'') {
-        str = str.substr(1, str.length() - 2);
+    if (value_str.size() >= 2 && value_str.front() == '\'' && value_str.back() == '\'') {
+        value_str = value_str.substr(1, value_str.size() - 2);
     }
-    return str;
+    return std::string(value_str);
 }
 
 Column::Type QueryParser::parseColumnType(const std::string& type_str) {
@@ -1070,35 +1522,4 @@ Column::Type QueryParser::parseColumnType(const std::string& type_str) {
     
     throw std::runtime_error("Unknown column type: " + type_str);
 }
-std::vector<Record> QueryParser::filterRecordsByColumns(const std::vector<Record>& records, const std::vector<std::string>& columns) {
-    if (columns.size() == 1 && columns[0] == "*") {
-        return records; // Return all columns if "*" is specified
-    }
-
-    std::vector<Record> filtered_records;
-    for (const auto& record : records) {
-        Record filtered_record;
-        for (const auto& col : columns) {
-            // Use the full column name from the query (e.g., "users.name", "orders.order_id")
-            std::string full_col_name = col;
-            // Try the full column name first (e.g., "users.name")
-            if (record.find(full_col_name) != record.end()) {
-                filtered_record[full_col_name] = record.at(full_col_name);
-                continue;
-            }
-            // Try the base column name (e.g., "name", "order_id")
-            size_t dot_pos = col.find('.');
-            if (dot_pos != std::string::npos) {
-                std::string base_col_name = col.substr(dot_pos + 1);
-                if (record.find(base_col_name) != record.end()) {
-                    filtered_record[full_col_name] = record.at(base_col_name);
-                }
-            }
-        }
-        // Only include non-empty records
-        if (!filtered_record.empty()) {
-            filtered_records.push_back(filtered_record);
-        }
-    }
-    return filtered_records;
-}
\ No newline at end of file
+
@@ -2,9 +2,13 @@
 #define QUERY_PARSER_H
 
 #include "database_manager.h"
+#include "operators.h"
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <mutex>
 #include <variant>
 #include <tuple>
 
@@ -21,7 +25,13 @@ enum class QueryType {
     INSERT,
     SELECT,
     UPDATE,
-    DELETE_OP
+    DELETE_OP,
+    VACUUM,
+    PREPARE,
+    EXECUTE,
+    DEALLOCATE,
+    COPY,
+    ANALYZE
 };
 
 struct Condition {
@@ -30,6 +40,19 @@ struct Condition {
     FieldValue value;
 };
 
+// A '?' in a prepared statement, and where the parameter bound to it goes
+struct Placeholder {
+    int condition = -1;                  // Index into Query::conditions, or -1 for a value
+    std::string column;                  // Key into Query::values, or the column of an INSERT value
+    Column::Type type = Column::UNKNOWN; // Column type an INSERT value is converted to
+    int row = -1;                        // INSERT: the value is rows[row][ordinal]
+    int ordinal = -1;
+};
+
+struct PreparedStatement;
+struct LogicalNode;
+struct CachedPlan;
+
 struct Query {
     QueryType type;
     std::string database_name;
@@ -39,44 +62,107 @@ struct Query {
     std::string primary_key;
     std::map<std::string, std::pair<std::string, std::string>> foreign_keys; // col -> (ref_table, ref_col)
     std::map<std::string, FieldValue> values;
+    std::vector<Row> rows; // INSERT: one schema-ordered row per VALUES tuple
     std::vector<Condition> conditions;
     std::vector<std::string> condition_operators;
     std::vector<std::string> select_columns; // Added for SELECT column selection
+    std::vector<std::string> group_by;
+    std::vector<std::pair<std::string, bool>> order_by; // column, descending
+    int limit = -1; // -1 when there is no LIMIT
+    int offset = 0;
+    bool explain = false; // EXPLAIN SELECT: the plan is returned instead of the rows
     // Join-related fields
     Condition join_condition;
+    // PREPARE / EXECUTE / DEALLOCATE
+    std::string statement_name;
+    std::shared_ptr<PreparedStatement> prepared; // PREPARE: the statement to keep
+    std::vector<FieldValue> parameters;    // EXECUTE: one value per placeholder, in order
+    std::vector<Placeholder> placeholders; // The '?' of a prepared statement in order of appearance
+    std::shared_ptr<CachedPlan> cached_plan; // A prepared SELECT: its plan, shared by each EXECUTE
+    // COPY: the file to load and how it is laid out
+    std::string file_path;
+    CopyOptions copy_options;
     // New fields for structured response
-    std::vector<Record> results;
+    RowSet results;
     std::string error_message;
-    int records_found;
+    int records_found = 0;
+    // A SELECT executed for streaming leaves its rows here instead of in results; the caller
+    // drains it (it holds the database lock until destroyed) and, if it produced no rows,
+    // reports empty_message as the error message
+    std::shared_ptr<RowOperator> cursor;
+    std::string empty_message;
+};
+
+// A statement kept by PREPARE. Parsed and validated once; each EXECUTE copies the query and
+// binds its parameters. If tables have been created or dropped since (schema_version is the
+// DatabaseManager's at the last check), the text is parsed and validated again first. A SELECT
+// also keeps the plan the optimizer chose for it (see CachedPlan).
+struct PreparedStatement {
+    Query query;
+    std::string text;
+    uint64_t schema_version = 0;
+};
+
+// Prepared statements by name. One set may be shared by the parsers of a session or server,
+// which may run on several threads; statements is only used with mutex held.
+struct PreparedStatements {
+    std::mutex mutex;
+    std::map<std::string, PreparedStatement> statements;
 };
 
 class QueryParser {
 public:
     Query current_query;
-    QueryParser(DatabaseManager& db_manager);
+    // PREPARE stores statements in prepared, or in the parser itself when it is null
+    QueryParser(DatabaseManager& db_manager, PreparedStatements* prepared = nullptr);
+    // Lexes the ';'-separated statements in one pass and parses each into a Query of its own;
+    // false, with current_query.error_message set, at the first statement that does not parse
     bool parse(const std::string& query_string);
-    bool execute();
+    // Runs the statements built by parse() in order, without looking at the text again. With
+    // stream_results, the rows of a final SELECT are left in current_query.cursor for the
+    // caller to read batch by batch, so they are never all in memory at once
+    bool execute(bool stream_results = false);
+    // Stands in for parse("EXECUTE name (...)") with parameters that are already values, as
+    // sent by the HTTP /execute endpoint; false if there is no such prepared statement
+    bool bind(const std::string& name, std::vector<FieldValue> parameters);
 
 private:
+    using Tokens = std::vector<std::string_view>;
+
     DatabaseManager& db_manager;
-    std::vector<std::string> commands;
-    
+    PreparedStatements own_prepared;
+    PreparedStatements& prepared;
+    std::vector<Query> statements;
 
     // Parsing methods
-    bool parseCreateDatabase(const std::vector<std::string>& tokens);
-    bool parseDropDatabase(const std::vector<std::string>& tokens);
-    bool parseUseDatabase(const std::vector<std::string>& tokens);
-    bool parseCreateTable(const std::vector<std::string>& tokens);
-    bool parseDropTable(const std::vector<std::string>& tokens);
-    bool parseInsert(const std::vector<std::string>& tokens);
-    bool parseSelect(const std::vector<std::string>& tokens);
-    bool parseUpdate(const std::vector<std::string>& tokens);
-    bool parseDelete(const std::vector<std::string>& tokens);
-    std::vector<Record> filterRecordsByColumns(const std::vector<Record>& records, const std::vector<std::string>& columns);
+    bool parseCreateDatabase(const Tokens& tokens);
+    bool parseDropDatabase(const Tokens& tokens);
+    bool parseUseDatabase(const Tokens& tokens);
+    bool parseCreateTable(const Tokens& tokens);
+    bool parseDropTable(const Tokens& tokens);
+    bool parseInsert(const Tokens& tokens);
+    bool parseSelect(const Tokens& tokens);
+    bool parseUpdate(const Tokens& tokens);
+    bool parseDelete(const Tokens& tokens);
+    bool parseVacuum(const Tokens& tokens);
+    bool parsePrepare(const Tokens& tokens);
+    bool parseExecute(const Tokens& tokens);
+    bool parseDeallocate(const Tokens& tokens);
+    bool parseCopy(const Tokens& tokens);
+    bool parseAnalyze(const Tokens& tokens);
+    // Parses one statement of any kind into current_query
+    bool parseStatement(const Tokens& tokens);
+    // Replaces the EXECUTE in current_query with its prepared statement, parameters bound
+    bool bindPrepared();
+    // The SELECT in current_query as a logical plan for the optimizer
+    std::unique_ptr<LogicalNode> buildLogicalPlan() const;
 
     // Helper methods
-    std::vector<std::string> tokenize(const std::string& query);
-    FieldValue parseValue(const std::string& value_str);
+    // Splits text into statements at ';' and each statement into tokens: '(', ')' and ','
+    // on their own, everything else separated by whitespace. Quoted text stays in one token.
+    // The tokens point into text.
+    static std::vector<Tokens> lex(std::string_view text);
+    FieldValue parseValue(std::string_view value_str);
     Column::Type parseColumnType(const std::string& type_str);
 };
 
@@ -0,0 +1,81 @@
+#include "statistics.h"
+#include <fstream>
+#include <iterator>
+
+void DistinctCounter::add(uint64_t hash) {
+    if (smallest.size() == DISTINCT_SKETCH_SIZE && hash >= *smallest.rbegin()) {
+        return;
+    }
+    if (smallest.insert(hash).second && smallest.size() > DISTINCT_SKETCH_SIZE) {
+        smallest.erase(std::prev(smallest.end()));
+    }
+}
+
+uint64_t DistinctCounter::estimate() const {
+    if (smallest.size() < DISTINCT_SKETCH_SIZE) {
+        return smallest.size();
+    }
+    // The K-th smallest of n uniform hashes lies near K / n of the hash range
+    double fraction = (static_cast<double>(*smallest.rbegin()) + 1.0) / 18446744073709551616.0;
+    return static_cast<uint64_t>((DISTINCT_SKETCH_SIZE - 1) / fraction);
+}
+
+void Statistics::load(const std::string& path) {
+    tables.clear();
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return;
+    }
+    int table_count = 0;
+    file.read(reinterpret_cast<char*>(&table_count), sizeof(table_count));
+    for (int i = 0; i < table_count && file; i++) {
+        int name_length = 0;
+        file.read(reinterpret_cast<char*>(&name_length), sizeof(name_length));
+        std::string name(name_length, '\0');
+        file.read(&name[0], name_length);
+
+        TableStatistics table;
+        file.read(reinterpret_cast<char*>(&table.rows), sizeof(table.rows));
+        file.read(reinterpret_cast<char*>(&table.pages), sizeof(table.pages));
+        file.read(reinterpret_cast<char*>(&table.key_clustering), sizeof(table.key_clustering));
+        int column_count = 0;
+        file.read(reinterpret_cast<char*>(&column_count), sizeof(column_count));
+        for (int j = 0; j < column_count && file; j++) {
+            ColumnStatistics column;
+            file.read(reinterpret_cast<char*>(&column.distinct), sizeof(column.distinct));
+            file.read(reinterpret_cast<char*>(&column.has_range), sizeof(column.has_range));
+            file.read(reinterpret_cast<char*>(&column.min), sizeof(column.min));
+            file.read(reinterpret_cast<char*>(&column.max), sizeof(column.max));
+            table.columns.push_back(column);
+        }
+        if (file) {
+            tables[name] = table;
+        }
+    }
+}
+
+void Statistics::save(const std::string& path) const {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        return;
+    }
+    int table_count = tables.size();
+    file.write(reinterpret_cast<const char*>(&table_count), sizeof(table_count));
+    for (const auto& [name, table] : tables) {
+        int name_length = name.size();
+        file.write(reinterpret_cast<const char*>(&name_length), sizeof(name_length));
+        file.write(name.c_str(), name_length);
+
+        file.write(reinterpret_cast<const char*>(&table.rows), sizeof(table.rows));
+        file.write(reinterpret_cast<const char*>(&table.pages), sizeof(table.pages));
+        file.write(reinterpret_cast<const char*>(&table.key_clustering), sizeof(table.key_clustering));
+        int column_count = table.columns.size();
+        file.write(reinterpret_cast<const char*>(&column_count), sizeof(column_count));
+        for (const auto& column : table.columns) {
+            file.write(reinterpret_cast<const char*>(&column.distinct), sizeof(column.distinct));
+            file.write(reinterpret_cast<const char*>(&column.has_range), sizeof(column.has_range));
+            file.write(reinterpret_cast<const char*>(&column.min), sizeof(column.min));
+            file.write(reinterpret_cast<const char*>(&column.max), sizeof(column.max));
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Hashes a distinct-value estimate keeps; up to this many distinct values are counted exactly
+constexpr size_t DISTINCT_SKETCH_SIZE = 1024;
+
+// Per-column figures gathered by ANALYZE
+struct ColumnStatistics {
+    uint64_t distinct = 0;  // Estimated number of distinct values
+    bool has_range = false; // INT and FLOAT columns: smallest and largest value
+    double min = 0;
+    double max = 0;
+};
+
+// What the optimizer knows about a table. ANALYZE stores the row count it saw with the
+// column figures; the optimizer combines them with the live row and page counts.
+struct TableStatistics {
+    uint64_t rows = 0;
+    uint32_t pages = 0;
+    // How closely the stored row order follows the primary key: 1 when every row follows one
+    // with a smaller key, 0 when the order is unrelated (or unknown)
+    double key_clustering = 0;
+    std::vector<ColumnStatistics> columns; // Schema order; empty if the table was never analyzed
+};
+
+// Estimates the number of distinct values from the smallest value hashes seen (K minimum
+// values). Exact up to DISTINCT_SKETCH_SIZE values, within a few percent beyond.
+class DistinctCounter {
+public:
+    // hash must be spread over the full 64 bits
+    void add(uint64_t hash);
+    uint64_t estimate() const;
+
+private:
+    std::set<uint64_t> smallest;
+};
+
+// Statistics of the tables of one database, kept in a file next to its catalog
+class Statistics {
+public:
+    void load(const std::string& path);
+    void save(const std::string& path) const;
+    std::map<std::string, TableStatistics> tables;
+};
+
+#endif
@@ -0,0 +1,395 @@
+#include "wal.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr uint32_t WAL_RECORD_MAGIC = 0x4C41574C; // "LWAL"
+constexpr uint8_t WAL_PAGE = 1;
+constexpr uint8_t WAL_COMMIT = 2;
+constexpr uint8_t WAL_UNDO = 3;
+
+struct WalRecordHeader {
+    uint32_t magic;
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t length;   // Payload bytes following the header
+    uint32_t checksum; // FNV-1a of the payload, catches a torn tail after a crash
+    uint64_t lsn;
+};
+
+uint32_t checksum(const char* data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ static_cast<uint8_t>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+bool syncStream(FILE* stream) {
+    if (std::fflush(stream) != 0) {
+        return false;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(stream)) == 0;
+#else
+    return fsync(fileno(stream)) == 0;
+#endif
+}
+
+// A page image waiting for its commit record during recovery
+struct PendingPage {
+    std::string file_path;
+    uint32_t page_no;
+    std::string image;
+};
+
+// A committed page image to restore if its statement never commits
+struct UndoPage {
+    std::string file_path;
+    uint32_t page_no;
+    uint64_t committed_size;
+    std::string image;
+};
+
+} // namespace
+
+bool syncFileToDisk(const std::string& path) {
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool ok = FlushFileBuffers(handle) != 0;
+    CloseHandle(handle);
+    return ok;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#endif
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    close();
+}
+
+bool WriteAheadLog::open(const std::string& log_path) {
+    close();
+    path = log_path;
+
+    if (std::filesystem::exists(path) && !recover()) {
+        std::cerr << "Error: Failed to replay write-ahead log: " << path << std::endl;
+        return false;
+    }
+
+    // Everything in the old log is now in the data files
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Error: Failed to open write-ahead log: " << path << std::endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    buffer.clear();
+    durable_lsn = next_lsn - 1;
+    file_size = 0;
+    if (write_failed) {
+        lost_to = next_lsn - 1;
+        write_failed = false;
+    }
+    return true;
+}
+
+void WriteAheadLog::close() {
+    std::unique_lock<std::mutex> lock(mutex);
+    flushed.wait(lock, [this] { return !flushing; });
+    if (file) {
+        std::fwrite(buffer.data(), 1, buffer.size(), file);
+        syncStream(file);
+        std::fclose(file);
+        file = nullptr;
+    }
+    buffer.clear();
+    durable_lsn = next_lsn - 1;
+}
+
+uint64_t WriteAheadLog::appendPage(const std::string& file_path, uint32_t page_no, const Page& page) {
+    uint16_t path_length = static_cast<uint16_t>(file_path.size());
+    std::string payload;
+    payload.reserve(sizeof(page_no) + sizeof(path_length) + path_length + sizeof(Page));
+    payload.append(reinterpret_cast<const char*>(&page_no), sizeof(page_no));
+    payload.append(reinterpret_cast<const char*>(&path_length), sizeof(path_length));
+    payload.append(file_path, 0, path_length);
+    payload.append(reinterpret_cast<const char*>(&page), sizeof(Page));
+    return appendRecord(WAL_PAGE, payload);
+}
+
+uint64_t WriteAheadLog::appendUndo(const std::string& file_path, uint32_t page_no, uint64_t committed_size,
+    const std::string& image) {
+    uint16_t path_length = static_cast<uint16_t>(file_path.size());
+    std::string payload;
+    payload.reserve(sizeof(page_no) + sizeof(path_length) + path_length + sizeof(committed_size) + image.size());
+    payload.append(reinterpret_cast<const char*>(&page_no), sizeof(page_no));
+    payload.append(reinterpret_cast<const char*>(&path_length), sizeof(path_length));
+    payload.append(file_path, 0, path_length);
+    payload.append(reinterpret_cast<const char*>(&committed_size), sizeof(committed_size));
+    payload.append(image);
+    return appendRecord(WAL_UNDO, payload);
+}
+
+uint64_t WriteAheadLog::appendCommit() {
+    return appendRecord(WAL_COMMIT, std::string());
+}
+
+uint64_t WriteAheadLog::appendRecord(uint8_t type, const std::string& payload) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) {
+        return 0;
+    }
+    if (write_failed) {
+        return next_lsn++;
+    }
+
+    WalRecordHeader header{};
+    header.magic = WAL_RECORD_MAGIC;
+    header.type = type;
+    header.length = static_cast<uint32_t>(payload.size());
+    header.checksum = checksum(payload.data(), payload.size());
+    header.lsn = next_lsn++;
+
+    buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    buffer.append(payload);
+    if (type == WAL_PAGE) {
+        stats.page_records++;
+    } else if (type == WAL_UNDO) {
+        stats.undo_records++;
+    } else {
+        stats.commits++;
+    }
+    return header.lsn;
+}
+
+bool WriteAheadLog::flushTo(uint64_t lsn) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (file && !write_failed && durable_lsn < lsn) {
+        if (flushing) {
+            // Another thread is syncing; its batch may already cover this record
+            flushed.wait(lock);
+            continue;
+        }
+
+        // Become the leader: write and sync everything appended so far in one go
+        flushing = true;
+        std::string batch;
+        batch.swap(buffer);
+        uint64_t target = next_lsn - 1;
+        FILE* stream = file;
+        lock.unlock();
+
+        bool ok = std::fwrite(batch.data(), 1, batch.size(), stream) == batch.size() && syncStream(stream);
+
+        lock.lock();
+        flushing = false;
+        if (ok) {
+            durable_lsn = target;
+            file_size += batch.size();
+            stats.syncs++;
+        } else {
+            // The batch may be partly in the file, so nothing can safely follow it
+            std::cerr << "Error: Failed to sync write-ahead log: " << path << std::endl;
+            write_failed = true;
+            lost_from = durable_lsn + 1;
+            buffer.clear();
+        }
+        flushed.notify_all();
+    }
+    // The log may have been reopened since, so a failed write is also told by the lost range
+    bool lost = lost_from != 0 && lsn >= lost_from && (write_failed || lsn <= lost_to);
+    return !lost && durable_lsn >= lsn;
+}
+
+void WriteAheadLog::truncate() {
+    std::unique_lock<std::mutex> lock(mutex);
+    flushed.wait(lock, [this] { return !flushing; });
+    if (!file || write_failed) {
+        return;
+    }
+    std::fclose(file);
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Error: Failed to truncate write-ahead log: " << path << std::endl;
+    }
+    buffer.clear();
+    durable_lsn = next_lsn - 1;
+    file_size = 0;
+    flushed.notify_all();
+}
+
+uint64_t WriteAheadLog::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return file_size + buffer.size();
+}
+
+bool WriteAheadLog::failed() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return write_failed;
+}
+
+WalStats WriteAheadLog::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+bool WriteAheadLog::recover() {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+
+    std::vector<PendingPage> pending;
+    std::vector<UndoPage> undo;
+    std::map<std::string, std::unique_ptr<std::fstream>> targets;
+    int replayed = 0;
+    bool written = true; // Every image and resize reached the disk; otherwise the log is kept
+
+    auto writeImage = [&targets, &written](const std::string& file_path, uint32_t page_no, const std::string& image) {
+        auto& target = targets[file_path];
+        if (!target) {
+            // Files removed after the log was written belong to dropped tables
+            if (!std::filesystem::exists(file_path)) {
+                return false;
+            }
+            target = std::make_unique<std::fstream>(file_path, std::ios::binary | std::ios::in | std::ios::out);
+        }
+        target->seekp(static_cast<std::streamoff>(page_no) * PAGE_SIZE);
+        target->write(image.data(), image.size());
+        written = written && static_cast<bool>(*target);
+        return true;
+    };
+
+    // Replay statement by statement; a trailing statement without a commit record is dropped
+    WalRecordHeader header;
+    std::string payload;
+    while (in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        if (header.magic != WAL_RECORD_MAGIC) {
+            break;
+        }
+        payload.resize(header.length);
+        if (!in.read(&payload[0], header.length) || checksum(payload.data(), payload.size()) != header.checksum) {
+            break;
+        }
+        next_lsn = std::max(next_lsn, header.lsn + 1);
+
+        if (header.type == WAL_PAGE) {
+            uint32_t page_no;
+            uint16_t path_length;
+            if (payload.size() < sizeof(page_no) + sizeof(path_length)) {
+                break;
+            }
+            std::memcpy(&page_no, payload.data(), sizeof(page_no));
+            std::memcpy(&path_length, payload.data() + sizeof(page_no), sizeof(path_length));
+            size_t image_start = sizeof(page_no) + sizeof(path_length) + path_length;
+            if (payload.size() != image_start + sizeof(Page)) {
+                break;
+            }
+            pending.push_back(PendingPage{ payload.substr(sizeof(page_no) + sizeof(path_length), path_length),
+                page_no, payload.substr(image_start) });
+            continue;
+        }
+
+        if (header.type == WAL_UNDO) {
+            uint32_t page_no;
+            uint16_t path_length;
+            uint64_t committed_size;
+            if (payload.size() < sizeof(page_no) + sizeof(path_length)) {
+                break;
+            }
+            std::memcpy(&page_no, payload.data(), sizeof(page_no));
+            std::memcpy(&path_length, payload.data() + sizeof(page_no), sizeof(path_length));
+            size_t size_start = sizeof(page_no) + sizeof(path_length) + path_length;
+            size_t image_start = size_start + sizeof(committed_size);
+            if (payload.size() != image_start && payload.size() != image_start + sizeof(Page)) {
+                break;
+            }
+            std::memcpy(&committed_size, payload.data() + size_start, sizeof(committed_size));
+            undo.push_back(UndoPage{ payload.substr(sizeof(page_no) + sizeof(path_length), path_length),
+                page_no, committed_size, payload.substr(image_start) });
+            continue;
+        }
+
+        for (const auto& page : pending) {
+            if (writeImage(page.file_path, page.page_no, page.image)) {
+                replayed++;
+            }
+        }
+        pending.clear();
+        undo.clear();
+    }
+
+    // Whatever is left belongs to a statement cut short by the crash: put back the committed
+    // images of the pages it wrote early and drop the pages it added
+    std::map<std::string, uint64_t> committed_sizes;
+    int rolled_back = 0;
+    for (const auto& page : undo) {
+        auto size = committed_sizes.emplace(page.file_path, page.committed_size).first;
+        size->second = std::min(size->second, page.committed_size);
+        if (!page.image.empty() && writeImage(page.file_path, page.page_no, page.image)) {
+            rolled_back++;
+        }
+    }
+
+    for (auto& [file_path, target] : targets) {
+        if (target) {
+            target->close();
+            written = written && static_cast<bool>(*target);
+        }
+    }
+    for (const auto& [file_path, committed_size] : committed_sizes) {
+        std::error_code error;
+        uint64_t current_size = std::filesystem::file_size(file_path, error);
+        if (!error && current_size > committed_size) {
+            std::filesystem::resize_file(file_path, committed_size, error);
+            written = written && !error;
+            rolled_back++;
+        }
+    }
+    for (auto& [file_path, target] : targets) {
+        if (target) {
+            written = syncFileToDisk(file_path) && written;
+        }
+    }
+    for (const auto& [file_path, committed_size] : committed_sizes) {
+        if (!targets.count(file_path) && std::filesystem::exists(file_path)) {
+            written = syncFileToDisk(file_path) && written;
+        }
+    }
+    if (!written) {
+        std::cerr << "Error: Failed to write recovered pages back to the data files" << std::endl;
+        return false;
+    }
+    if (replayed > 0) {
+        std::cout << "Recovered " << replayed << " pages from write-ahead log: " << path << std::endl;
+    }
+    if (rolled_back > 0) {
+        std::cout << "Rolled back an unfinished statement from write-ahead log: " << path << std::endl;
+    }
+    return true;
+}
@@ -0,0 +1,86 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include "page.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+constexpr uint64_t WAL_CHECKPOINT_SIZE = 16 * 1024 * 1024; // Checkpoint once the log passes 16MB
+
+struct WalStats {
+    uint64_t page_records = 0;
+    uint64_t undo_records = 0; // Before-images of pages written back ahead of their commit
+    uint64_t commits = 0;
+    uint64_t syncs = 0; // fsync calls; fewer than commits when commits are grouped
+};
+
+// Redo log of page after-images. Each statement appends the pages it dirtied followed by a
+// commit record; the buffer pool writes a page back only after its image is durable, so the
+// data and index files can be written lazily and are repaired from the log after a crash.
+// A page written back before its statement commits is preceded by its committed image,
+// which recovery puts back if the commit record never made it to the log.
+//
+// Commits are grouped: a thread waiting for durability either performs one write + fsync
+// covering every record appended so far, or waits for the sync already in progress.
+class WriteAheadLog {
+public:
+    WriteAheadLog() = default;
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Replays committed page images left in an existing log and rolls back an unfinished
+    // statement, then starts a new one
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return file != nullptr; }
+
+    // All return the LSN of the appended record, 0 if the log is closed
+    uint64_t appendPage(const std::string& file_path, uint32_t page_no, const Page& page);
+    // committed_size is the file's length at the last commit; an empty image means the page
+    // lies past it
+    uint64_t appendUndo(const std::string& file_path, uint32_t page_no, uint64_t committed_size,
+        const std::string& image);
+    uint64_t appendCommit();
+
+    // Blocks until every record up to lsn is on disk; false if the log could not be written
+    bool flushTo(uint64_t lsn);
+    // Drops all records; only valid once the pages they describe are on disk
+    void truncate();
+    // Set once a write or sync of the log has failed. Records appended since are dropped and
+    // never become durable, until the log is opened again.
+    bool failed() const;
+
+    uint64_t size() const;
+    WalStats getStats() const;
+
+private:
+    std::string path;
+    FILE* file = nullptr;
+    std::string buffer;        // Appended records not yet written
+    uint64_t next_lsn = 1;
+    uint64_t durable_lsn = 0;
+    uint64_t file_size = 0;
+    bool flushing = false;
+    bool write_failed = false;
+    // Records from lost_from on were dropped by the last failed write; lost_to is the last of
+    // them once the log has been opened again
+    uint64_t lost_from = 0;
+    uint64_t lost_to = 0;
+    WalStats stats;
+
+    mutable std::mutex mutex;
+    std::condition_variable flushed;
+
+    uint64_t appendRecord(uint8_t type, const std::string& payload);
+    bool recover();
+};
+
+// Forces a file's written data to stable storage
+bool syncFileToDisk(const std::string& path);
+
+#endif